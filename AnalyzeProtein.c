@@ -8,285 +8,9643 @@
  *
  * @section DESCRIPTION
  * The system keeps track of the cooking times.
- * Input  : pdb files.
+ * Input  : pdb, mmCIF and BinaryCIF files.
  * Process: reads the files responsible for parsing the lines gets the
  * relevants parameters and calculates equations with them.
  * Output : prints the results to the screen.
+ * Gzip and zstd inputs are decompressed on the fly when built with
+ * -DHAVE_ZLIB -lz and -DHAVE_ZSTD -lzstd.
+ * The pairwise distances of large frames run on a GPU when built with
+ * -DHAVE_OFFLOAD -fopenmp and an offload target (-foffload=nvptx-none, amdgcn-amdhsa).
  */
 
 //************************************  includes ***********************************************
+#define _POSIX_C_SOURCE 200809L //posix_memalign, getline
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
+#include <strings.h> //strncasecmp
 #include <math.h>
+#include <float.h>
+#include <limits.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef HAVE_OFFLOAD
+#include <omp.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#define X86_KERNELS
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#define NEON_KERNELS
+#include <arm_neon.h>
+#endif
 
 //************************************* define **********************************************
-#define MAX_ATOMS 20000
-#define MAX_LINE 80
 #define COORDINATES 3
 #define END_OF_STRING '\0'
 #define LINE_STARTER "ATOM  "
 #define LINE_STARTER_LEN 6
+#define HETATM_STARTER "HETATM"
+#define NAME_FIELD 12 //the atom name columns 13-16
+#define NAME_LEN 4
+#define CHAIN_FIELD 21 //the chain identifier column 22
+#define RESIDUE_FIELD 22 //the residue sequence number columns 23-26
+#define RESIDUE_LEN 4
+#define ELEMENT_FIELD 76 //the element symbol columns 77-78, right justified
+#define ELEMENT_LEN 2
+#define ELEMENT_LETTERS 27 //a blank and A-Z, for the second letter of the symbol
+#define ELEMENT_INDEX(first, second) (((first) - 'A') * ELEMENT_LETTERS + ((second) == ' ' ? 0 : (second) - 'A' + 1))
+#define ELEMENT_TABLE_SIZE (26 * ELEMENT_LETTERS)
+#define CIF_DATA_STARTER "data_" //the first item of an mmCIF file
+#define CIF_DATA_STARTER_LEN 5
+#define CIF_LOOP "loop_"
+#define CIF_LOOP_LEN 5
+#define CIF_ATOM_SITE "_atom_site." //the prefix of the tags of the atoms loop
+#define CIF_ATOM_SITE_LEN 11
+#define CIF_ATOM_SITE_CATEGORY "_atom_site" //the name of the atoms category of a BinaryCIF file
+#define CIF_ATOM_GROUP "ATOM"
+#define CIF_TEXT_FIELD ';' //a line starting with it starts or ends a text field
+#define CIF_COMMENT '#'
+#define CIF_MAX_COLUMNS 64 //the items of the atoms loop past this are skipped
+#define CIF_VALUE_LEN 31 //the kept characters of a value of the atoms loop
+#define CIF_MAX_ENCODINGS 8 //the encodings of one column of a BinaryCIF file
+#define IS_CIF_BLANK(c) ((c) == ' ' || (c) == '\t' || (c) == '\r' || (c) == '\n')
+#define BCIF_INT8 1 //the types of the ByteArray encoding of BinaryCIF
+#define BCIF_INT16 2
+#define BCIF_INT32 3
+#define BCIF_UINT8 4
+#define BCIF_UINT16 5
+#define BCIF_UINT32 6
+#define BCIF_FLOAT32 32
+#define BCIF_FLOAT64 33
+#define MODEL_STARTER "MODEL "
+#define END_MODEL_STARTER "ENDMDL"
+#define MODEL_SERIAL_FIELD 10 //the model serial columns 11-14
+#define MODEL_SERIAL_LEN 4
+#define NO_MODEL (-1)
+#define INITIAL_FRAMES 4
 #define COORDINATE_LEN 8 //the max len of the coordinate
 #define MIN_LINE_LEN 60
 #define MIN_ARGS 2
 #define ERROR_ARGS
+#define X_FIELD 30 //the coordinates columns 31-38, 39-46 and 47-54
+#define Y_FIELD 38
+#define Z_FIELD 46
+#define COORDINATE_DECIMALS 3 //the coordinates are written as %8.3f
+#define COORDINATE_SCALE 1000.0f
+#define OPTION_PREFIX '-'
+#define DMAX_FLAG "--dmax"
+#define DMAX_HULL "hull"
+#define DMAX_BRUTE_FORCE "brute"
+#define DMAX_APPROXIMATE "approx"
+#define DMAX_PRUNED "pruned"
+#define TOLERANCE_FLAG "--tolerance"
+#define DEFAULT_TOLERANCE 0.01
+#define PARSER_FLAG "--parser"
+#define PARSER_FIXED "fixed"
+#define PARSER_STRTOF "strtof"
+#define JOBS_FLAG "-j"
+#define THREADS_FLAG "-t"
+#define TWO_PASS_FLAG "--two-pass"
+#define DETERMINISTIC_FLAG "--deterministic"
+#define CROSS_CHECK_FLAG "--cross-check"
+#define NO_DMAX_FLAG "--no-dmax"
+#define CACHE_FLAG "--cache"
+#define BENCH_FLAG "--bench"
+#define FORMAT_FLAG "--format"
+#define FORMAT_TEXT_NAME "text"
+#define FORMAT_CSV_NAME "csv"
+#define FORMAT_JSON_NAME "json"
+#define FORMAT_BIN_NAME "bin"
+#define STATS_FLAG "--stats"
+#define STATS_FILE_FLAG "--stats-file"
+#define CONTACTS_FLAG "--contacts"
+#define SHAPE_FLAG "--shape"
+#define SELECT_FLAG "--select"
+#define MASS_FLAG "--mass"
+#define RESULT_CACHE_FLAG "--result-cache"
+#define TRUST_MTIME_FLAG "--trust-mtime"
+#define SERVE_FLAG "--serve"
+#define SOCKET_FLAG "--socket"
+#define SERVE_PAYLOAD '@' //a request "@N" is followed by the N bytes of a file instead of its path
+#define SERVE_PAYLOAD_PATH "<payload>"
+#define SERVE_BACKLOG 8
+#define SERVE_DEPTH_PER_WORKER 2 //the requests read ahead for every worker of the daemon, so none waits for the reader
+#define SELECT_HETATM "hetatm"
+#define SELECT_CHAIN "chain="
+#define SELECT_NAME "name="
+#define SELECT_RESIDUE "resi="
+#define SELECT_SEPARATOR " "
+#define SELECT_LIST_SEPARATOR ","
+#define SELECT_RANGE_SEPARATOR '-'
+#define SELECT_MAX_ITEMS 16 //the names and the residue ranges of a selection
+#define SELECT_MAX_CHAINS 62 //A-Z, a-z and 0-9
+#define NEIGHBORS_FLAG "--neighbors"
+#define NEIGHBORS_HEADER "file,model,atom,neighbors\n"
+#define RMSD_FLAG "--rmsd"
+#define RMSD_HEADER "file_1,model_1,file_2,model_2,rmsd\n"
+#define BENCH_DEFAULT_SIZES "1000,10000,100000,1000000"
+#define SIMD_FLAG "--simd"
+#define SIMD_AUTO "auto"
+#define SIMD_SCALAR "scalar"
+#define SIMD_AVX2 "avx2"
+#define SIMD_AVX512 "avx512"
+#define SIMD_NEON "neon"
+#define DEVICE_FLAG "--device"
+#define DEVICE_AUTO "auto"
+#define DEVICE_CPU "cpu"
+#define DEVICE_GPU "gpu"
+#define USAGE "Usage: AnalyzeProtein [-j N] [-t N] [--dmax hull|brute|approx|pruned] [--tolerance T] [--parser fixed|strtof] " \
+              "[--simd auto|scalar|avx2|avx512|neon] [--device auto|cpu|gpu] [--two-pass] [--deterministic] [--cross-check] [--no-dmax] [--cache] [--stats] [--format text|csv|json|bin] " \
+              "[--stats-file FILE] [--contacts CUTOFF] [--neighbors FILE] [--rmsd FILE] [--shape] " \
+              "[--select \"[hetatm] [chain=A,B] [name=CA,...] [resi=N-M,...]\"] [--mass] " \
+              "[--result-cache DIR [--trust-mtime]] <pdb1> <pdb2>\n" \
+              "       AnalyzeProtein [options] --bench [N1,N2,...]\n" \
+              "       AnalyzeProtein [options] --serve | --socket PATH"
+#define AVX2_WIDTH 8
+#define AVX512_WIDTH 16
+#define NEON_WIDTH 4
+#define DMAX_TILE 256 //atoms per side of a square of pairs handed to a thread
+#define PARALLEL_DMAX_MIN_ATOMS 4096 //below this the threads cost more than the pairs
+#define OFFLOAD_MIN_ATOMS 262144 //below this the copies to the device cost more than the CPU pairs
+#define OFFLOAD_TILE 256 //atoms of a tile held in the memory of a team of the device
+#define RMSD_TILE 32 //structures per side of a square of pairs handed to a thread
+#define RMSD_LANES 4 //the independent double sums of every inner product, one 256 bit vector
+#define RMSD_MAX_ITERATIONS 50 //of Newton's method on the characteristic polynomial
+#define RMSD_PRECISION 1e-11 //the relative change of the eigenvalue that ends Newton's method
+#define INNER_PRODUCTS 9 //xx, xy, xz, yx, yy, yz, zx, zy and zz of two structures
+#define PAIRWISE_BLOCK 64 //the values added one by one at the leaves of the pairwise sums
+#define CROSS_CHECK_TOLERANCE 1e-5 //the relative error allowed to a result above 1, the absolute one below
+#define KERNEL_SETS 3 //the scalar kernels and the vector ones of a CPU
+#define PRUNE_MARGIN 1e-5 //the relative error of the float radii allowed to the bounds of the pruned Dmax
+#define HULL_EPSILON_SCALE 64.0 //multiplies DBL_EPSILON * coordinates extent
+#define HULL_INITIAL_FACES 64
+#define GRID_CELLS_PER_ATOM 4 //the cells are made larger than the cutoff instead of growing above this
+#define CONTACT_CHUNK 64 //cells handed to a thread of the contacts at once
+#define PARALLEL_CONTACTS_MIN_ATOMS 4096
+#define TETRAHEDRON_FACES 4
+#define NO_FACE (-1)
+#define STORE_ALIGNMENT 64 //a cache line, and wide enough for any vector load
+#define STORE_INITIAL_CAPACITY 1024
+#define READ_CHUNK 65536 //for inputs that can't be mapped
+#define STREAM_BUFFER 65536 //the fixed window of the streaming reader, longer lines are cut
+#define NEW_LINE '\n'
+#define COMPRESSION_MAGIC_LEN 4
+#define GZIP_MAGIC "\x1f\x8b"
+#define GZIP_MAGIC_LEN 2
+#define ZSTD_MAGIC "\x28\xb5\x2f\xfd"
+#define ZSTD_MAGIC_LEN 4
+#define DECOMPRESS_BLOCK 131072 //the decompressed bytes handed to the pipe at once
+#define GZIP_WINDOW_BITS (15 + 16) //the largest window of zlib, with the gzip header and trailer
+#define PREFETCH_DEPTH 2 //the file being analyzed and the next one read ahead of it
+#define PREFETCH_PAGE 4096 //one read per page loads a mapped file
+#define BENCH_REPEATS 3 //every phase is timed this many times and the fastest run is kept
+#define BENCH_SEED 2018u
+#define BENCH_DENSITY 0.01 //atoms per cubic angstrom, about the density of a protein
+#define BENCH_LINE_LEN 79 //an ATOM line of the generator with its new line
+#define BALL_VOLUME 4.18879020478639098 //of the unit ball, 4 * pi / 3
+#define TWO_THIRDS_PI 2.09439510239319549
+#define SHAPE_EPSILON 1e-9 //an eigenvector shorter than this, relative to the tensor, is a repeated eigenvalue
+#define TENSOR_TERMS 6 //xx, yy, zz, xy, xz and yz of a symmetric 3 x 3 tensor
+#define BENCH_PATH "<bench>"
+#define NANOSECONDS 1e9
+#define OUTPUT_BUFFER 1048576 //the stdout buffer of the machine formats
+#define ERROR_MESSAGE_LEN 4096
+#define RESULT_MAGIC "APRESULT"
+#define RESULT_MAGIC_LEN 8
+#define RESULT_VERSION 3
+#define CSV_HEADER "file,model,status,atoms,cg_x,cg_y,cg_z,rg,dmax,dmax_upper,contacts," \
+                   "eigen_1,eigen_2,eigen_3,asphericity,axis1_x,axis1_y,axis1_z,axis2_x,axis2_y,axis2_z," \
+                   "axis3_x,axis3_y,axis3_z\n"
+#define MEGABYTE 1e6
+#define CACHE_SUFFIX ".apc" //the sidecar of file.pdb is file.pdb.apc
+#define CACHE_TEMP_SUFFIX_LEN 32 //".apc.<pid>.<serial>.tmp"
+#define CACHE_MAGIC "APCACHE"
+#define CACHE_MAGIC_LEN 8
+#define CACHE_VERSION 1
+#define CACHE_BYTE_ORDER 0x01020304u //a cache of a machine with another byte order is rejected
+#define CACHE_ALIGNMENT 64 //every lane starts on STORE_ALIGNMENT of the mapped file
+#define CACHE_LANE_PADDING 16 //the floats of CACHE_ALIGNMENT bytes
+#define RESULT_CACHE_MAGIC "APRCACHE"
+#define RESULT_INDEX_MAGIC "APRINDEX"
+#define RESULT_CACHE_VERSION 1
+#define RESULT_ENTRY_SUFFIX ".apr" //DIR/<content hash>-<options key>.apr holds the frames of a file
+#define RESULT_INDEX_SUFFIX ".api" //DIR/<path hash>.api holds the content hash of a path and its mtime
+#define RESULT_NAME_LEN 48 //"/", two hashes in hex, "-" and the suffix
+#define HASH_PRIME_1 0x9E3779B185EBCA87ULL //the primes of xxHash64
+#define HASH_PRIME_2 0xC2B2AE3D27D4EB4FULL
+#define HASH_PRIME_3 0x165667B19E3779F9ULL
+#define HASH_PRIME_4 0x85EBCA77C2B2AE63ULL
+#define HASH_PRIME_5 0x27D4EB2F165667C5ULL
+#define HASH_STRIPE 32
+#define HASH_LANES 4
+#define ROTATE_LEFT(value, bits) (((value) << (bits)) | ((value) >> (64 - (bits))))
+
+//*********************************** types ************************************************
+/**
+ * The whole content of an input file, mapped to memory when the file allows it
+ * and read to the heap otherwise (pipes, devices).
+ */
+typedef struct PdbBuffer
+{
+    const char *data;
+    size_t size;
+    int mapped;
+} PdbBuffer;
+
+/**
+ * The atoms coordinates of a file, kept as a structure of arrays.
+ * lane[0], lane[1] and lane[2] are the x, y and z coordinates, each one is
+ * aligned and contiguous so the loops over the atoms stream over plain floats.
+ * The lanes grow geometrically so there is no limit on the number of atoms.
+ */
+typedef struct AtomStore
+{
+    float *lane[COORDINATES];
+    int count;
+    int capacity;
+} AtomStore;
+
+/**
+ * The available engines for the max distance calculation.
+ */
+typedef enum DmaxEngine
+{
+    DMAX_ENGINE_HULL,
+    DMAX_ENGINE_BRUTE_FORCE,
+    DMAX_ENGINE_APPROXIMATE,
+    DMAX_ENGINE_PRUNED
+} DmaxEngine;
+
+/**
+ * The available converters of the coordinates columns.
+ */
+typedef enum CoordinateParser
+{
+    PARSER_FIXED_COLUMNS,
+    PARSER_STRTOF_COLUMNS
+} CoordinateParser;
+
+/**
+ * Gets the lanes of the atoms, an atom and a range of atoms.
+ * Return the max squared distance from the atom to the atoms of the range and
+ * the index of the first atom at that distance, or 0 and -1 for no positive distance.
+ */
+typedef float (*RowMaxKernel)(const float *x, const float *y, const float *z, float px, float py, float pz,
+                              int start, int end, int *farthest);
+
+/**
+ * Gets the lanes of the atoms, their number and a center.
+ * Return the sum of the squared distances of the atoms from the center.
+ */
+typedef float (*RotationSumKernel)(const float *x, const float *y, const float *z, int count,
+                                   float cx, float cy, float cz);
+
+/**
+ * The formats of the results on stdout.
+ */
+typedef enum OutputFormat
+{
+    FORMAT_TEXT, //the lines of the original tool, for people
+    FORMAT_CSV,
+    FORMAT_JSON, //one JSON object per line
+    FORMAT_BIN //a ResultHeader and then fixed size ResultRecords
+} OutputFormat;
+
+/**
+ * The atoms a run keeps, checked on the fixed columns of an ATOM line before its
+ * coordinates are converted. Every filter that is given must match, one of its
+ * items is enough; an empty filter matches every atom.
+ */
+typedef struct Selection
+{
+    int active; //0 takes every ATOM line as the original tool
+    int hetatm; //HETATM lines are atoms too
+    char chains[SELECT_MAX_CHAINS + 1];
+    char names[SELECT_MAX_ITEMS][NAME_LEN + 1];
+    int nameCount;
+    int residues[SELECT_MAX_ITEMS][2]; //the first and the last residue number of every range
+    int residueCount;
+} Selection;
+
+/**
+ * The settings given on the command line.
+ */
+typedef struct Options
+{
+    DmaxEngine engine;
+    double tolerance; //the relative error allowed to the approximate Dmax
+    CoordinateParser parser;
+    int jobs; //the number of files analyzed at the same time
+    int threads; //the number of threads of the max distance of one file
+    const char *simd; //the name of the distance kernels
+    const char *device; //where the pairwise distances run, "auto" offloads the large frames when there is a GPU
+    int twoPass; //Cg and Rg from the stored atoms instead of while parsing
+    int deterministic; //Cg and Rg from the stored atoms by pairwise sums in double, the same for every kernel
+    int crossCheck; //every frame is calculated again by all the engines and kernels and compared
+    int maxDistance; //0 streams the files without storing the atoms and skips Dmax
+    int cache; //read the atoms from the binary sidecar and write it when it is stale
+    OutputFormat format;
+    const char *bench; //the atom counts of the benchmark, NULL for a normal run
+    const char *statsPath; //the JSON lines of the statistics go to this file, "-" for stderr
+    FILE *statsFile; //open statsPath, NULL when there are no statistics
+    float contactCutoff; //the pairs of atoms closer than this are counted, 0 skips the contacts
+    const char *neighborsPath; //the neighbors of every atom go to this file, NULL to skip them
+    const char *rmsdPath; //the RMSD of every pair of structures goes to this file, NULL to skip it
+    int keepAtoms; //Dmax, the contacts, the RMSD or the checks need the stored atoms
+    int shape; //the gyration tensor, its eigenvalues and principal axes
+    Selection selection;
+    int mass; //Cg, Rg and the gyration tensor weighted by the masses of the elements
+    const char *resultCache; //the directory of the result cache, NULL to analyze every file
+    int trustMtime; //a path with the size and the mtime it was hashed at isn't hashed again
+    uint64_t resultKey; //the hash of the options the results depend on
+    int serve; //a daemon, the paths come as requests instead of arguments
+    const char *socketPath; //the Unix socket of the requests, NULL for stdin
+} Options;
+
+/**
+ * The running center and spread of the atoms, updated with every parsed atom
+ * by Welford's method in double so no pass over the stored atoms is needed.
+ * mean is the center of gravity and deviations is the sum of the squared
+ * distances of the atoms from it. comoments are the sums of the products of
+ * the deviations, xx, yy, zz, xy, xz and yz, n times the gyration tensor.
+ * With masses every sum is weighted by the mass of the atom and divided by
+ * the total mass instead of the count.
+ */
+typedef struct Moments
+{
+    long count;
+    double mass; //0 when the atoms have no masses
+    double mean[COORDINATES];
+    double deviations;
+    double comoments[TENSOR_TERMS];
+} Moments;
+
+/**
+ * The outcome of reading and analyzing one file.
+ */
+typedef enum FileStatus
+{
+    FILE_OK,
+    FILE_OPEN_FAILED,
+    FILE_NO_ATOMS,
+    FILE_SHORT_LINE,
+    FILE_BAD_COORDINATE,
+    FILE_NO_MEMORY,
+    FILE_BAD_COMPRESSION,
+    FILE_NO_DECOMPRESSOR,
+    FILE_UNKNOWN_ELEMENT,
+    FILE_BAD_BINARY_CIF,
+    FILE_CROSS_CHECK_FAILED
+} FileStatus;
+
+/**
+ * The formats of the inputs, found by the first bytes of the file.
+ */
+typedef enum Compression
+{
+    COMPRESSION_NONE,
+    COMPRESSION_GZIP,
+    COMPRESSION_ZSTD
+} Compression;
+
+/**
+ * The decompression thread of a compressed input. It reads the mapped
+ * compressed file and writes the text to a pipe, the parser reads the other
+ * end of the pipe so inflating and parsing overlap and the pipe bounds the memory.
+ */
+typedef struct Decompressor
+{
+    Compression compression;
+    const PdbBuffer *source; //the compressed file
+    int sink; //the write end of the pipe
+    int failed; //the compressed data is corrupt or truncated
+} Decompressor;
+
+/**
+ * The phases of the analysis of a file timed by the statistics.
+ */
+typedef enum Phase
+{
+    PHASE_OPEN,
+    PHASE_PARSE,
+    PHASE_MOMENTS, //Cg and Rg of the frames
+    PHASE_DMAX,
+    PHASE_CONTACTS,
+    PHASE_TOTAL,
+    PHASE_COUNT
+} Phase;
+
+/**
+ * A moment of the wall clock and of the CPU clock of the thread, in seconds.
+ */
+typedef struct Stopwatch
+{
+    double wall;
+    double cpu;
+} Stopwatch;
+
+/**
+ * The statistics of one file, or of all the files of the run.
+ * The time of a phase doesn't include the frames that end inside it, so the
+ * phases add up to the total.
+ */
+typedef struct FileStats
+{
+    Stopwatch phase[PHASE_COUNT];
+    long long bytes; //of the text parsed or of the cache
+    long long lines;
+    long long atoms;
+    long long pairs; //the distances calculated by the Dmax
+    int frames;
+} FileStats;
+
+/**
+ * The results of one structure: a whole file, or one MODEL of a multi model
+ * file (NMR ensembles, trajectories).
+ */
+typedef struct FrameResult
+{
+    int model; //the serial of the MODEL record, NO_MODEL for a file without models
+    int atomCount;
+    float gravityCenter[COORDINATES];
+    float rotationRadius;
+    float maxDistance;
+    float maxDistanceBound; //the upper bound of an approximate Dmax, maxDistance when it is exact
+    int hasMaxDistance;
+    int approximate; //the Dmax is only bounded, maxDistanceBound is above it
+    float contactCutoff; //0 when the contacts weren't counted
+    long long contacts; //the pairs of atoms within the cutoff
+    int *neighborCounts; //the contacts of every atom of the frame, NULL unless they are written
+    int hasShape;
+    float eigenvalues[COORDINATES]; //of the gyration tensor, largest first, they add up to Rg^2
+    float asphericity; //the largest eigenvalue less the mean of the other two
+    float axes[COORDINATES][COORDINATES]; //the principal axes, axes[k] of eigenvalues[k], right handed
+} FrameResult;
+
+/**
+ * The start of the binary results, written once before the records.
+ */
+typedef struct ResultHeader
+{
+    char magic[RESULT_MAGIC_LEN];
+    uint32_t version;
+    uint32_t recordSize; //sizeof(ResultRecord)
+} ResultHeader;
+
+/**
+ * One record of the binary results: a frame, or the error of a file.
+ * The records have one size so the results can be mapped as an array.
+ */
+typedef struct ResultRecord
+{
+    int32_t file; //the index of the file among the files of the command line
+    int32_t model; //NO_MODEL for a file without models
+    int32_t status; //a FileStatus, FILE_OK for the results of a frame
+    int32_t atomCount;
+    float gravityCenter[COORDINATES];
+    float rotationRadius;
+    float maxDistance; //NAN when it wasn't calculated
+    float maxDistanceBound; //the upper bound of an approximate Dmax, maxDistance when it is exact
+    int64_t contacts; //-1 when they weren't counted
+    float eigenvalues[COORDINATES]; //NAN, as the asphericity and the axes, without --shape
+    float asphericity;
+    float axes[COORDINATES][COORDINATES];
+    int32_t reserved;
+} ResultRecord;
+
+/**
+ * The results of one file, or the details of its error.
+ * The frames are kept only when the file is printed later by the main thread,
+ * a serial run prints every frame as soon as it ends.
+ */
+typedef struct FileResult
+{
+    FileStatus status;
+    FrameResult *frames;
+    int frameCount;
+    int frameCapacity;
+    unsigned long lineLength; //the length of the short ATOM line
+    char badField[COORDINATE_LEN + 1]; //the coordinate that couldn't be converted, the unknown element or the failed check
+    FileStats stats;
+    int file; //the index of the file among the files of the command line, set by the caller
+    int ready;
+} FileResult;
+
+/**
+ * The start of a coordinates cache file. The cache is valid only for a source
+ * of the same size and modification time.
+ * After the header come the frames, each one is its x, y and z lanes of float32
+ * padded to CACHE_ALIGNMENT, and at tableOffset the table of the frames.
+ */
+typedef struct CacheHeader
+{
+    char magic[CACHE_MAGIC_LEN];
+    uint32_t version;
+    uint32_t byteOrder;
+    int64_t sourceSize;
+    int64_t sourceMtime;
+    int64_t tableOffset;
+    uint32_t frameCount;
+    uint32_t reserved;
+} CacheHeader;
+
+/**
+ * One entry of the frames table of a cache file.
+ */
+typedef struct CacheFrame
+{
+    int32_t model;
+    int32_t atomCount;
+    int64_t offset; //the start of the x lane, the y and z lanes follow it
+} CacheFrame;
+
+/**
+ * A cache file being written next to its source while the source is parsed.
+ * It is written under a temporary name and renamed only when complete, so a
+ * reader never maps a half written cache.
+ */
+typedef struct CacheWriter
+{
+    FILE *file;
+    char *tempPath;
+    CacheFrame *frames;
+    int frameCount;
+    int frameCapacity;
+    int64_t offset;
+    int failed;
+} CacheWriter;
+
+/**
+ * The start of an entry of the result cache, the frames of one file analyzed
+ * with one set of options. The frames follow it as FrameResults of this build,
+ * without their neighbors.
+ */
+typedef struct ResultEntryHeader
+{
+    char magic[CACHE_MAGIC_LEN];
+    uint32_t version;
+    uint32_t frameSize; //sizeof(FrameResult) of the build that wrote it
+    uint64_t contentHash;
+    uint64_t optionsKey;
+    uint32_t frameCount;
+    uint32_t reserved;
+} ResultEntryHeader;
+
+/**
+ * The start of an index file of the result cache, the content hash of a path
+ * at a size and a modification time. The path follows it.
+ */
+typedef struct ResultIndexHeader
+{
+    char magic[CACHE_MAGIC_LEN];
+    uint32_t version;
+    uint32_t pathLength;
+    int64_t sourceSize;
+    int64_t sourceMtime;
+    uint64_t contentHash;
+} ResultIndexHeader;
+
+/**
+ * The frames of a file collected while it is analyzed, for the result cache.
+ */
+typedef struct ResultWriter
+{
+    FrameResult *frames;
+    int frameCount;
+    int frameCapacity;
+    int failed;
+} ResultWriter;
+
+/**
+ * Gets the path of the file, its result and a frame that ended.
+ * Return 0 for success, -1 if the frame couldn't be kept.
+ */
+typedef int (*FrameSink)(const char *path, FileResult *result, const FrameResult *frame);
+
+/**
+ * The formats of the text of an input, found by its first line.
+ */
+typedef enum InputFormat
+{
+    INPUT_UNDETECTED, //only blank and comment lines so far
+    INPUT_PDB,
+    INPUT_CIF //mmCIF, or BinaryCIF found by its first byte
+} InputFormat;
+
+/**
+ * The items of the mmCIF atoms loop that are read, cifFieldNames are their names.
+ */
+typedef enum CifField
+{
+    CIF_GROUP, //ATOM or HETATM
+    CIF_X,
+    CIF_Y,
+    CIF_Z,
+    CIF_MODEL,
+    CIF_SYMBOL,
+    CIF_AUTH_NAME, //the names, the chains and the residues as the PDB file writes them
+    CIF_LABEL_NAME,
+    CIF_AUTH_CHAIN,
+    CIF_LABEL_CHAIN,
+    CIF_AUTH_RESIDUE,
+    CIF_LABEL_RESIDUE,
+    CIF_FIELD_COUNT
+} CifField;
+
+/**
+ * Where the tokenizer of an mmCIF file is between two tokens.
+ */
+typedef enum CifState
+{
+    CIF_OUTSIDE,
+    CIF_LOOP_TAGS, //after loop_, before the first value
+    CIF_ATOM_ROWS, //the values of the _atom_site loop
+    CIF_OTHER_ROWS, //the values of any other loop, skipped
+    CIF_PAIR_VALUE //the value of a single item follows
+} CifState;
+
+/**
+ * The state of the tokenizer of an mmCIF file kept from one line to the next,
+ * a row of the atoms loop may span lines. Only the values of the read items
+ * are copied out of the line.
+ */
+typedef struct CifReader
+{
+    CifState state;
+    int textField; //inside the lines of a text field
+    int atomLoop; //the tags of the loop are _atom_site items
+    int columnCount;
+    int column; //of the next value of the row
+    signed char columnField[CIF_MAX_COLUMNS]; //the CifField of every column, -1 for a skipped item
+    int fieldColumn[CIF_FIELD_COUNT]; //the column of every CifField, -1 when the loop hasn't it
+    char values[CIF_FIELD_COUNT][CIF_VALUE_LEN + 1];
+    int valueLength[CIF_FIELD_COUNT];
+    int model; //of the atoms being read
+    int models; //the models seen so far
+} CifReader;
+
+/**
+ * One atom of an mmCIF or a BinaryCIF file. A text is NULL when the file
+ * hasn't the item or its value is unknown ('?') or inapplicable ('.').
+ */
+typedef struct CifAtom
+{
+    float coordinates[COORDINATES];
+    const char *group;
+    int groupLength;
+    const char *symbol;
+    int symbolLength;
+    const char *name;
+    int nameLength;
+    const char *chain;
+    int chainLength;
+    int residue;
+    int hasResidue;
+    int model;
+    int hasModel;
+} CifAtom;
+
+/**
+ * A decoded column of a BinaryCIF file. The values of a string column are the
+ * indexes of the strings of the rows, -1 for none, and the string k is text
+ * from offsets[k] to offsets[k + 1].
+ */
+typedef struct CifColumn
+{
+    double *values; //NULL when the category hasn't the column
+    int count;
+    double *offsets; //NULL for a numeric column
+    int offsetCount;
+    const char *text;
+    size_t textLength;
+    double *mask; //0 for a present value, NULL when every value is present
+    int maskCount;
+} CifColumn;
+
+/**
+ * The kinds of the MessagePack values of a BinaryCIF file. A string is
+ * a str or a bin, they are read the same.
+ */
+typedef enum MsgKind
+{
+    MSG_INVALID, //an unknown or truncated value
+    MSG_NIL,
+    MSG_BOOLEAN,
+    MSG_NUMBER,
+    MSG_STRING,
+    MSG_ARRAY,
+    MSG_MAP,
+    MSG_EXTENSION
+} MsgKind;
+
+/**
+ * A position in a MessagePack buffer. Readers are copied to come back to a value.
+ */
+typedef struct MsgReader
+{
+    const uint8_t *data;
+    size_t size;
+    size_t position;
+} MsgReader;
+
+/**
+ * Where the atoms of the file being parsed go.
+ * The atoms store and the moments hold the current frame only, they are reset
+ * when the frame ends so every frame reuses the same memory.
+ */
+typedef struct ParseContext
+{
+    const Options *options;
+    const char *path;
+    AtomStore *atoms; //NULL when the atoms aren't kept
+    Moments moments;
+    int model;
+    int frameCount;
+    FrameSink emitFrame;
+    CacheWriter *cache; //NULL when the frames aren't written to a cache
+    ResultWriter *results; //NULL when the frames aren't kept for the result cache
+    struct Workspace *workspace; //the scratch memory of the Dmax of the frames
+    FileStats *stats; //NULL when there are no statistics
+    InputFormat format;
+    CifReader cif; //the tokenizer of an mmCIF file
+} ParseContext;
+
+/**
+ * An opened input file, ready to be parsed. A plain file whose atoms are kept
+ * is held in the buffer, a compressed or streamed file by its descriptor.
+ */
+typedef struct PdbInput
+{
+    int open; //0 if the file couldn't open
+    int noMemory; //the file couldn't be read to the heap
+    int fd; //-1 when the buffer holds the file
+    Compression compression;
+    PdbBuffer buffer;
+} PdbInput;
+
+/**
+ * The reader thread of a serial run. It opens and loads the files ahead of
+ * the analysis to a ring of PREFETCH_DEPTH inputs, so the reads of the next
+ * file wait on the disk while the current file is calculated.
+ * file i goes to inputs[i % PREFETCH_DEPTH]. A file whose results or atoms
+ * come from a cache is skipped, the analysis doesn't read its text.
+ */
+typedef struct Prefetcher
+{
+    char **paths;
+    int fileCount;
+    int keepAtoms;
+    const Options *options;
+    PdbInput inputs[PREFETCH_DEPTH];
+    int skipped[PREFETCH_DEPTH]; //the input of the file wasn't opened, it is cached
+    int loaded; //the files opened by the reader so far
+    int consumed; //the files the analysis is done with
+    int stop;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} Prefetcher;
+
+/**
+ * The files of the command line shared by the workers of the batch.
+ * Workers take the next file under the lock and publish its result, the main
+ * thread waits for the results one by one in the order of the files.
+ */
+typedef struct Batch
+{
+    char **paths;
+    int fileCount;
+    const Options *options;
+    FileResult *results;
+    int nextFile;
+    int stop; //set when a file failed, the files after it are not needed
+    pthread_mutex_t lock;
+    pthread_cond_t resultReady;
+} Batch;
+
+/**
+ * One request of a daemon session, in a slot of the ring of the pool.
+ * The slot keeps its line buffer from request to request.
+ */
+typedef struct ServeRequest
+{
+    char *line; //the path of the file, or "@N" of a payload
+    size_t capacity;
+    const char *path; //line, or SERVE_PAYLOAD_PATH
+    PdbInput payload;
+    int hasPayload;
+    FileResult result;
+} ServeRequest;
+
+/**
+ * The workers of a daemon, started once with a workspace each and kept warm
+ * between all the requests and the connections.
+ * The reader of a session puts the requests in the ring, the workers take
+ * them in order and the writer writes the responses in the same order; the
+ * counters only grow during a session, the slot of request i is i % depth.
+ */
+typedef struct ServePool
+{
+    const Options *options;
+    ServeRequest *requests; //depth slots
+    int depth;
+    int read; //the requests of the session read so far
+    int taken; //the requests handed to a worker
+    int written; //the responses written
+    int ended; //the client sent its last request
+    int failed; //the failed requests of the session
+    int stop; //the daemon ends, the workers leave
+    FileStats total; //of the session
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} ServePool;
+
+/**
+ * A triangle of the convex hull, the vertices are ordered counter clockwise
+ * when looking from outside so the normal points out of the hull.
+ * neighbor[k] is the face across the edge vertex[k] -> vertex[(k + 1) % 3].
+ */
+typedef struct HullFace
+{
+    int vertex[3];
+    int neighbor[3];
+    double normal[3];
+    double offset;
+    int outsideHead; //first point of the conflict list, -1 if empty
+    int alive;
+    int mark;
+} HullFace;
+
+/**
+ * A horizon edge found while looking for the faces a point can see.
+ */
+typedef struct HorizonEdge
+{
+    int from;
+    int to;
+    int outerFace; //the face behind the edge that is not visible
+} HorizonEdge;
+
+/**
+ * The state of the quickhull algorithm.
+ */
+typedef struct Hull
+{
+    HullFace *faces;
+    int faceCount;
+    int faceCapacity;
+    int *nextOutside; //conflict lists linked by point index
+    int *startOf; //new face whose horizon edge starts at the vertex
+    int *stack;
+    HorizonEdge *horizon;
+    int horizonCapacity;
+    int pointCapacity; //the atoms nextOutside and startOf have room for
+    int stackCapacity;
+    double epsilon;
+} Hull;
+
+/**
+ * A uniform grid of cubic cells over the atoms of a frame, a cell list.
+ * The atoms are copied sorted by cell, so the atoms of cell c are the contiguous
+ * range cellStart[c] .. cellStart[c + 1] of atoms, and order[i] is the index in
+ * the frame of the sorted atom i. The cells are numbered x first, then y and z.
+ * A cell is at least as large as the cutoff the grid was built for, so the
+ * atoms within the cutoff of an atom are in its cell and the 26 around it.
+ */
+typedef struct CellGrid
+{
+    AtomStore atoms;
+    int *order;
+    int *cellOf; //the cell of every atom of the frame, used while sorting
+    int atomCapacity;
+    int *cellStart; //cellCount + 1 long
+    int cellCapacity;
+    int cellCount;
+    int dimension[COORDINATES];
+    float origin[COORDINATES];
+    float cellSize;
+} CellGrid;
+
+/**
+ * Gets the data of a neighbor query, two sorted atoms of the grid and their squared distance.
+ * A point query gives -1 as the first atom.
+ */
+typedef void (*NeighborVisitor)(void *data, int first, int second, float squaredDistance);
+
+/**
+ * The cells of a contacts count shared by its threads, every thread takes
+ * the next CONTACT_CHUNK cells with an atomic add.
+ */
+typedef struct ContactCells
+{
+    const CellGrid *grid;
+    float cutoff;
+    int nextCell;
+} ContactCells;
+
+/**
+ * The arguments of one thread of the contacts, and its local results.
+ */
+typedef struct ContactWorker
+{
+    ContactCells *cells;
+    int *neighborCounts; //by sorted atom of the grid, NULL when only the total is counted
+    long long contacts;
+} ContactWorker;
+
+/**
+ * An atom and its distance from the center of the atoms, the order of the pruned Dmax.
+ */
+typedef struct RankedAtom
+{
+    float radius;
+    int atom;
+} RankedAtom;
+
+/**
+ * The memory of one worker (the serial loop or a thread of the -j pool),
+ * kept from file to file. Every buffer only grows, when a larger file than
+ * all before arrives, and starting a new file only resets the counts.
+ */
+typedef struct Workspace
+{
+    AtomStore atoms; //the atoms of the current frame
+    AtomStore hullAtoms; //the hull vertices, copied for the pairs loop
+    AtomStore rankedAtoms; //the atoms from the farthest from the center, copied for the pruned pairs loop
+    AtomStore candidateAtoms; //the atoms that can still be in the farthest pair of the approximate Dmax
+    RankedAtom *ranked; //rankedCapacity long, the order of rankedAtoms
+    int rankedCapacity;
+    Hull hull;
+    int *hullVertices; //pointCapacity long as the conflict lists of the hull
+    int pairedAtoms; //the atoms of the last pairs loop of the Dmax
+    CellGrid grid; //built only by the analyses that query neighbors
+} Workspace;
+
+/**
+ * The two farthest atoms found so far.
+ */
+typedef struct FarthestPair
+{
+    float squaredDistance;
+    int first;
+    int second;
+} FarthestPair;
+
+/**
+ * The triangle of pairs i < j cut to square tiles of DMAX_TILE x DMAX_TILE atoms,
+ * numbered row by row. Every thread takes the next tile with an atomic add, so
+ * a thread that ends its tiles early keeps taking more and the uneven rows balance out.
+ */
+typedef struct PairTiles
+{
+    const AtomStore *atoms;
+    int blockCount; //the number of tiles along a side
+    long tileCount;
+    long nextTile;
+} PairTiles;
+
+/**
+ * The arguments of one thread of the tiled max distance, and its local result.
+ */
+typedef struct PairWorker
+{
+    PairTiles *tiles;
+    FarthestPair best;
+} PairWorker;
+
+/**
+ * One structure kept for the RMSD matrix, a frame of one of the files.
+ * The coordinates are centered on the center of gravity of the frame and held
+ * as a structure of arrays, x, y and z one after the other, every lane padded
+ * with zeros to a multiple of RMSD_LANES so the sums need no tail.
+ */
+typedef struct RmsdStructure
+{
+    float *coordinates;
+    int atomCount;
+    int stride; //the padded length of a lane
+    double squaredNorm; //the sum of the squared centered coordinates
+    int file; //the index of the path the frame was read from
+    int frame; //the order of the frame in the file
+    int model;
+} RmsdStructure;
+
+/**
+ * The structures of every analyzed file, added by the threads of the files
+ * under the lock and sorted by file and frame before the matrix is calculated.
+ */
+typedef struct RmsdSet
+{
+    RmsdStructure *structures;
+    int count;
+    int capacity;
+    pthread_mutex_t lock;
+} RmsdSet;
+
+/**
+ * The triangle of pairs i < j of the structures cut to square tiles of
+ * RMSD_TILE x RMSD_TILE structures, taken by the threads like PairTiles.
+ * The RMSD of i < j goes to the condensed upper triangle, row by row.
+ */
+typedef struct RmsdTiles
+{
+    const RmsdSet *set;
+    float *matrix;
+    int blockCount;
+    long tileCount;
+    long nextTile;
+} RmsdTiles;
 
 
 //*********************************** functions declarations ********************************
-int startsWith(char* line);
-float getFloat(char* input);
-int parseLine(char *fileLine, int atomCounter, float fileAtoms[MAX_ATOMS][COORDINATES]);
-void calCenterOfGravity(int atomCounter, float fileAtoms[MAX_ATOMS][COORDINATES], float gravityCenter[3]);
-void calRotationRadious(int atomCounter, float fileAtoms[MAX_ATOMS][COORDINATES], float gravityCenter[3]);
-void calMaxDistance(int atomCounter, float fileAtoms[MAX_ATOMS][COORDINATES]);
+int startsWith(const char* line);
+int isAtomRecord(const char *line, const Selection *selection);
+int selectAtom(const char *line, const Selection *selection);
+int parseSelection(const char *expression, Selection *selection);
+int parseSelectionItems(const char *key, const char *items, size_t length, Selection *selection);
+int getFloat(char* input, float *result);
+int getFieldFloat(const char *field, float *result);
+int parseCoordinate(const char *field, float *result);
+FileStatus parseLine(const char *fileLine, size_t lineLength, ParseContext *context, FileResult *result);
+FileStatus storeAtom(ParseContext *context, const float coordinates[COORDINATES], float mass);
+int matchSelection(const Selection *selection, const char *chain, int chainLength, const char *name, int nameLength,
+                   int residue, int hasResidue);
+int parseOptions(int argc, char *argv[], Options *options);
+char *cachePath(const char *path);
+int openCache(const char *path, const struct stat *source, PdbBuffer *cache);
+FileStatus analyzeCache(const PdbBuffer *cache, ParseContext *context, FileResult *result);
+int beginCache(const char *path, CacheWriter *writer);
+void writeCacheFrame(CacheWriter *writer, int model, const AtomStore *atoms);
+void endCache(const char *path, const struct stat *source, CacheWriter *writer, int keep);
+uint64_t hashBytes(const void *data, size_t size, uint64_t seed);
+uint64_t hashRound(uint64_t accumulator, uint64_t lane);
+uint64_t hashOptions(const Options *options);
+char *resultCachePath(const char *directory, uint64_t first, uint64_t second, const char *suffix);
+int readContentHash(const char *path, const struct stat *source, const Options *options, uint64_t *hash);
+void writeContentHash(const char *path, const struct stat *source, const Options *options, uint64_t hash);
+int loadResults(uint64_t contentHash, ParseContext *context, FileResult *result);
+void recordResultFrame(ResultWriter *writer, const FrameResult *frame);
+void storeResults(const char *path, const struct stat *source, uint64_t contentHash, const Options *options,
+                  ResultWriter *writer);
+int replaceFile(const char *name, const void *header, size_t headerSize, const void *data, size_t dataSize);
+int analyzeSerial(char *paths[], int fileCount, const Options *options);
+int analyzeParallel(char *paths[], int fileCount, const Options *options);
+int serveRequests(const Options *options);
+void serveConnection(int connection, ServePool *pool);
+int serveSession(FILE *requests, ServePool *pool);
+void *serveWorker(void *poolPointer);
+void *serveWriter(void *poolPointer);
+void readPayload(const char *size, FILE *requests, PdbInput *payload);
+void endResponse(const FileResult *result);
+void freeFileFrames(FileResult *result);
+void *batchWorker(void *batchPointer);
+void analyzeFile(const char *path, PdbInput *input, Workspace *workspace, const Options *options,
+                 FrameSink emitFrame, FileResult *result);
+void initParseContext(ParseContext *context, const char *path, const Options *options, Workspace *workspace,
+                      FrameSink emitFrame);
+void initWorkspace(Workspace *workspace);
+int reserveWorkspace(Workspace *workspace, int atomCount);
+void freeWorkspace(Workspace *workspace);
+void *prefetchWorker(void *prefetcherPointer);
+PdbInput *takePdbInput(Prefetcher *prefetcher, int file);
+int isTextNeeded(const char *path, const Options *options);
+void releasePdbInput(Prefetcher *prefetcher);
+FileStatus finishFrame(ParseContext *context, FileResult *result);
+int printFrame(const char *path, FileResult *result, const FrameResult *frame);
+int keepFrame(const char *path, FileResult *result, const FrameResult *frame);
+int printFileResult(const char *path, const FileResult *result);
+void writeResultHeader(void);
+void writeFrame(const char *path, int file, const FrameResult *frame);
+void writeError(const char *path, const FileResult *result);
+void formatFileError(char *message, size_t size, const char *path, const FileResult *result);
+void printCsvString(FILE *file, const char *text);
+void readClocks(Stopwatch *now);
+void startPhase(const FileStats *stats, Stopwatch *start);
+void endPhase(FileStats *stats, Phase phase, const Stopwatch *start);
+void printFileStats(FILE *file, const char *path, const FileResult *result, FileStats *total);
+void printTotalStats(FILE *file, const FileStats *total, int fileCount, int failed);
+void printPhases(FILE *file, const FileStats *stats);
+void printJsonString(FILE *file, const char *text);
+int openPdbBuffer(const char *path, PdbBuffer *buffer);
+int mapPdbBuffer(int fd, PdbBuffer *buffer);
+int openPdbInput(const char *path, int keepAtoms, PdbInput *input);
+void warmPdbInput(const PdbInput *input);
+FileStatus parsePdbInput(PdbInput *input, ParseContext *context, FileResult *result);
+void closePdbInput(PdbInput *input);
+Compression detectCompression(int fd);
+FileStatus parseCompressed(const PdbBuffer *buffer, Compression compression, ParseContext *context, FileResult *result);
+void *decompressWorker(void *decompressorPointer);
+int writeAll(int fd, const char *data, size_t size);
+#ifdef HAVE_ZLIB
+int inflateGzip(Decompressor *decompressor);
+#endif
+#ifdef HAVE_ZSTD
+int inflateZstd(Decompressor *decompressor);
+#endif
+void closePdbBuffer(PdbBuffer *buffer);
+FileStatus parsePdbBuffer(const PdbBuffer *buffer, ParseContext *context, FileResult *result);
+FileStatus parsePdbStream(int fd, ParseContext *context, FileResult *result);
+FileStatus parseRecord(const char *line, size_t lineLength, ParseContext *context, FileResult *result);
+void initMoments(Moments *moments);
+void addMoments(Moments *moments, float x, float y, float z);
+float momentsRotationRadius(const Moments *moments);
+void addWeightedMoments(Moments *moments, float x, float y, float z, double mass);
+double momentsWeight(const Moments *moments);
+float atomMass(const char *line, size_t lineLength, char element[ELEMENT_LEN + 1]);
+float elementMass(char first, char second);
+void calGyrationShape(const Moments *moments, FrameResult *frame);
+void solveSymmetric3(const double tensor[TENSOR_TERMS], double eigenvalues[3], double axes[3][3]);
+int calEigenvector(const double tensor[TENSOR_TERMS], double eigenvalue, double axis[3]);
+void perpendicularAxis(const double axis[3], double result[3]);
+void crossProduct(const double first[3], const double second[3], double result[3]);
+void initAtomStore(AtomStore *atoms);
+int addAtom(AtomStore *atoms, float x, float y, float z);
+void freeAtomStore(AtomStore *atoms);
+void calCenterOfGravity(const AtomStore *atoms, float gravityCenter[3]);
+float calRotationRadious(const AtomStore *atoms, float gravityCenter[3]);
+void calPairwiseMoments(const AtomStore *atoms, float gravityCenter[3], float *rotationRadius);
+double pairwiseSum(const float *lane, int start, int end);
+double pairwiseSquares(const AtomStore *atoms, const double center[3], int start, int end);
+float calMaxDistance(const AtomStore *atoms, const Options *options, Workspace *workspace, float *upperBound);
+float calMaxDistanceApproximate(const AtomStore *atoms, const Options *options, Workspace *workspace,
+                                float *upperBound);
+float calMaxSquaredDistanceBruteForce(const AtomStore *atoms, int threads);
+float calMaxSquaredDistanceRows(const AtomStore *atoms, RowMaxKernel kernel);
+float calMaxSquaredDistanceHull(const AtomStore *atoms, int threads, Workspace *workspace);
+float calMaxSquaredDistancePruned(const AtomStore *atoms, int threads, Workspace *workspace);
+int compareRankedAtoms(const void *first, const void *second);
+FarthestPair calFarthestPairTiled(const AtomStore *atoms, int threads);
+void *pairWorker(void *workerPointer);
+void locateTile(long tile, int blockCount, int *row, int *column);
+void updateFarthestPair(FarthestPair *best, float squaredDistance, int first, int second);
+int parseCount(const char *value, int *count);
+int runBenchmark(const Options *options);
+int benchSize(int atomCount, const Options *options, Workspace *workspace);
+char *generatePdb(int atomCount, unsigned int seed, size_t *size);
+double wallSeconds(void);
+int discardFrame(const char *path, FileResult *result, const FrameResult *frame);
+int selectKernels(const char *name);
+int listKernels(RowMaxKernel rowMax[KERNEL_SETS], RotationSumKernel rotationSum[KERNEL_SETS]);
+float calDistance(float xCor1, float yCor1, float zCor1, float xCor2, float yCor2, float zCor2);
+float rowMaxScalar(const float *x, const float *y, const float *z, float px, float py, float pz,
+                   int start, int end, int *farthest);
+float rotationSumScalar(const float *x, const float *y, const float *z, int count, float cx, float cy, float cz);
+#ifdef X86_KERNELS
+float rowMaxAvx2(const float *x, const float *y, const float *z, float px, float py, float pz,
+                 int start, int end, int *farthest);
+float rotationSumAvx2(const float *x, const float *y, const float *z, int count, float cx, float cy, float cz);
+float rowMaxAvx512(const float *x, const float *y, const float *z, float px, float py, float pz,
+                   int start, int end, int *farthest);
+float rotationSumAvx512(const float *x, const float *y, const float *z, int count, float cx, float cy, float cz);
+#endif
+#ifdef NEON_KERNELS
+float rowMaxNeon(const float *x, const float *y, const float *z, float px, float py, float pz,
+                 int start, int end, int *farthest);
+float rotationSumNeon(const float *x, const float *y, const float *z, int count, float cx, float cy, float cz);
+#endif
+float reduceRowMax(const float *best, const int *bestIndex, int width, int *farthest);
+int findHullVertices(const AtomStore *atoms, Hull *hull, int *hullVertices);
+double faceDistance(const HullFace *face, const AtomStore *atoms, int atom);
+int addHullFace(Hull *hull, const AtomStore *atoms, int a, int b, int c);
+void assignOutside(Hull *hull, const AtomStore *atoms, int atom, int firstFace);
+int buildTetrahedron(const AtomStore *atoms, Hull *hull);
+int addHullPoint(Hull *hull, const AtomStore *atoms, int start, int eye, int iteration);
+void initCellGrid(CellGrid *grid);
+int buildCellGrid(CellGrid *grid, const AtomStore *atoms, float cutoff);
+void freeCellGrid(CellGrid *grid);
+int gridCell(const CellGrid *grid, float x, float y, float z, int cell[3]);
+void visitNeighbors(const CellGrid *grid, const float point[3], float cutoff, NeighborVisitor visitor, void *data);
+long visitCellPairs(const CellGrid *grid, int firstCell, int lastCell, float cutoff,
+                    NeighborVisitor visitor, void *data);
+long long calContacts(const AtomStore *atoms, float cutoff, int threads, Workspace *workspace, int *neighborCounts);
+void *contactWorker(void *workerPointer);
+void countNeighbor(void *data, int first, int second, float squaredDistance);
+void writeNeighbors(const char *path, const FrameResult *frame);
+void initCifReader(CifReader *reader);
+InputFormat detectFormat(const char *line, size_t lineLength);
+FileStatus parseCifLine(const char *line, size_t lineLength, ParseContext *context, FileResult *result);
+FileStatus parseCifToken(const char *token, size_t length, int quoted, ParseContext *context, FileResult *result);
+void startCifLoop(CifReader *reader);
+FileStatus parseCifRow(ParseContext *context, FileResult *result);
+int cifRowValue(const CifReader *reader, CifField field, const char **text, int *length);
+int parseCifInteger(const char *text, int length, int *value);
+FileStatus addCifAtom(const CifAtom *atom, ParseContext *context, FileResult *result);
+void endCifInput(ParseContext *context);
+int isBinaryCif(const char *data, size_t size);
+FileStatus parseBinaryStream(int fd, const char *start, size_t size, ParseContext *context, FileResult *result);
+FileStatus parseBinaryCif(const char *data, size_t size, ParseContext *context, FileResult *result);
+FileStatus parseBinaryAtoms(MsgReader category, ParseContext *context, FileResult *result);
+FileStatus decodeCifColumn(MsgReader column, CifColumn *decoded);
+FileStatus decodeCifData(MsgReader encoded, int strings, CifColumn *decoded);
+FileStatus decodeCifValues(const uint8_t *raw, size_t rawLength, MsgReader encodings, int strings, CifColumn *decoded);
+FileStatus decodeByteArray(MsgReader step, const uint8_t *raw, size_t rawLength, double **values, size_t *count);
+FileStatus decodeStringArray(MsgReader step, CifColumn *decoded, const uint8_t *raw, size_t rawLength,
+                             double **values, size_t *count);
+FileStatus decodeCifStep(MsgReader step, const char *kind, size_t kindLength, double **values, size_t *count);
+void freeCifColumn(CifColumn *column);
+int cifColumnString(const CifColumn *column, int row, const char **text, int *length);
+int cifColumnInteger(const CifColumn *column, int row, int *value);
+MsgKind readMsgHeader(MsgReader *reader, uint64_t *length, double *number);
+int skipMsgValue(MsgReader *reader);
+int findMsgKey(MsgReader map, const char *key, MsgReader *value);
+int findMsgNumber(MsgReader map, const char *key, double *number);
+int readMsgString(MsgReader *reader, const char **text, size_t *length);
+int readMsgNumber(MsgReader *reader, double *number);
+int equalsText(const char *text, size_t length, const char *expected);
+uint64_t readBigEndian(const uint8_t *bytes, int count);
+
+int keepRmsdStructure(const AtomStore *atoms, const float gravityCenter[3], int file, int frame, int model);
+int compareRmsdStructures(const void *first, const void *second);
+int writeRmsdMatrix(char *paths[], int threads);
+float *calRmsdMatrix(const RmsdSet *set, int threads);
+void *rmsdWorker(void *tilesPointer);
+double calPairRmsd(const RmsdStructure *first, const RmsdStructure *second);
+double solveQcp(const double products[INNER_PRODUCTS], double innerProduct, int atomCount);
+void freeRmsdSet(RmsdSet *set);
+
+int selectDevice(const char *name);
+int uploadAtoms(const AtomStore *atoms, const Options *options);
+void releaseAtoms(const AtomStore *atoms, int resident);
+#ifdef HAVE_OFFLOAD
+float calMaxSquaredDistanceDevice(const AtomStore *atoms);
+long long calContactsDevice(const AtomStore *atoms, const CellGrid *grid, float cutoff, int *neighborCounts);
+#endif
+
+FileStatus crossCheckFrame(const AtomStore *atoms, const Moments *moments, const FrameResult *frame,
+                           const Options *options, Workspace *workspace, char failed[COORDINATE_LEN + 1]);
+int agrees(double value, double reference, double slack);
+long long countContactsBruteForce(const AtomStore *atoms, float cutoff);
+
+//*******************************************************************************************
+
+//makes the temporary names of the caches written at the same time unique
+int cacheSerial = 0;
+
+//the names of the phases and of the statuses in the statistics
+const char *phaseNames[PHASE_COUNT] = {"open", "parse", "cg_rg", "dmax", "contacts", "total"};
+const char *engineNames[] = {DMAX_HULL, DMAX_BRUTE_FORCE, DMAX_APPROXIMATE, DMAX_PRUNED};
+const char *statusNames[] = {"ok", "open_failed", "no_atoms", "short_line", "bad_coordinate", "no_memory",
+                             "bad_compression", "no_decompressor", "unknown_element", "bad_binary_cif",
+                             "cross_check_failed"};
+
+//the items of the atoms loop read from an mmCIF file, by CifField
+const char *cifFieldNames[] = {"group_PDB", "Cartn_x", "Cartn_y", "Cartn_z", "pdbx_PDB_model_num", "type_symbol",
+                               "auth_atom_id", "label_atom_id", "auth_asym_id", "label_asym_id", "auth_seq_id",
+                               "label_seq_id"};
+
+//the standard atomic weights of the elements of the PDB files, by ELEMENT_INDEX of their symbols
+const float elementMasses[ELEMENT_TABLE_SIZE] = {
+    [ELEMENT_INDEX('H', ' ')] = 1.008f, [ELEMENT_INDEX('D', ' ')] = 2.014f, [ELEMENT_INDEX('L', 'I')] = 6.94f,
+    [ELEMENT_INDEX('B', 'E')] = 9.012f, [ELEMENT_INDEX('B', ' ')] = 10.81f, [ELEMENT_INDEX('C', ' ')] = 12.011f,
+    [ELEMENT_INDEX('N', ' ')] = 14.007f, [ELEMENT_INDEX('O', ' ')] = 15.999f, [ELEMENT_INDEX('F', ' ')] = 18.998f,
+    [ELEMENT_INDEX('N', 'A')] = 22.990f, [ELEMENT_INDEX('M', 'G')] = 24.305f, [ELEMENT_INDEX('A', 'L')] = 26.982f,
+    [ELEMENT_INDEX('S', 'I')] = 28.085f, [ELEMENT_INDEX('P', ' ')] = 30.974f, [ELEMENT_INDEX('S', ' ')] = 32.06f,
+    [ELEMENT_INDEX('C', 'L')] = 35.45f, [ELEMENT_INDEX('A', 'R')] = 39.948f, [ELEMENT_INDEX('K', ' ')] = 39.098f,
+    [ELEMENT_INDEX('C', 'A')] = 40.078f, [ELEMENT_INDEX('T', 'I')] = 47.867f, [ELEMENT_INDEX('V', ' ')] = 50.942f,
+    [ELEMENT_INDEX('C', 'R')] = 51.996f, [ELEMENT_INDEX('M', 'N')] = 54.938f, [ELEMENT_INDEX('F', 'E')] = 55.845f,
+    [ELEMENT_INDEX('C', 'O')] = 58.933f, [ELEMENT_INDEX('N', 'I')] = 58.693f, [ELEMENT_INDEX('C', 'U')] = 63.546f,
+    [ELEMENT_INDEX('Z', 'N')] = 65.38f, [ELEMENT_INDEX('G', 'A')] = 69.723f, [ELEMENT_INDEX('A', 'S')] = 74.922f,
+    [ELEMENT_INDEX('S', 'E')] = 78.971f, [ELEMENT_INDEX('B', 'R')] = 79.904f, [ELEMENT_INDEX('R', 'B')] = 85.468f,
+    [ELEMENT_INDEX('S', 'R')] = 87.62f, [ELEMENT_INDEX('M', 'O')] = 95.95f, [ELEMENT_INDEX('A', 'G')] = 107.868f,
+    [ELEMENT_INDEX('C', 'D')] = 112.414f, [ELEMENT_INDEX('S', 'N')] = 118.710f, [ELEMENT_INDEX('I', ' ')] = 126.904f,
+    [ELEMENT_INDEX('X', 'E')] = 131.293f, [ELEMENT_INDEX('C', 'S')] = 132.905f, [ELEMENT_INDEX('B', 'A')] = 137.327f,
+    [ELEMENT_INDEX('G', 'D')] = 157.25f, [ELEMENT_INDEX('Y', 'B')] = 173.045f, [ELEMENT_INDEX('W', ' ')] = 183.84f,
+    [ELEMENT_INDEX('P', 'T')] = 195.084f, [ELEMENT_INDEX('A', 'U')] = 196.967f, [ELEMENT_INDEX('H', 'G')] = 200.592f,
+    [ELEMENT_INDEX('P', 'B')] = 207.2f, [ELEMENT_INDEX('U', ' ')] = 238.029f};
+
+//the format of the results, chosen once by main before any result is written
+OutputFormat outputFormat = FORMAT_TEXT;
+
+//the file of the neighbors of every atom, opened by main when they are asked for
+FILE *neighborsFile = NULL;
+
+//the file of the RMSD matrix, opened by main when it is asked for
+FILE *rmsdFile = NULL;
+
+//the structures of the RMSD matrix, kept while the files are analyzed
+RmsdSet rmsdSet = {NULL, 0, 0, PTHREAD_MUTEX_INITIALIZER};
+
+//the distance kernels, chosen once by selectKernels before any file is read
+RowMaxKernel rowMaxKernel = rowMaxScalar;
+RotationSumKernel rotationSumKernel = rotationSumScalar;
+
+//the frames with at least this many atoms run their pairwise distances on the device, chosen by selectDevice
+int offloadMinAtoms = INT_MAX;
+
+
+/**
+ * Gets relevant arguments for running the program.
+ * Passing over the files calculates the relevant equations by calling to the relevant functions.
+ * Return 0 if the program ran successfuly.
+ * @param argc
+ * @param argv
+ * @return int 0 for success
+ */
+int main(int argc, char *argv[])
+{
+    Options options;
+    int firstFile = parseOptions(argc, argv, &options);
+    int failed;
+
+    if(firstFile < 0)
+    {
+        return 1;
+    }
+    if(selectKernels(options.simd) != 0)
+    {
+        printf("SIMD kernel %s is not supported by this CPU", options.simd);
+        return 1;
+    }
+    if(selectDevice(options.device) != 0)
+    {
+        printf("Device %s is unknown or not available to this build", options.device);
+        return 1;
+    }
+    if(options.statsPath != NULL)
+    {
+        options.statsFile = strcmp(options.statsPath, "-") == 0 ? stderr : fopen(options.statsPath, "w");
+        if(options.statsFile == NULL)
+        {
+            printf("Error opening file: %s", options.statsPath);
+            return 1;
+        }
+    }
+    if(options.resultCache != NULL && mkdir(options.resultCache, 0777) != 0 && errno != EEXIST)
+    {
+        printf("Error opening directory: %s", options.resultCache);
+        return 1;
+    }
+    if(options.neighborsPath != NULL)
+    {
+        neighborsFile = fopen(options.neighborsPath, "w");
+        if(neighborsFile == NULL)
+        {
+            printf("Error opening file: %s", options.neighborsPath);
+            return 1;
+        }
+        fputs(NEIGHBORS_HEADER, neighborsFile);
+    }
+    if(options.rmsdPath != NULL)
+    {
+        rmsdFile = fopen(options.rmsdPath, "w");
+        if(rmsdFile == NULL)
+        {
+            printf("Error opening file: %s", options.rmsdPath);
+            return 1;
+        }
+        fputs(RMSD_HEADER, rmsdFile);
+    }
+    outputFormat = options.format;
+    if(outputFormat != FORMAT_TEXT)
+    {
+        setvbuf(stdout, NULL, _IOFBF, OUTPUT_BUFFER);
+    }
+    if(options.bench != NULL)
+    {
+        if(argc > firstFile) //the benchmark makes its own files
+        {
+            printf(USAGE);
+            return 1;
+        }
+        return runBenchmark(&options);
+    }
+    if(options.serve ? argc > firstFile : argc < firstFile + 1) //checks if no arguments entered, a daemon takes none
+    {
+        printf(USAGE);
+        return 1;
+
+    }
+
+    if(options.serve)
+    {
+        failed = serveRequests(&options);
+    }
+    else
+    {
+        writeResultHeader();
+        if(options.jobs > 1 && argc - firstFile > 1)
+        {
+            failed = analyzeParallel(argv + firstFile, argc - firstFile, &options);
+        }
+        else
+        {
+            failed = analyzeSerial(argv + firstFile, argc - firstFile, &options);
+        }
+        if(rmsdFile != NULL && !failed)
+        {
+            failed = writeRmsdMatrix(argv + firstFile, options.threads);
+        }
+    }
+    if(options.statsFile != NULL && options.statsFile != stderr)
+    {
+        fclose(options.statsFile);
+    }
+    if(neighborsFile != NULL)
+    {
+        fclose(neighborsFile);
+    }
+    if(rmsdFile != NULL)
+    {
+        fclose(rmsdFile);
+    }
+    freeRmsdSet(&rmsdSet);
+    return failed;
+}
+
+/**
+ * Gets the files and the options.
+ * Responsible for analyzing the files one after the other with one atoms store.
+ * A reader thread opens and loads the next file while the current one is
+ * calculated, without it the files are read by the analysis itself.
+ * Stops at the first file that fails.
+ * @param paths
+ * @param fileCount
+ * @param options
+ * @return 0 for success
+ */
+int analyzeSerial(char *paths[], int fileCount, const Options *options)
+{
+    Workspace workspace;
+    FileResult result;
+    FileStats total;
+    Prefetcher prefetcher;
+    pthread_t reader;
+    int failed = 0, prefetching, analyzed = 0;
+
+    prefetcher.paths = paths;
+    prefetcher.fileCount = fileCount;
+    prefetcher.keepAtoms = options->keepAtoms || options->cache || options->resultCache != NULL;
+    prefetcher.options = options;
+    prefetcher.loaded = 0;
+    prefetcher.consumed = 0;
+    prefetcher.stop = 0;
+    pthread_mutex_init(&prefetcher.lock, NULL);
+    pthread_cond_init(&prefetcher.changed, NULL);
+    prefetching = fileCount > 1 && pthread_create(&reader, NULL, prefetchWorker, &prefetcher) == 0;
+
+    memset(&total, 0, sizeof(total));
+    readClocks(&total.phase[PHASE_TOTAL]);
+    initWorkspace(&workspace);
+    for(int i = 0; i < fileCount && !failed; i++, analyzed++)
+    {
+        result.file = i;
+        analyzeFile(paths[i], prefetching ? takePdbInput(&prefetcher, i) : NULL, &workspace, options, printFrame,
+                    &result);
+        if(prefetching)
+        {
+            releasePdbInput(&prefetcher);
+        }
+        failed = printFileResult(paths[i], &result);
+        printFileStats(options->statsFile, paths[i], &result, &total);
+    }
+    printTotalStats(options->statsFile, &total, analyzed, failed);
+    freeWorkspace(&workspace);
+
+    if(prefetching)
+    {
+        pthread_mutex_lock(&prefetcher.lock);
+        prefetcher.stop = 1;
+        pthread_cond_broadcast(&prefetcher.changed);
+        pthread_mutex_unlock(&prefetcher.lock);
+        pthread_join(reader, NULL);
+        for(int i = prefetcher.consumed; i < prefetcher.loaded; i++) //read ahead of a file that failed
+        {
+            if(!prefetcher.skipped[i % PREFETCH_DEPTH])
+            {
+                closePdbInput(&prefetcher.inputs[i % PREFETCH_DEPTH]);
+            }
+        }
+    }
+    pthread_cond_destroy(&prefetcher.changed);
+    pthread_mutex_destroy(&prefetcher.lock);
+    return failed;
+}
+
+/**
+ * Gets the prefetcher of a serial run.
+ * Responsible for the reader thread, it opens and loads the files in order
+ * and waits while the ring of inputs is full.
+ * @param prefetcherPointer
+ * @return NULL
+ */
+void *prefetchWorker(void *prefetcherPointer)
+{
+    Prefetcher *prefetcher = prefetcherPointer;
+
+    for(int i = 0; i < prefetcher->fileCount; i++)
+    {
+        PdbInput *input = &prefetcher->inputs[i % PREFETCH_DEPTH];
+
+        pthread_mutex_lock(&prefetcher->lock);
+        while(!prefetcher->stop && prefetcher->loaded - prefetcher->consumed == PREFETCH_DEPTH)
+        {
+            pthread_cond_wait(&prefetcher->changed, &prefetcher->lock);
+        }
+        if(prefetcher->stop)
+        {
+            pthread_mutex_unlock(&prefetcher->lock);
+            break;
+        }
+        pthread_mutex_unlock(&prefetcher->lock);
+
+        prefetcher->skipped[i % PREFETCH_DEPTH] = !isTextNeeded(prefetcher->paths[i], prefetcher->options);
+        if(!prefetcher->skipped[i % PREFETCH_DEPTH])
+        {
+            openPdbInput(prefetcher->paths[i], prefetcher->keepAtoms, input);
+            warmPdbInput(input);
+        }
+
+        pthread_mutex_lock(&prefetcher->lock);
+        prefetcher->loaded++;
+        pthread_cond_broadcast(&prefetcher->changed);
+        pthread_mutex_unlock(&prefetcher->lock);
+    }
+    return NULL;
+}
+
+/**
+ * Gets the prefetcher and the index of the next file.
+ * Responsible for waiting until the reader opened the file.
+ * @param prefetcher
+ * @param file
+ * @return the input of the file, NULL for a skipped one
+ */
+PdbInput *takePdbInput(Prefetcher *prefetcher, int file)
+{
+    pthread_mutex_lock(&prefetcher->lock);
+    while(prefetcher->loaded <= file)
+    {
+        pthread_cond_wait(&prefetcher->changed, &prefetcher->lock);
+    }
+    pthread_mutex_unlock(&prefetcher->lock);
+    return prefetcher->skipped[file % PREFETCH_DEPTH] ? NULL : &prefetcher->inputs[file % PREFETCH_DEPTH];
+}
+
+/**
+ * Gets a path and the options.
+ * Responsible for telling the reader thread if the analysis reads the text of
+ * the file: not when its results come from the result cache by the index of
+ * the path, or its atoms from a valid sidecar cache. Without the index the
+ * text is hashed, so it is read for the result cache.
+ * @param path
+ * @param options
+ * @return 1 if the text is needed, 0 if the file is cached
+ */
+int isTextNeeded(const char *path, const Options *options)
+{
+    struct stat source;
+    PdbBuffer cache;
+    uint64_t contentHash;
+    char *name;
+    int cached = 0;
+
+    if((options->resultCache == NULL && !options->cache) || stat(path, &source) != 0 || !S_ISREG(source.st_mode))
+    {
+        return 1;
+    }
+    if(options->resultCache != NULL)
+    {
+        if(readContentHash(path, &source, options, &contentHash) != 0)
+        {
+            return 1;
+        }
+        name = resultCachePath(options->resultCache, contentHash, options->resultKey, RESULT_ENTRY_SUFFIX);
+        cached = name != NULL && access(name, R_OK) == 0;
+        free(name);
+    }
+    if(!cached && options->cache && openCache(path, &source, &cache) == 0)
+    {
+        closePdbBuffer(&cache);
+        cached = 1;
+    }
+    return !cached;
+}
+
+/**
+ * Gets the prefetcher.
+ * Responsible for giving the input of the analyzed file back to the reader.
+ * @param prefetcher
+ */
+void releasePdbInput(Prefetcher *prefetcher)
+{
+    pthread_mutex_lock(&prefetcher->lock);
+    prefetcher->consumed++;
+    pthread_cond_broadcast(&prefetcher->changed);
+    pthread_mutex_unlock(&prefetcher->lock);
+}
+
+/**
+ * Gets the options of a daemon.
+ * Responsible for serving the requests of stdin, or of the connections of the
+ * Unix socket one after the other, by a pool of -j workers started once.
+ * Every worker keeps its workspace between all the requests so the buffers
+ * of the atoms, the hull and the grid are allocated and touched once, and the
+ * requests of a session are analyzed -j at a time. A client that leaves early
+ * doesn't stop the daemon.
+ * @param options
+ * @return 0 when stdin ends, 1 if the socket or the workers can't be served
+ */
+int serveRequests(const Options *options)
+{
+    ServePool pool;
+    pthread_t *workers = malloc(sizeof(pthread_t) * options->jobs);
+    struct sockaddr_un address;
+    struct stat status;
+    int listener = -1, started = 0, failed = 1;
+
+    signal(SIGPIPE, SIG_IGN);
+    memset(&pool, 0, sizeof(pool));
+    pool.options = options;
+    pool.depth = options->jobs * SERVE_DEPTH_PER_WORKER;
+    pool.requests = calloc(pool.depth, sizeof(ServeRequest));
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.changed, NULL);
+    while(workers != NULL && pool.requests != NULL && started < options->jobs &&
+          pthread_create(&workers[started], NULL, serveWorker, &pool) == 0)
+    {
+        started++;
+    }
+    if(started == 0)
+    {
+        printf("Error starting the workers of the daemon");
+    }
+    else if(options->socketPath == NULL)
+    {
+        serveSession(stdin, &pool);
+        failed = 0;
+    }
+    else
+    {
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        listener = strlen(options->socketPath) < sizeof(address.sun_path) ? socket(AF_UNIX, SOCK_STREAM, 0) : -1;
+        if(listener >= 0)
+        {
+            strcpy(address.sun_path, options->socketPath);
+            if(lstat(options->socketPath, &status) == 0 && S_ISSOCK(status.st_mode))
+            {
+                int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+                if(probe >= 0 && connect(probe, (struct sockaddr *)&address, sizeof(address)) != 0 &&
+                   errno == ECONNREFUSED)
+                {
+                    unlink(options->socketPath); //left by a daemon that ended, a live one keeps its socket
+                }
+                if(probe >= 0)
+                {
+                    close(probe);
+                }
+            }
+        }
+        if(listener < 0 || bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+           listen(listener, SERVE_BACKLOG) != 0)
+        {
+            printf("Error opening socket: %s", options->socketPath);
+        }
+        else
+        {
+            while(1)
+            {
+                int connection = accept(listener, NULL, NULL);
+                if(connection >= 0)
+                {
+                    serveConnection(connection, &pool);
+                }
+                else if(errno != EINTR && errno != ECONNABORTED)
+                {
+                    break;
+                }
+            }
+        }
+        if(listener >= 0)
+        {
+            close(listener);
+        }
+    }
+
+    pthread_mutex_lock(&pool.lock);
+    pool.stop = 1;
+    pthread_cond_broadcast(&pool.changed);
+    pthread_mutex_unlock(&pool.lock);
+    for(int i = 0; i < started; i++)
+    {
+        pthread_join(workers[i], NULL);
+    }
+    for(int i = 0; pool.requests != NULL && i < pool.depth; i++)
+    {
+        free(pool.requests[i].line);
+    }
+    pthread_cond_destroy(&pool.changed);
+    pthread_mutex_destroy(&pool.lock);
+    free(pool.requests);
+    free(workers);
+    return failed;
+}
+
+/**
+ * Gets a connection of the socket and the pool of the daemon.
+ * Responsible for serving the requests of the connection with the results
+ * written to it in place of stdout. The messages of the text format are
+ * written to it too, the other formats keep stderr for the daemon.
+ * The connection is closed.
+ * @param connection
+ * @param pool
+ */
+void serveConnection(int connection, ServePool *pool)
+{
+    int output = dup(STDOUT_FILENO);
+    int errors = outputFormat == FORMAT_TEXT ? dup(STDERR_FILENO) : -1;
+    FILE *requests;
+
+    fflush(stdout);
+    dup2(connection, STDOUT_FILENO);
+    if(errors >= 0)
+    {
+        dup2(connection, STDERR_FILENO);
+    }
+    requests = fdopen(connection, "r");
+    if(requests != NULL)
+    {
+        serveSession(requests, pool);
+        fclose(requests);
+    }
+    else
+    {
+        close(connection);
+    }
+    fflush(stdout);
+    clearerr(stdout); //of a client that left
+    if(output >= 0)
+    {
+        dup2(output, STDOUT_FILENO);
+        close(output);
+    }
+    if(errors >= 0)
+    {
+        dup2(errors, STDERR_FILENO);
+        close(errors);
+    }
+}
+
+/**
+ * Gets the requests of a client and the pool of the daemon.
+ * Responsible for reading the request lines into the ring of the pool while
+ * the workers analyze them and a writer thread writes their results, each as
+ * the results of one file of a run ended by endResponse, in the order of the
+ * requests. A request is the path of a file, or "@N" and then N bytes of a
+ * file. The results start with the header of the output format, and a failed
+ * file doesn't end the requests. The statistics are written after every request.
+ * @param requests
+ * @param pool
+ * @return the number of failed requests
+ */
+int serveSession(FILE *requests, ServePool *pool)
+{
+    pthread_t writer;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->read = pool->taken = pool->written = 0;
+    pool->ended = 0;
+    pool->failed = 0;
+    pthread_mutex_unlock(&pool->lock);
+    memset(&pool->total, 0, sizeof(pool->total));
+    readClocks(&pool->total.phase[PHASE_TOTAL]);
+    writeResultHeader();
+    fflush(stdout);
+    if(pthread_create(&writer, NULL, serveWriter, pool) != 0)
+    {
+        printf("Error starting the writer of the session");
+        fflush(stdout);
+        return 1;
+    }
+    while(1)
+    {
+        ServeRequest *request;
+
+        pthread_mutex_lock(&pool->lock);
+        while(pool->read - pool->written == pool->depth)
+        {
+            pthread_cond_wait(&pool->changed, &pool->lock);
+        }
+        pthread_mutex_unlock(&pool->lock);
+        request = &pool->requests[pool->read % pool->depth];
+        if(getline(&request->line, &request->capacity, requests) <= 0)
+        {
+            break;
+        }
+        request->line[strcspn(request->line, "\r\n")] = END_OF_STRING;
+        if(request->line[0] == END_OF_STRING)
+        {
+            continue;
+        }
+        request->path = request->line;
+        request->hasPayload = request->line[0] == SERVE_PAYLOAD;
+        if(request->hasPayload)
+        {
+            readPayload(request->line + 1, requests, &request->payload);
+            request->path = SERVE_PAYLOAD_PATH;
+        }
+        request->result.file = pool->read;
+        request->result.ready = 0;
+
+        pthread_mutex_lock(&pool->lock);
+        pool->read++;
+        pthread_cond_broadcast(&pool->changed);
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->ended = 1;
+    pthread_cond_broadcast(&pool->changed);
+    pthread_mutex_unlock(&pool->lock);
+    pthread_join(writer, NULL);
+    printTotalStats(pool->options->statsFile, &pool->total, pool->read, pool->failed > 0);
+    return pool->failed;
+}
+
+/**
+ * Gets the pool of the daemon.
+ * Responsible for a worker of the daemon, it takes the next request of the
+ * ring, analyzes it into its slot and publishes the result, with the same
+ * workspace until the daemon ends.
+ * @param poolPointer
+ * @return NULL
+ */
+void *serveWorker(void *poolPointer)
+{
+    ServePool *pool = poolPointer;
+    Workspace workspace;
+
+    initWorkspace(&workspace);
+    while(1)
+    {
+        ServeRequest *request;
+        FileResult result;
+
+        pthread_mutex_lock(&pool->lock);
+        while(!pool->stop && pool->taken == pool->read)
+        {
+            pthread_cond_wait(&pool->changed, &pool->lock);
+        }
+        if(pool->stop)
+        {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+        request = &pool->requests[pool->taken++ % pool->depth];
+        pthread_mutex_unlock(&pool->lock);
+
+        result.file = request->result.file;
+        analyzeFile(request->path, request->hasPayload ? &request->payload : NULL, &workspace, pool->options,
+                    keepFrame, &result);
+        result.ready = 1;
+        pthread_mutex_lock(&pool->lock);
+        request->result = result;
+        pthread_cond_broadcast(&pool->changed);
+        pthread_mutex_unlock(&pool->lock);
+    }
+    freeWorkspace(&workspace);
+    return NULL;
+}
+
+/**
+ * Gets the pool of the daemon.
+ * Responsible for the writer of a session, it writes the results of the
+ * requests in their order as soon as each one is ready, and frees its frames
+ * so its slot can take the next request.
+ * @param poolPointer
+ * @return NULL
+ */
+void *serveWriter(void *poolPointer)
+{
+    ServePool *pool = poolPointer;
+    FILE *statsFile = pool->options->statsFile;
+
+    while(1)
+    {
+        ServeRequest *request;
+        FileResult *result;
+
+        pthread_mutex_lock(&pool->lock);
+        while(!(pool->ended && pool->written == pool->read) &&
+              !(pool->written < pool->read && pool->requests[pool->written % pool->depth].result.ready))
+        {
+            pthread_cond_wait(&pool->changed, &pool->lock);
+        }
+        if(pool->written == pool->read)
+        {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+        request = &pool->requests[pool->written % pool->depth];
+        pthread_mutex_unlock(&pool->lock);
+
+        result = &request->result;
+        for(int i = 0; i < result->frameCount; i++)
+        {
+            writeFrame(request->path, result->file, &result->frames[i]);
+        }
+        fflush(stdout); //the frames go before a message written to stderr
+        if(result->status != FILE_OK)
+        {
+            writeError(request->path, result);
+            pool->failed++;
+        }
+        endResponse(result);
+        printFileStats(statsFile, request->path, result, &pool->total);
+        if(statsFile != NULL)
+        {
+            fflush(statsFile);
+        }
+        freeFileFrames(result);
+
+        pthread_mutex_lock(&pool->lock);
+        pool->written++;
+        pthread_cond_broadcast(&pool->changed);
+        pthread_mutex_unlock(&pool->lock);
+    }
+    return NULL;
+}
+
+/**
+ * Gets the size of a payload request, the requests and the input to fill.
+ * Responsible for reading the bytes of the payload to the heap, the input is
+ * a file that couldn't open when the size is wrong or the bytes end early.
+ * The bytes of a payload that can't be kept are still read so the next
+ * request is found.
+ * @param size
+ * @param requests
+ * @param payload
+ */
+void readPayload(const char *size, FILE *requests, PdbInput *payload)
+{
+    char *end, *data;
+    long long bytes = strtoll(size, &end, 10);
+
+    payload->open = 0;
+    payload->noMemory = 0;
+    payload->fd = -1;
+    payload->compression = COMPRESSION_NONE;
+    payload->buffer.data = NULL;
+    payload->buffer.size = 0;
+    payload->buffer.mapped = 0;
+    if(end == size || *end != END_OF_STRING || bytes < 0 || (unsigned long long)bytes > SIZE_MAX)
+    {
+        return;
+    }
+    data = malloc(bytes > 0 ? (size_t)bytes : 1);
+    if(data == NULL)
+    {
+        char skipped[BUFSIZ];
+        size_t read = 1;
+        while(bytes > 0 && read > 0)
+        {
+            read = fread(skipped, 1, bytes < BUFSIZ ? (size_t)bytes : BUFSIZ, requests);
+            bytes -= read;
+        }
+        return;
+    }
+    if(fread(data, 1, (size_t)bytes, requests) != (size_t)bytes)
+    {
+        free(data);
+        return;
+    }
+    payload->open = 1;
+    payload->buffer.data = data;
+    payload->buffer.size = (size_t)bytes;
+}
+
+/**
+ * Gets the result of a request.
+ * Responsible for ending its response so the client knows it is complete:
+ * an empty line for the text formats, after a new line that ends the message
+ * of a failed file in the text format, and a record of file -1 for the binary
+ * format. The response is flushed.
+ * @param result
+ */
+void endResponse(const FileResult *result)
+{
+    ResultRecord record;
+
+    if(outputFormat == FORMAT_BIN)
+    {
+        memset(&record, 0, sizeof(record));
+        record.file = -1;
+        record.model = NO_MODEL;
+        fwrite(&record, sizeof(record), 1, stdout);
+    }
+    else
+    {
+        if(outputFormat == FORMAT_TEXT && result->status != FILE_OK)
+        {
+            fputc(NEW_LINE, result->status == FILE_BAD_COORDINATE ? stderr : stdout);
+        }
+        fputc(NEW_LINE, stdout);
+    }
+    fflush(stdout);
+}
+
+/**
+ * Gets the files and the options.
+ * Responsible for analyzing the files by a pool of workers, each with its own
+ * atoms store, while this thread prints the results in the order of the files.
+ * Stops at the first file that fails, like the serial run.
+ * @param paths
+ * @param fileCount
+ * @param options
+ * @return 0 for success
+ */
+int analyzeParallel(char *paths[], int fileCount, const Options *options)
+{
+    Batch batch;
+    FileStats total;
+    int workerCount = options->jobs < fileCount ? options->jobs : fileCount;
+    pthread_t *workers = malloc(sizeof(pthread_t) * workerCount);
+    int started = 0, failed = 0, analyzed = 0;
+
+    batch.paths = paths;
+    batch.fileCount = fileCount;
+    batch.options = options;
+    batch.results = calloc(fileCount, sizeof(FileResult));
+    batch.nextFile = 0;
+    batch.stop = 0;
+    if(workers == NULL || batch.results == NULL)
+    {
+        free(workers);
+        free(batch.results);
+        return analyzeSerial(paths, fileCount, options);
+    }
+    memset(&total, 0, sizeof(total));
+    readClocks(&total.phase[PHASE_TOTAL]);
+    pthread_mutex_init(&batch.lock, NULL);
+    pthread_cond_init(&batch.resultReady, NULL);
+    while(started < workerCount && pthread_create(&workers[started], NULL, batchWorker, &batch) == 0)
+    {
+        started++;
+    }
+    if(started == 0)
+    {
+        batchWorker(&batch); //no threads at all, this thread does the work
+    }
+
+    for(int i = 0; i < fileCount && !failed; i++, analyzed++)
+    {
+        pthread_mutex_lock(&batch.lock);
+        while(!batch.results[i].ready)
+        {
+            pthread_cond_wait(&batch.resultReady, &batch.lock);
+        }
+        pthread_mutex_unlock(&batch.lock);
+        failed = printFileResult(paths[i], &batch.results[i]);
+        printFileStats(options->statsFile, paths[i], &batch.results[i], &total);
+        freeFileFrames(&batch.results[i]); //printed, only the window of the workers stays in memory
+    }
+    printTotalStats(options->statsFile, &total, analyzed, failed);
+    pthread_mutex_lock(&batch.lock);
+    batch.stop = 1;
+    pthread_mutex_unlock(&batch.lock);
+
+    for(int i = 0; i < started; i++)
+    {
+        pthread_join(workers[i], NULL);
+    }
+    for(int i = analyzed; i < fileCount; i++) //analyzed after a file that failed
+    {
+        freeFileFrames(&batch.results[i]);
+    }
+    pthread_cond_destroy(&batch.resultReady);
+    pthread_mutex_destroy(&batch.lock);
+    free(workers);
+    free(batch.results);
+    return failed;
+}
+
+/**
+ * Gets the result of a file.
+ * Responsible for freeing its frames and their neighbors.
+ * @param result
+ */
+void freeFileFrames(FileResult *result)
+{
+    for(int f = 0; f < result->frameCount; f++)
+    {
+        free(result->frames[f].neighborCounts);
+    }
+    free(result->frames);
+    result->frames = NULL;
+    result->frameCount = 0;
+    result->frameCapacity = 0;
+}
+
+/**
+ * Gets the batch.
+ * Responsible for taking the next file of the batch, analyzing it and
+ * publishing its result, until there are no files left.
+ * @param batchPointer
+ * @return NULL
+ */
+void *batchWorker(void *batchPointer)
+{
+    Batch *batch = batchPointer;
+    Workspace workspace;
+    FileResult result;
+
+    initWorkspace(&workspace);
+    while(1)
+    {
+        int file;
+        pthread_mutex_lock(&batch->lock);
+        file = batch->stop ? batch->fileCount : batch->nextFile++;
+        pthread_mutex_unlock(&batch->lock);
+        if(file >= batch->fileCount)
+        {
+            break;
+        }
+
+        result.file = file;
+        analyzeFile(batch->paths[file], NULL, &workspace, batch->options, keepFrame, &result);
+        result.ready = 1;
+        pthread_mutex_lock(&batch->lock);
+        batch->results[file] = result;
+        pthread_cond_broadcast(&batch->resultReady);
+        pthread_mutex_unlock(&batch->lock);
+    }
+    freeWorkspace(&workspace);
+    return NULL;
+}
+
+/**
+ * Gets a path, its opened input or NULL to open it here, the workspace of the
+ * worker, the options, where the frames go and the result to fill.
+ * Responsible for reading the atoms of the file and calculating the equations
+ * of every frame, each frame goes to emitFrame as soon as it ends.
+ * The input is always closed.
+ * With the cache option the atoms come from a valid sidecar cache, or the
+ * cache is written while the text is parsed.
+ * With the result cache the frames of a file whose content and options were
+ * analyzed before come from the cache, without parsing, and the frames of
+ * any other file are stored in it. The content is hashed from the mapped
+ * buffer the parser reads after a miss, so the file is read once, and the
+ * hash goes to the index of the path after the analysis.
+ * The result holds the error if there is one.
+ * @param path
+ * @param input
+ * @param workspace
+ * @param options
+ * @param emitFrame
+ * @param result
+ */
+void analyzeFile(const char *path, PdbInput *input, Workspace *workspace, const Options *options,
+                 FrameSink emitFrame, FileResult *result)
+{
+    AtomStore *atoms = &workspace->atoms;
+    FileStats *stats = options->statsFile != NULL ? &result->stats : NULL;
+    PdbInput opened;
+    PdbBuffer buffer;
+    ParseContext context;
+    CacheWriter writer;
+    ResultWriter results = {NULL, 0, 0, 0};
+    Stopwatch fileStart, phaseStart;
+    struct stat source;
+    uint64_t contentHash = 0;
+    int regular, cacheable, cached, hashed, indexed, stored = 0;
+
+    memset(&result->stats, 0, sizeof(result->stats));
+    startPhase(stats, &fileStart);
+    startPhase(stats, &phaseStart);
+    result->status = FILE_OK;
+    result->frames = NULL;
+    result->frameCount = 0;
+    result->frameCapacity = 0;
+    result->ready = 0;
+    initParseContext(&context, path, options, workspace, emitFrame);
+    context.atoms = options->keepAtoms ? atoms : NULL;
+    context.stats = stats;
+    regular = (options->cache || options->resultCache != NULL) && stat(path, &source) == 0 &&
+              S_ISREG(source.st_mode);
+    indexed = regular && options->resultCache != NULL && readContentHash(path, &source, options, &contentHash) == 0;
+    stored = indexed && loadResults(contentHash, &context, result) == 0;
+    hashed = indexed;
+    if(!indexed && regular && options->resultCache != NULL)
+    {
+        if(input == NULL) //a prefetched input is mapped by the reader thread for the result cache
+        {
+            openPdbInput(path, 1, &opened);
+            input = &opened;
+        }
+        hashed = input->open && !input->noMemory && input->fd < 0;
+        if(hashed)
+        {
+            contentHash = hashBytes(input->buffer.data, input->buffer.size, 0);
+            stored = loadResults(contentHash, &context, result) == 0;
+        }
+    }
+    cacheable = !stored && options->cache && regular;
+    cached = cacheable && openCache(path, &source, &buffer) == 0;
+    endPhase(stats, PHASE_OPEN, &phaseStart);
+    if(stored)
+    {
+        if(input != NULL) //the text wasn't needed
+        {
+            closePdbInput(input);
+        }
+    }
+    else if(cached)
+    {
+        startPhase(stats, &phaseStart);
+        result->status = analyzeCache(&buffer, &context, result);
+        closePdbBuffer(&buffer);
+        endPhase(stats, PHASE_PARSE, &phaseStart);
+        if(input != NULL) //the text wasn't needed
+        {
+            closePdbInput(input);
+        }
+    }
+    else
+    {
+        if(cacheable && beginCache(path, &writer) == 0)
+        {
+            context.atoms = atoms; //the cache needs the coordinates even without Dmax
+            context.cache = &writer;
+        }
+        if(hashed)
+        {
+            context.results = &results;
+        }
+        if(input == NULL) //a prefetched input was opened by the reader thread
+        {
+            startPhase(stats, &phaseStart);
+            openPdbInput(path, context.atoms != NULL, &opened);
+            input = &opened;
+            endPhase(stats, PHASE_OPEN, &phaseStart);
+        }
+        startPhase(stats, &phaseStart);
+        result->status = parsePdbInput(input, &context, result);
+        endPhase(stats, PHASE_PARSE, &phaseStart);
+        if(result->status == FILE_OK)
+        {
+            result->status = finishFrame(&context, result); //the atoms after the last ENDMDL or of a file without models
+        }
+        if(context.cache != NULL)
+        {
+            endCache(path, &source, &writer, result->status == FILE_OK && context.frameCount > 0);
+        }
+    }
+    if(context.results != NULL)
+    {
+        results.failed |= result->status != FILE_OK || context.frameCount == 0;
+        storeResults(path, &source, contentHash, options, &results);
+    }
+    if(hashed && !indexed)
+    {
+        writeContentHash(path, &source, options, contentHash);
+    }
+    //checks if problem accoured while reading the file
+    if(result->status == FILE_OK && context.frameCount == 0)
+    {
+        result->status = FILE_NO_ATOMS;
+    }
+    if(stats != NULL)
+    {
+        readClocks(&phaseStart);
+        stats->phase[PHASE_TOTAL].wall = phaseStart.wall - fileStart.wall;
+        stats->phase[PHASE_TOTAL].cpu = phaseStart.cpu - fileStart.cpu;
+    }
+}
+
+/**
+ * Gets a parse context, the path of the file, the options, the workspace and where the frames go.
+ * Responsible for starting the context of a new file, with the atoms stored in
+ * the workspace store and no cache.
+ * @param context
+ * @param path
+ * @param options
+ * @param workspace
+ * @param emitFrame
+ */
+void initParseContext(ParseContext *context, const char *path, const Options *options, Workspace *workspace,
+                      FrameSink emitFrame)
+{
+    workspace->atoms.count = 0;
+    context->options = options;
+    context->path = path;
+    context->atoms = &workspace->atoms;
+    context->model = NO_MODEL;
+    context->frameCount = 0;
+    context->emitFrame = emitFrame;
+    context->cache = NULL;
+    context->results = NULL;
+    context->workspace = workspace;
+    context->stats = NULL;
+    context->format = INPUT_UNDETECTED;
+    initCifReader(&context->cif);
+    initMoments(&context->moments);
+}
+
+/**
+ * Gets a workspace.
+ * Responsible for starting it empty, the buffers are allocated on first use.
+ * @param workspace
+ */
+void initWorkspace(Workspace *workspace)
+{
+    initAtomStore(&workspace->atoms);
+    initAtomStore(&workspace->hullAtoms);
+    initAtomStore(&workspace->rankedAtoms);
+    initAtomStore(&workspace->candidateAtoms);
+    workspace->ranked = NULL;
+    workspace->rankedCapacity = 0;
+    workspace->hull.faces = NULL;
+    workspace->hull.faceCapacity = 0;
+    workspace->hull.horizon = NULL;
+    workspace->hull.horizonCapacity = 0;
+    workspace->hull.nextOutside = NULL;
+    workspace->hull.startOf = NULL;
+    workspace->hull.pointCapacity = 0;
+    workspace->hull.stack = NULL;
+    workspace->hull.stackCapacity = 0;
+    workspace->hullVertices = NULL;
+    workspace->pairedAtoms = 0;
+    initCellGrid(&workspace->grid);
+}
+
+/**
+ * Gets a workspace and the number of atoms of a frame.
+ * Responsible for growing the buffers of the hull to the frame, they are
+ * kept as they are for a frame that fits.
+ * @param workspace
+ * @param atomCount
+ * @return 0 for success, -1 if the memory ran out
+ */
+int reserveWorkspace(Workspace *workspace, int atomCount)
+{
+    Hull *hull = &workspace->hull;
+
+    if(hull->faces == NULL)
+    {
+        hull->faces = malloc(sizeof(HullFace) * HULL_INITIAL_FACES);
+        hull->horizon = malloc(sizeof(HorizonEdge) * HULL_INITIAL_FACES);
+        if(hull->faces == NULL || hull->horizon == NULL)
+        {
+            free(hull->faces);
+            free(hull->horizon);
+            hull->faces = NULL;
+            hull->horizon = NULL;
+            return -1;
+        }
+        hull->faceCapacity = HULL_INITIAL_FACES;
+        hull->horizonCapacity = HULL_INITIAL_FACES;
+    }
+    if(atomCount > hull->pointCapacity)
+    {
+        int *nextOutside = realloc(hull->nextOutside, sizeof(int) * atomCount);
+        int *startOf = nextOutside == NULL ? NULL : realloc(hull->startOf, sizeof(int) * atomCount);
+        int *hullVertices = startOf == NULL ? NULL : realloc(workspace->hullVertices, sizeof(int) * atomCount);
+
+        hull->nextOutside = nextOutside != NULL ? nextOutside : hull->nextOutside;
+        hull->startOf = startOf != NULL ? startOf : hull->startOf;
+        workspace->hullVertices = hullVertices != NULL ? hullVertices : workspace->hullVertices;
+        if(hullVertices == NULL)
+        {
+            return -1;
+        }
+        hull->pointCapacity = atomCount;
+    }
+    return 0;
+}
+
+/**
+ * Gets a workspace.
+ * Responsible for freeing all its buffers.
+ * @param workspace
+ */
+void freeWorkspace(Workspace *workspace)
+{
+    freeAtomStore(&workspace->atoms);
+    freeAtomStore(&workspace->hullAtoms);
+    freeAtomStore(&workspace->rankedAtoms);
+    freeAtomStore(&workspace->candidateAtoms);
+    free(workspace->ranked);
+    free(workspace->hull.faces);
+    free(workspace->hull.horizon);
+    free(workspace->hull.nextOutside);
+    free(workspace->hull.startOf);
+    free(workspace->hull.stack);
+    free(workspace->hullVertices);
+    freeCellGrid(&workspace->grid);
+    initWorkspace(workspace);
+}
+
+/**
+ * Gets the parse context and the file result.
+ * Responsible for calculating the equations of the atoms read since the last
+ * frame, handing the frame on and resetting the atoms for the next one.
+ * A frame without atoms is dropped.
+ * @param context
+ * @param result
+ * @return FILE_OK for success or FILE_NO_MEMORY
+ */
+FileStatus finishFrame(ParseContext *context, FileResult *result)
+{
+    const Options *options = context->options;
+    FileStats *stats = context->stats;
+    FrameResult frame;
+    Stopwatch start, finish;
+    int resident;
+
+    if(context->moments.count == 0)
+    {
+        return FILE_OK;
+    }
+    if(stats != NULL)
+    {
+        readClocks(&start);
+    }
+    frame.model = context->model;
+    frame.atomCount = (int)context->moments.count;
+    frame.hasMaxDistance = options->maxDistance;
+    if(options->deterministic)
+    {
+        calPairwiseMoments(context->atoms, frame.gravityCenter, &frame.rotationRadius);
+    }
+    else if(options->twoPass)
+    {
+        calCenterOfGravity(context->atoms, frame.gravityCenter);
+        frame.rotationRadius = calRotationRadious(context->atoms, frame.gravityCenter);
+    }
+    else
+    {
+        for(int k = 0; k < COORDINATES; k++)
+        {
+            frame.gravityCenter[k] = (float)context->moments.mean[k];
+        }
+        frame.rotationRadius = momentsRotationRadius(&context->moments);
+    }
+    frame.hasShape = options->shape;
+    if(options->shape)
+    {
+        calGyrationShape(&context->moments, &frame);
+    }
+    if(rmsdFile != NULL && keepRmsdStructure(context->atoms, frame.gravityCenter, result->file, context->frameCount,
+                                             frame.model) != 0)
+    {
+        return FILE_NO_MEMORY;
+    }
+    if(stats != NULL)
+    {
+        readClocks(&finish);
+        stats->phase[PHASE_MOMENTS].wall += finish.wall - start.wall;
+        stats->phase[PHASE_MOMENTS].cpu += finish.cpu - start.cpu;
+        start = finish;
+    }
+    //the coordinates are copied to the device once for the Dmax and the contacts
+    resident = uploadAtoms(context->atoms, options);
+    frame.maxDistance = 0;
+    frame.maxDistanceBound = 0;
+    if(options->maxDistance)
+    {
+        frame.maxDistance = calMaxDistance(context->atoms, options, context->workspace, &frame.maxDistanceBound);
+    }
+    //an approximate Dmax that turned out exact is printed as one
+    frame.approximate = frame.maxDistanceBound > frame.maxDistance;
+    if(stats != NULL)
+    {
+        long long paired = options->maxDistance ? context->workspace->pairedAtoms : 0;
+        readClocks(&finish);
+        stats->phase[PHASE_DMAX].wall += finish.wall - start.wall;
+        stats->phase[PHASE_DMAX].cpu += finish.cpu - start.cpu;
+        stats->pairs += paired * (paired - 1) / 2;
+        stats->atoms += frame.atomCount;
+        stats->frames++;
+    }
+    frame.contactCutoff = options->contactCutoff;
+    frame.contacts = 0;
+    frame.neighborCounts = NULL;
+    if(options->contactCutoff > 0)
+    {
+        if(stats != NULL)
+        {
+            readClocks(&start);
+        }
+        if(neighborsFile != NULL)
+        {
+            frame.neighborCounts = calloc(frame.atomCount, sizeof(int));
+            if(frame.neighborCounts == NULL)
+            {
+                releaseAtoms(context->atoms, resident);
+                return FILE_NO_MEMORY;
+            }
+        }
+        frame.contacts = calContacts(context->atoms, options->contactCutoff, options->threads, context->workspace,
+                                     frame.neighborCounts);
+        if(stats != NULL)
+        {
+            readClocks(&finish);
+            stats->phase[PHASE_CONTACTS].wall += finish.wall - start.wall;
+            stats->phase[PHASE_CONTACTS].cpu += finish.cpu - start.cpu;
+        }
+    }
+    releaseAtoms(context->atoms, resident);
+    if(frame.contacts < 0)
+    {
+        free(frame.neighborCounts);
+        return FILE_NO_MEMORY;
+    }
+    if(options->crossCheck)
+    {
+        FileStatus status = crossCheckFrame(context->atoms, &context->moments, &frame, options, context->workspace,
+                                            result->badField);
+        if(status != FILE_OK)
+        {
+            free(frame.neighborCounts);
+            return status;
+        }
+    }
+    if(context->cache != NULL)
+    {
+        writeCacheFrame(context->cache, context->model, context->atoms);
+    }
+    if(context->results != NULL)
+    {
+        recordResultFrame(context->results, &frame);
+    }
+
+    context->frameCount++;
+    if(context->atoms != NULL)
+    {
+        context->atoms->count = 0;
+    }
+    initMoments(&context->moments);
+    if(context->emitFrame(context->path, result, &frame) != 0)
+    {
+        free(frame.neighborCounts);
+        return FILE_NO_MEMORY;
+    }
+    return FILE_OK;
+}
+
+/**
+ * Gets a path, its result and a frame.
+ * Responsible for writing the results of the frame right away, and
+ * freeing its neighbors.
+ * @param path
+ * @param result
+ * @param frame
+ * @return 0
+ */
+int printFrame(const char *path, FileResult *result, const FrameResult *frame)
+{
+    writeFrame(path, result->file, frame);
+    free(frame->neighborCounts);
+    return 0;
+}
+
+/**
+ * Gets a path, its result and a frame.
+ * Responsible for keeping the frame in the result until the file is printed.
+ * @param path
+ * @param result
+ * @param frame
+ * @return 0 for success, -1 if the memory ran out
+ */
+int keepFrame(const char *path, FileResult *result, const FrameResult *frame)
+{
+    (void)path;
+    if(result->frameCount == result->frameCapacity)
+    {
+        int capacity = result->frameCapacity == 0 ? INITIAL_FRAMES : result->frameCapacity * 2;
+        FrameResult *frames = realloc(result->frames, sizeof(FrameResult) * capacity);
+        if(frames == NULL)
+        {
+            return -1;
+        }
+        result->frames = frames;
+        result->frameCapacity = capacity;
+    }
+    result->frames[result->frameCount++] = *frame;
+    return 0;
+}
+
+/**
+ * Gets a path and its result.
+ * Responsible for printing the kept frames of the file, and its error message.
+ * @param path
+ * @param result
+ * @return 0 if the file was analyzed, 1 if it failed
+ */
+int printFileResult(const char *path, const FileResult *result)
+{
+    for(int i = 0; i < result->frameCount; i++)
+    {
+        writeFrame(path, result->file, &result->frames[i]);
+    }
+    if(result->status == FILE_OK)
+    {
+        return 0;
+    }
+    writeError(path, result);
+    return 1;
+}
+
+/**
+ * Responsible for writing what comes before the records of the output format,
+ * the column names of CSV and the header of the binary results.
+ */
+void writeResultHeader(void)
+{
+    ResultHeader header;
+
+    if(outputFormat == FORMAT_CSV)
+    {
+        fputs(CSV_HEADER, stdout);
+    }
+    else if(outputFormat == FORMAT_BIN)
+    {
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, RESULT_MAGIC, RESULT_MAGIC_LEN);
+        header.version = RESULT_VERSION;
+        header.recordSize = sizeof(ResultRecord);
+        fwrite(&header, sizeof(header), 1, stdout);
+    }
+}
+
+/**
+ * Gets a path, the index of the file and a frame.
+ * Responsible for writing the results of the frame in the output format.
+ * @param path
+ * @param file
+ * @param frame
+ */
+void writeFrame(const char *path, int file, const FrameResult *frame)
+{
+    ResultRecord record;
+
+    switch(outputFormat)
+    {
+        case FORMAT_TEXT:
+            if(frame->model == NO_MODEL)
+            {
+                printf("PDB file %s, %d atoms were read\n", path, frame->atomCount);
+            }
+            else
+            {
+                printf("PDB file %s, model %d, %d atoms were read\n", path, frame->model, frame->atomCount);
+            }
+            printf("Cg = %.3f %.3f %.3f\n", frame->gravityCenter[0], frame->gravityCenter[1],
+                   frame->gravityCenter[2]);
+            printf("Rg = %.3f\n", frame->rotationRadius);
+            if(frame->hasMaxDistance && frame->approximate)
+            {
+                printf("Dmax = %.3f (approximate, at most %.3f)\n", frame->maxDistance, frame->maxDistanceBound);
+            }
+            else if(frame->hasMaxDistance)
+            {
+                printf("Dmax = %.3f\n", frame->maxDistance);
+            }
+            if(frame->contactCutoff > 0)
+            {
+                printf("Contacts = %lld (cutoff %.3f)\n", frame->contacts, frame->contactCutoff);
+            }
+            if(frame->hasShape)
+            {
+                printf("Gyration eigenvalues = %.3f %.3f %.3f\n", frame->eigenvalues[0], frame->eigenvalues[1],
+                       frame->eigenvalues[2]);
+                printf("Asphericity = %.3f\n", frame->asphericity);
+                for(int k = 0; k < COORDINATES; k++)
+                {
+                    printf("Axis %d = %.3f %.3f %.3f\n", k + 1, frame->axes[k][0], frame->axes[k][1], frame->axes[k][2]);
+                }
+            }
+            break;
+        case FORMAT_CSV:
+            printCsvString(stdout, path);
+            if(frame->model == NO_MODEL)
+            {
+                printf(",,%s,%d", statusNames[FILE_OK], frame->atomCount);
+            }
+            else
+            {
+                printf(",%d,%s,%d", frame->model, statusNames[FILE_OK], frame->atomCount);
+            }
+            printf(",%.3f,%.3f,%.3f,%.3f,", frame->gravityCenter[0], frame->gravityCenter[1],
+                   frame->gravityCenter[2], frame->rotationRadius);
+            if(frame->hasMaxDistance)
+            {
+                printf("%.3f,%.3f", frame->maxDistance, frame->maxDistanceBound);
+            }
+            else
+            {
+                putchar(',');
+            }
+            putchar(',');
+            if(frame->contactCutoff > 0)
+            {
+                printf("%lld", frame->contacts);
+            }
+            if(frame->hasShape)
+            {
+                printf(",%.3f,%.3f,%.3f,%.3f", frame->eigenvalues[0], frame->eigenvalues[1], frame->eigenvalues[2],
+                       frame->asphericity);
+                for(int k = 0; k < COORDINATES * COORDINATES; k++)
+                {
+                    printf(",%.3f", frame->axes[k / COORDINATES][k % COORDINATES]);
+                }
+            }
+            else
+            {
+                printf(",,,,,,,,,,,,");
+            }
+            putchar(NEW_LINE);
+            break;
+        case FORMAT_JSON:
+            printf("{\"file\": ");
+            printJsonString(stdout, path);
+            if(frame->model != NO_MODEL)
+            {
+                printf(", \"model\": %d", frame->model);
+            }
+            printf(", \"status\": \"%s\", \"atoms\": %d, \"cg\": [%.3f, %.3f, %.3f], \"rg\": %.3f",
+                   statusNames[FILE_OK], frame->atomCount, frame->gravityCenter[0], frame->gravityCenter[1],
+                   frame->gravityCenter[2], frame->rotationRadius);
+            if(frame->hasMaxDistance)
+            {
+                printf(", \"dmax\": %.3f, \"dmax_upper\": %.3f", frame->maxDistance, frame->maxDistanceBound);
+            }
+            if(frame->contactCutoff > 0)
+            {
+                printf(", \"contacts\": %lld, \"cutoff\": %.3f", frame->contacts, frame->contactCutoff);
+            }
+            if(frame->hasShape)
+            {
+                printf(", \"eigenvalues\": [%.3f, %.3f, %.3f], \"asphericity\": %.3f, \"axes\": [",
+                       frame->eigenvalues[0], frame->eigenvalues[1], frame->eigenvalues[2], frame->asphericity);
+                for(int k = 0; k < COORDINATES; k++)
+                {
+                    printf("%s[%.3f, %.3f, %.3f]", k > 0 ? ", " : "", frame->axes[k][0], frame->axes[k][1],
+                           frame->axes[k][2]);
+                }
+                printf("]");
+            }
+            printf("}\n");
+            break;
+        case FORMAT_BIN:
+            record.file = file;
+            record.model = frame->model;
+            record.status = FILE_OK;
+            record.atomCount = frame->atomCount;
+            for(int k = 0; k < COORDINATES; k++)
+            {
+                record.gravityCenter[k] = frame->gravityCenter[k];
+            }
+            record.rotationRadius = frame->rotationRadius;
+            record.maxDistance = frame->hasMaxDistance ? frame->maxDistance : NAN;
+            record.maxDistanceBound = frame->hasMaxDistance ? frame->maxDistanceBound : NAN;
+            record.contacts = frame->contactCutoff > 0 ? frame->contacts : -1;
+            for(int k = 0; k < COORDINATES; k++)
+            {
+                record.eigenvalues[k] = frame->hasShape ? frame->eigenvalues[k] : NAN;
+                for(int j = 0; j < COORDINATES; j++)
+                {
+                    record.axes[k][j] = frame->hasShape ? frame->axes[k][j] : NAN;
+                }
+            }
+            record.asphericity = frame->hasShape ? frame->asphericity : NAN;
+            record.reserved = 0;
+            fwrite(&record, sizeof(record), 1, stdout);
+            break;
+    }
+    if(neighborsFile != NULL && frame->neighborCounts != NULL)
+    {
+        writeNeighbors(path, frame);
+    }
+}
+
+/**
+ * Gets a path and a frame with its neighbors.
+ * Responsible for writing the number of atoms within the cutoff of every atom
+ * of the frame to the neighbors file, one CSV line per atom numbered from 1
+ * in the order of the ATOM lines.
+ * @param path
+ * @param frame
+ */
+void writeNeighbors(const char *path, const FrameResult *frame)
+{
+    for(int i = 0; i < frame->atomCount; i++)
+    {
+        printCsvString(neighborsFile, path);
+        if(frame->model == NO_MODEL)
+        {
+            fprintf(neighborsFile, ",,%d,%d\n", i + 1, frame->neighborCounts[i]);
+        }
+        else
+        {
+            fprintf(neighborsFile, ",%d,%d,%d\n", frame->model, i + 1, frame->neighborCounts[i]);
+        }
+    }
+}
+
+/**
+ * Gets a path and its failed result.
+ * Responsible for writing the error of the file. The text format prints the
+ * message of the original tool, the other formats write a record of the
+ * error and, for the binary format that can't hold it, the message to stderr.
+ * @param path
+ * @param result
+ */
+void writeError(const char *path, const FileResult *result)
+{
+    char message[ERROR_MESSAGE_LEN];
+    ResultRecord record;
+
+    formatFileError(message, sizeof(message), path, result);
+    switch(outputFormat)
+    {
+        case FORMAT_TEXT:
+            fputs(message, result->status == FILE_BAD_COORDINATE ? stderr : stdout);
+            break;
+        case FORMAT_CSV:
+            printCsvString(stdout, path);
+            printf(",,%s,,,,,,,,,,,,,,,,,,,,,\n", statusNames[result->status]);
+            fprintf(stderr, "%s\n", message);
+            break;
+        case FORMAT_JSON:
+            printf("{\"file\": ");
+            printJsonString(stdout, path);
+            printf(", \"status\": \"%s\", \"error\": ", statusNames[result->status]);
+            printJsonString(stdout, message);
+            printf("}\n");
+            break;
+        case FORMAT_BIN:
+            memset(&record, 0, sizeof(record));
+            record.file = result->file;
+            record.model = NO_MODEL;
+            record.status = result->status;
+            record.rotationRadius = NAN;
+            record.maxDistance = NAN;
+            record.maxDistanceBound = NAN;
+            record.contacts = -1;
+            for(int k = 0; k < COORDINATES; k++)
+            {
+                record.eigenvalues[k] = NAN;
+                for(int j = 0; j < COORDINATES; j++)
+                {
+                    record.axes[k][j] = NAN;
+                }
+            }
+            record.asphericity = NAN;
+            fwrite(&record, sizeof(record), 1, stdout);
+            fprintf(stderr, "%s\n", message);
+            break;
+    }
+}
+
+/**
+ * Gets the message to fill with its size, a path and its failed result.
+ * Responsible for the error message of the file.
+ * @param message
+ * @param size
+ * @param path
+ * @param result
+ */
+void formatFileError(char *message, size_t size, const char *path, const FileResult *result)
+{
+    switch(result->status)
+    {
+        case FILE_OK:
+            message[0] = END_OF_STRING;
+            break;
+        case FILE_OPEN_FAILED:
+            snprintf(message, size, "Error opening file: %s", path);
+            break;
+        case FILE_NO_ATOMS:
+            snprintf(message, size, "Error - 0 atoms were found in the file %s", path);
+            break;
+        case FILE_SHORT_LINE:
+            snprintf(message, size, "ATOM line is too short %lu characters", result->lineLength);
+            break;
+        case FILE_BAD_COORDINATE:
+            snprintf(message, size, "Error in coordinate conversion %s", result->badField);
+            break;
+        case FILE_NO_MEMORY:
+            snprintf(message, size, "Error allocating memory for the atoms of %s", path);
+            break;
+        case FILE_BAD_COMPRESSION:
+            snprintf(message, size, "Error decompressing file: %s", path);
+            break;
+        case FILE_NO_DECOMPRESSOR:
+            snprintf(message, size, "Error - %s is compressed and this build can't decompress it", path);
+            break;
+        case FILE_UNKNOWN_ELEMENT:
+            snprintf(message, size, "Error - unknown element %s in the file %s", result->badField, path);
+            break;
+        case FILE_BAD_BINARY_CIF:
+            snprintf(message, size, "Error decoding the BinaryCIF file: %s", path);
+            break;
+        case FILE_CROSS_CHECK_FAILED:
+            snprintf(message, size, "Error - the engines disagree on the %s of %s", result->badField, path);
+            break;
+    }
+}
+
+/**
+ * Gets a file and a text.
+ * Responsible for writing the text as a CSV field, quoted only when it holds
+ * a comma, a quote or a new line.
+ * @param file
+ * @param text
+ */
+void printCsvString(FILE *file, const char *text)
+{
+    if(strpbrk(text, ",\"\r\n") == NULL)
+    {
+        fputs(text, file);
+        return;
+    }
+    fputc('"', file);
+    for(; *text != END_OF_STRING; text++)
+    {
+        if(*text == '"')
+        {
+            fputc('"', file);
+        }
+        fputc(*text, file);
+    }
+    fputc('"', file);
+}
+
+/**
+ * Gets the moment to fill.
+ * Responsible for reading the wall clock and the CPU clock of this thread.
+ * @param now
+ */
+void readClocks(Stopwatch *now)
+{
+    struct timespec cpu;
+
+    now->wall = wallSeconds();
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+    now->cpu = cpu.tv_sec + cpu.tv_nsec / NANOSECONDS;
+}
+
+/**
+ * Gets the statistics of a file, or NULL when there are none, and the start to fill.
+ * Responsible for starting a phase. The time of the frames so far is taken
+ * off the start, so the frames that end during the phase aren't counted twice.
+ * @param stats
+ * @param start
+ */
+void startPhase(const FileStats *stats, Stopwatch *start)
+{
+    if(stats == NULL)
+    {
+        return;
+    }
+    readClocks(start);
+    start->wall -= stats->phase[PHASE_MOMENTS].wall + stats->phase[PHASE_DMAX].wall
+                   + stats->phase[PHASE_CONTACTS].wall;
+    start->cpu -= stats->phase[PHASE_MOMENTS].cpu + stats->phase[PHASE_DMAX].cpu + stats->phase[PHASE_CONTACTS].cpu;
+}
+
+/**
+ * Gets the statistics of a file, or NULL when there are none, a phase and its start.
+ * Responsible for adding the time since the start to the phase.
+ * @param stats
+ * @param phase
+ * @param start
+ */
+void endPhase(FileStats *stats, Phase phase, const Stopwatch *start)
+{
+    Stopwatch now;
+
+    if(stats == NULL)
+    {
+        return;
+    }
+    startPhase(stats, &now);
+    stats->phase[phase].wall += now.wall - start->wall;
+    stats->phase[phase].cpu += now.cpu - start->cpu;
+}
+
+/**
+ * Gets the statistics file, or NULL when there are no statistics, a path, its
+ * result and the statistics of the run.
+ * Responsible for writing the statistics of the file as one JSON line and
+ * adding them to the run.
+ * @param file
+ * @param path
+ * @param result
+ * @param total
+ */
+void printFileStats(FILE *file, const char *path, const FileResult *result, FileStats *total)
+{
+    const FileStats *stats = &result->stats;
+
+    if(file == NULL)
+    {
+        return;
+    }
+    fprintf(file, "{\"file\": ");
+    printJsonString(file, path);
+    fprintf(file, ", \"status\": \"%s\", \"frames\": %d, \"atoms\": %lld, \"bytes\": %lld, \"lines\": %lld, "
+                  "\"pairs\": %lld, ", statusNames[result->status], stats->frames, stats->atoms, stats->bytes,
+            stats->lines, stats->pairs);
+    printPhases(file, stats);
+    fprintf(file, "}\n");
+    for(int k = 0; k < PHASE_TOTAL; k++)
+    {
+        total->phase[k].wall += stats->phase[k].wall;
+        total->phase[k].cpu += stats->phase[k].cpu;
+    }
+    total->bytes += stats->bytes;
+    total->lines += stats->lines;
+    total->atoms += stats->atoms;
+    total->pairs += stats->pairs;
+    total->frames += stats->frames;
+}
+
+/**
+ * Gets the statistics file, or NULL when there are no statistics, the
+ * statistics of the run, with the start of the run as its total, the number
+ * of files analyzed and whether one failed.
+ * Responsible for writing the statistics of the run as the last JSON line.
+ * The phases are the sums of the files, the total is the wall time of the run
+ * and the CPU time of the whole process, with all its threads.
+ * @param file
+ * @param total
+ * @param fileCount
+ * @param failed
+ */
+void printTotalStats(FILE *file, const FileStats *total, int fileCount, int failed)
+{
+    FileStats run = *total;
+    struct timespec cpu;
+
+    if(file == NULL)
+    {
+        return;
+    }
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu);
+    run.phase[PHASE_TOTAL].wall = wallSeconds() - total->phase[PHASE_TOTAL].wall;
+    run.phase[PHASE_TOTAL].cpu = cpu.tv_sec + cpu.tv_nsec / NANOSECONDS;
+    fprintf(file, "{\"files\": %d, \"failed\": %d, \"frames\": %d, \"atoms\": %lld, \"bytes\": %lld, "
+                  "\"lines\": %lld, \"pairs\": %lld, ", fileCount, failed, run.frames, run.atoms, run.bytes,
+            run.lines, run.pairs);
+    printPhases(file, &run);
+    fprintf(file, ", \"atoms_per_s\": %.0f, \"mb_per_s\": %.1f}\n",
+            run.phase[PHASE_TOTAL].wall > 0 ? run.atoms / run.phase[PHASE_TOTAL].wall : 0,
+            run.phase[PHASE_TOTAL].wall > 0 ? run.bytes / MEGABYTE / run.phase[PHASE_TOTAL].wall : 0);
+    fflush(file);
+}
+
+/**
+ * Gets a file and statistics.
+ * Responsible for writing the wall and CPU times of the phases as JSON members.
+ * @param file
+ * @param stats
+ */
+void printPhases(FILE *file, const FileStats *stats)
+{
+    fprintf(file, "\"wall_s\": {");
+    for(int k = 0; k < PHASE_COUNT; k++)
+    {
+        fprintf(file, "%s\"%s\": %.6f", k > 0 ? ", " : "", phaseNames[k], stats->phase[k].wall);
+    }
+    fprintf(file, "}, \"cpu_s\": {");
+    for(int k = 0; k < PHASE_COUNT; k++)
+    {
+        fprintf(file, "%s\"%s\": %.6f", k > 0 ? ", " : "", phaseNames[k], stats->phase[k].cpu);
+    }
+    fprintf(file, "}");
+}
+
+/**
+ * Gets a file and a text.
+ * Responsible for writing the text as a JSON string, quoted and escaped.
+ * @param file
+ * @param text
+ */
+void printJsonString(FILE *file, const char *text)
+{
+    fputc('"', file);
+    for(; *text != END_OF_STRING; text++)
+    {
+        unsigned char c = (unsigned char)*text;
+        if(c == '"' || c == '\\')
+        {
+            fprintf(file, "\\%c", c);
+        }
+        else if(c < ' ')
+        {
+            fprintf(file, "\\u%04x", c);
+        }
+        else
+        {
+            fputc(c, file);
+        }
+    }
+    fputc('"', file);
+}
+
+/**
+ * Gets the program arguments and the options to fill.
+ * Responsible for reading the options that come before the files,
+ * the missing options get their default values.
+ * Return the index of the first file or -1 if an option is wrong.
+ * @param argc
+ * @param argv
+ * @param options
+ * @return the index of the first file
+ */
+int parseOptions(int argc, char *argv[], Options *options)
+{
+    int i = 1;
+
+    options->engine = DMAX_ENGINE_HULL;
+    options->tolerance = DEFAULT_TOLERANCE;
+    options->parser = PARSER_FIXED_COLUMNS;
+    options->jobs = 1;
+    options->threads = 1;
+    options->simd = SIMD_AUTO;
+    options->device = DEVICE_AUTO;
+    options->twoPass = 0;
+    options->deterministic = 0;
+    options->crossCheck = 0;
+    options->maxDistance = 1;
+    options->cache = 0;
+    options->bench = NULL;
+    options->format = FORMAT_TEXT;
+    options->statsPath = NULL;
+    options->statsFile = NULL;
+    options->contactCutoff = 0;
+    options->neighborsPath = NULL;
+    options->rmsdPath = NULL;
+    options->shape = 0;
+    memset(&options->selection, 0, sizeof(options->selection));
+    options->mass = 0;
+    options->resultCache = NULL;
+    options->trustMtime = 0;
+    options->serve = 0;
+    options->socketPath = NULL;
+    for(; i < argc && argv[i][0] == OPTION_PREFIX; i++)
+    {
+        const char *value = i + 1 < argc ? argv[i + 1] : "";
+        if(strcmp(argv[i], JOBS_FLAG) == 0)
+        {
+            if(parseCount(value, &options->jobs) != 0)
+            {
+                printf("Wrong number of jobs: %s", value);
+                return -1;
+            }
+            i++;
+        }
+        else if(strcmp(argv[i], THREADS_FLAG) == 0)
+        {
+            if(parseCount(value, &options->threads) != 0)
+            {
+                printf("Wrong number of threads: %s", value);
+                return -1;
+            }
+            i++;
+        }
+        else if(strcmp(argv[i], DMAX_FLAG) == 0)
+        {
+            if(strcmp(value, DMAX_BRUTE_FORCE) == 0)
+            {
+                options->engine = DMAX_ENGINE_BRUTE_FORCE;
+            }
+            else if(strcmp(value, DMAX_HULL) == 0)
+            {
+                options->engine = DMAX_ENGINE_HULL;
+            }
+            else if(strcmp(value, DMAX_APPROXIMATE) == 0)
+            {
+                options->engine = DMAX_ENGINE_APPROXIMATE;
+            }
+            else if(strcmp(value, DMAX_PRUNED) == 0)
+            {
+                options->engine = DMAX_ENGINE_PRUNED;
+            }
+            else
+            {
+                printf("Unknown Dmax engine: %s", value);
+                return -1;
+            }
+            i++;
+        }
+        else if(strcmp(argv[i], TOLERANCE_FLAG) == 0)
+        {
+            char *end;
+            options->tolerance = strtod(value, &end);
+            if(end == value || *end != END_OF_STRING || !(options->tolerance > 0))
+            {
+                printf("Wrong Dmax tolerance: %s", value);
+                return -1;
+            }
+            i++;
+        }
+        else if(strcmp(argv[i], CONTACTS_FLAG) == 0)
+        {
+            char *end;
+            options->contactCutoff = strtof(value, &end);
+            if(end == value || *end != END_OF_STRING || !(options->contactCutoff > 0))
+            {
+                printf("Wrong contacts cutoff: %s", value);
+                return -1;
+            }
+            i++;
+        }
+        else if(strcmp(argv[i], NEIGHBORS_FLAG) == 0)
+        {
+            options->neighborsPath = value;
+            i++;
+        }
+        else if(strcmp(argv[i], RMSD_FLAG) == 0)
+        {
+            options->rmsdPath = value;
+            i++;
+        }
+        else if(strcmp(argv[i], TWO_PASS_FLAG) == 0)
+        {
+            options->twoPass = 1;
+        }
+        else if(strcmp(argv[i], DETERMINISTIC_FLAG) == 0)
+        {
+            options->deterministic = 1;
+        }
+        else if(strcmp(argv[i], CROSS_CHECK_FLAG) == 0)
+        {
+            options->crossCheck = 1;
+        }
+        else if(strcmp(argv[i], NO_DMAX_FLAG) == 0)
+        {
+            options->maxDistance = 0;
+        }
+        else if(strcmp(argv[i], SHAPE_FLAG) == 0)
+        {
+            options->shape = 1;
+        }
+        else if(strcmp(argv[i], MASS_FLAG) == 0)
+        {
+            options->mass = 1;
+        }
+        else if(strcmp(argv[i], RESULT_CACHE_FLAG) == 0)
+        {
+            options->resultCache = value;
+            i++;
+        }
+        else if(strcmp(argv[i], TRUST_MTIME_FLAG) == 0)
+        {
+            options->trustMtime = 1;
+        }
+        else if(strcmp(argv[i], SERVE_FLAG) == 0)
+        {
+            options->serve = 1;
+        }
+        else if(strcmp(argv[i], SOCKET_FLAG) == 0)
+        {
+            options->serve = 1;
+            options->socketPath = value;
+            i++;
+        }
+        else if(strcmp(argv[i], SELECT_FLAG) == 0)
+        {
+            if(parseSelection(value, &options->selection) != 0)
+            {
+                printf("Wrong selection: %s", value);
+                return -1;
+            }
+            i++;
+        }
+        else if(strcmp(argv[i], CACHE_FLAG) == 0)
+        {
+            options->cache = 1;
+        }
+        else if(strcmp(argv[i], FORMAT_FLAG) == 0)
+        {
+            if(strcmp(value, FORMAT_TEXT_NAME) == 0)
+            {
+                options->format = FORMAT_TEXT;
+            }
+            else if(strcmp(value, FORMAT_CSV_NAME) == 0)
+            {
+                options->format = FORMAT_CSV;
+            }
+            else if(strcmp(value, FORMAT_JSON_NAME) == 0)
+            {
+                options->format = FORMAT_JSON;
+            }
+            else if(strcmp(value, FORMAT_BIN_NAME) == 0)
+            {
+                options->format = FORMAT_BIN;
+            }
+            else
+            {
+                printf("Unknown output format: %s", value);
+                return -1;
+            }
+            i++;
+        }
+        else if(strcmp(argv[i], STATS_FLAG) == 0)
+        {
+            options->statsPath = "-";
+        }
+        else if(strcmp(argv[i], STATS_FILE_FLAG) == 0)
+        {
+            options->statsPath = value;
+            i++;
+        }
+        else if(strcmp(argv[i], BENCH_FLAG) == 0)
+        {
+            //the sizes are optional, a value that isn't a number is the next argument
+            options->bench = value[0] >= '0' && value[0] <= '9' ? argv[++i] : BENCH_DEFAULT_SIZES;
+        }
+        else if(strcmp(argv[i], SIMD_FLAG) == 0)
+        {
+            options->simd = value;
+            i++;
+        }
+        else if(strcmp(argv[i], DEVICE_FLAG) == 0)
+        {
+            options->device = value;
+            i++;
+        }
+        else if(strcmp(argv[i], PARSER_FLAG) == 0)
+        {
+            if(strcmp(value, PARSER_FIXED) == 0)
+            {
+                options->parser = PARSER_FIXED_COLUMNS;
+            }
+            else if(strcmp(value, PARSER_STRTOF) == 0)
+            {
+                options->parser = PARSER_STRTOF_COLUMNS;
+            }
+            else
+            {
+                printf("Unknown coordinate parser: %s", value);
+                return -1;
+            }
+            i++;
+        }
+        else
+        {
+            printf("Unknown option: %s\n%s", argv[i], USAGE);
+            return -1;
+        }
+    }
+    options->keepAtoms = options->maxDistance || options->contactCutoff > 0 || options->rmsdPath != NULL ||
+                         options->crossCheck;
+    if(options->neighborsPath != NULL && options->contactCutoff == 0)
+    {
+        printf("%s needs %s", NEIGHBORS_FLAG, CONTACTS_FLAG);
+        return -1;
+    }
+    if(options->selection.active && options->cache)
+    {
+        printf("%s keeps the atoms of the whole file and can't be used with %s", CACHE_FLAG, SELECT_FLAG);
+        return -1;
+    }
+    if(options->mass && (options->cache || options->twoPass || options->deterministic))
+    {
+        printf("%s needs the elements of the text and can't be used with %s, %s or %s", MASS_FLAG, CACHE_FLAG,
+               TWO_PASS_FLAG, DETERMINISTIC_FLAG);
+        return -1;
+    }
+    if((options->twoPass || options->deterministic) && !options->keepAtoms)
+    {
+        printf("%s needs the stored atoms and can't be used with %s",
+               options->twoPass ? TWO_PASS_FLAG : DETERMINISTIC_FLAG, NO_DMAX_FLAG);
+        return -1;
+    }
+    if(options->crossCheck && options->resultCache != NULL)
+    {
+        printf("%s calculates every frame again and can't be used with %s", CROSS_CHECK_FLAG, RESULT_CACHE_FLAG);
+        return -1;
+    }
+    if(options->resultCache != NULL && options->neighborsPath != NULL)
+    {
+        printf("%s doesn't keep the neighbors of the atoms and can't be used with %s", RESULT_CACHE_FLAG,
+               NEIGHBORS_FLAG);
+        return -1;
+    }
+    if(options->rmsdPath != NULL && (options->resultCache != NULL || options->mass))
+    {
+        printf("%s superposes the stored atoms on their centers and can't be used with %s or %s", RMSD_FLAG,
+               RESULT_CACHE_FLAG, MASS_FLAG);
+        return -1;
+    }
+    if(options->rmsdPath != NULL && (options->serve || options->bench != NULL))
+    {
+        printf("%s is written after the last file and can't be used with %s or %s", RMSD_FLAG,
+               SERVE_FLAG, BENCH_FLAG);
+        return -1;
+    }
+    if(options->trustMtime && options->resultCache == NULL)
+    {
+        printf("%s needs %s", TRUST_MTIME_FLAG, RESULT_CACHE_FLAG);
+        return -1;
+    }
+    options->resultKey = hashOptions(options);
+    return i;
+}
+
+/**
+ * Gets an option value and the count to fill.
+ * Responsible for converting the value to a positive int.
+ * @param value
+ * @param count
+ * @return 0 for success, -1 if the value isn't a positive number
+ */
+int parseCount(const char *value, int *count)
+{
+    char *end;
+    long number = strtol(value, &end, 10);
+
+    if(end == value || *end != END_OF_STRING || number < 1 || number > INT_MAX)
+    {
+        return -1;
+    }
+    *count = (int)number;
+    return 0;
+}
+
+
+/**
+ * Gets the options of a benchmark run.
+ * Responsible for timing every atom count of the benchmark and printing the
+ * results as one JSON document, so runs of two builds can be compared.
+ * @param options
+ * @return 0 for success, 1 for wrong sizes or no memory
+ */
+int runBenchmark(const Options *options)
+{
+    Workspace workspace;
+    const char *size = options->bench;
+    int failed = 0, first = 1;
+
+    initWorkspace(&workspace);
+    printf("{\"engine\": \"%s\", \"parser\": \"%s\", \"simd\": \"%s\", \"device\": \"%s\", \"threads\": %d, "
+           "\"two_pass\": %d, \"repeats\": %d, \"runs\": [", engineNames[options->engine],
+           options->parser == PARSER_FIXED_COLUMNS ? PARSER_FIXED : PARSER_STRTOF, options->simd, options->device,
+           options->threads, options->twoPass, BENCH_REPEATS);
+    while(!failed && *size != END_OF_STRING)
+    {
+        char *end;
+        long atomCount = strtol(size, &end, 10);
+
+        if(end == size || (*end != ',' && *end != END_OF_STRING) || atomCount < 1 || atomCount > INT_MAX / BENCH_LINE_LEN)
+        {
+            printf("]}\nWrong benchmark size: %s", size);
+            failed = 1;
+            break;
+        }
+        printf(first ? "\n" : ",\n");
+        first = 0;
+        failed = benchSize((int)atomCount, options, &workspace);
+        size = *end == ',' ? end + 1 : end;
+    }
+    if(!failed)
+    {
+        printf("\n]}\n");
+    }
+    freeWorkspace(&workspace);
+    return failed;
+}
+
+/**
+ * Gets an atom count, the options and a workspace.
+ * Responsible for generating a PDB text of the atoms in memory and timing its
+ * parse, Cg, Rg and Dmax one by one and the whole analysis of a file, which
+ * is the parse with the moments and the Dmax. Prints one JSON object.
+ * @param atomCount
+ * @param options
+ * @param workspace
+ * @return 0 for success, 1 if the memory ran out
+ */
+int benchSize(int atomCount, const Options *options, Workspace *workspace)
+{
+    PdbBuffer buffer;
+    ParseContext context;
+    FileResult result = {0};
+    double parse = INFINITY, gravity = INFINITY, rotation = INFINITY, distance = INFINITY, total = INFINITY;
+    float gravityCenter[COORDINATES], maxDistance = 0, upperBound;
+    char *data = generatePdb(atomCount, BENCH_SEED, &buffer.size);
+
+    if(data == NULL)
+    {
+        printf("]}\nError allocating memory for the benchmark of %d atoms", atomCount);
+        return 1;
+    }
+    buffer.data = data;
+    buffer.mapped = 0;
+    for(int run = 0; run < BENCH_REPEATS; run++)
+    {
+        double start, finish, begin, parsed;
+
+        initParseContext(&context, BENCH_PATH, options, workspace, discardFrame);
+        begin = wallSeconds();
+        result.status = parsePdbBuffer(&buffer, &context, &result);
+        parsed = wallSeconds();
+        if(result.status != FILE_OK || context.moments.count != atomCount)
+        {
+            free(data);
+            printf("]}\nError parsing the benchmark of %d atoms", atomCount);
+            return 1;
+        }
+        parse = fmin(parse, parsed - begin);
+
+        start = wallSeconds();
+        calCenterOfGravity(context.atoms, gravityCenter);
+        finish = wallSeconds();
+        gravity = fmin(gravity, finish - start);
+
+        start = wallSeconds();
+        calRotationRadious(context.atoms, gravityCenter);
+        finish = wallSeconds();
+        rotation = fmin(rotation, finish - start);
+
+        start = wallSeconds();
+        maxDistance = calMaxDistance(context.atoms, options, workspace, &upperBound);
+        finish = wallSeconds();
+        distance = fmin(distance, finish - start);
+
+        start = wallSeconds();
+        finishFrame(&context, &result);
+        finish = wallSeconds();
+        total = fmin(total, (parsed - begin) + (finish - start));
+    }
+    printf("  {\"atoms\": %d, \"bytes\": %lu, \"parse_s\": %.6f, \"cg_s\": %.6f, \"rg_s\": %.6f, "
+           "\"dmax_s\": %.6f, \"total_s\": %.6f, \"atoms_per_s\": %.0f, \"mb_per_s\": %.1f, \"dmax\": %.3f}",
+           atomCount, (unsigned long)buffer.size, parse, gravity, rotation, distance, total,
+           atomCount / total, buffer.size / MEGABYTE / total, maxDistance);
+    free(data);
+    return 0;
+}
+
+/**
+ * Gets an atom count, a seed and the size to fill.
+ * Responsible for writing a PDB text of ATOM lines with the atoms spread
+ * uniformly in a ball of protein density, the same seed gives the same text.
+ * @param atomCount
+ * @param seed
+ * @param size
+ * @return the text, allocated, or NULL if the memory ran out
+ */
+char *generatePdb(int atomCount, unsigned int seed, size_t *size)
+{
+    double radius = cbrt(atomCount / BENCH_DENSITY / BALL_VOLUME);
+    char *data = malloc((size_t)atomCount * BENCH_LINE_LEN + 1);
+    char *line = data;
+
+    if(data == NULL)
+    {
+        return NULL;
+    }
+    for(int i = 0; i < atomCount; i++)
+    {
+        double point[COORDINATES], squared;
+        do
+        {
+            squared = 0;
+            for(int k = 0; k < COORDINATES; k++)
+            {
+                seed = seed * 1103515245u + 12345u;
+                point[k] = ((seed >> 8) / (double)(1u << 24)) * 2 - 1;
+                squared += point[k] * point[k];
+            }
+        } while(squared > 1);
+        line += sprintf(line, "ATOM  %5d  CA  ALA A%4d    %8.3f%8.3f%8.3f  1.00  0.00           C\n",
+                        i % 100000, i / 10 % 10000, point[0] * radius, point[1] * radius, point[2] * radius);
+    }
+    *size = line - data;
+    return data;
+}
+
+/**
+ * Return the time of a monotonic clock in seconds.
+ * @return the seconds
+ */
+double wallSeconds(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / NANOSECONDS;
+}
+
+/**
+ * Gets a path, its result and a frame.
+ * Responsible for nothing, the benchmark only times the frames.
+ * @param path
+ * @param result
+ * @param frame
+ * @return 0
+ */
+int discardFrame(const char *path, FileResult *result, const FrameResult *frame)
+{
+    (void)path;
+    (void)result;
+    free(frame->neighborCounts);
+    return 0;
+}
+
+
+/**
+ * Gets a string line and checks if the line starts with the substring "ATOM"
+ * return 0 for true 1 otherwise
+ * @param line
+ * @return the result
+ */
+int startsWith(const char* line)
+{
+    return (strncmp(line, LINE_STARTER, LINE_STARTER_LEN) == 0);
+
+}
+
+/**
+ * Gets a line of at least LINE_STARTER_LEN characters and the selection.
+ * Return 1 if the line is an ATOM line, or a HETATM line the selection takes, 0 otherwise.
+ * @param line
+ * @param selection
+ * @return the result
+ */
+int isAtomRecord(const char *line, const Selection *selection)
+{
+    return startsWith(line) || (selection->hetatm && strncmp(line, HETATM_STARTER, LINE_STARTER_LEN) == 0);
+}
+
+/**
+ * Gets an atom line longer than MIN_LINE_LEN and an active selection.
+ * Responsible for matching the chain, the name and the residue number columns
+ * of the line to the filters, without touching the coordinates.
+ * A residue number that isn't a number (hybrid-36) matches no range.
+ * @param line
+ * @param selection
+ * @return 1 if the atom is selected, 0 otherwise
+ */
+int selectAtom(const char *line, const Selection *selection)
+{
+    const char *name = line + NAME_FIELD;
+    int start = 0, end = NAME_LEN, residue = 0, hasResidue = 0;
+
+    while(start < end && name[start] == ' ')
+    {
+        start++;
+    }
+    while(end > start && name[end - 1] == ' ')
+    {
+        end--;
+    }
+    if(selection->residueCount > 0)
+    {
+        const char *field = line + RESIDUE_FIELD;
+        int k = 0, negative = 0, digits = 0;
+        while(k < RESIDUE_LEN && field[k] == ' ')
+        {
+            k++;
+        }
+        if(k < RESIDUE_LEN && field[k] == '-')
+        {
+            negative = 1;
+            k++;
+        }
+        for(; k < RESIDUE_LEN && field[k] >= '0' && field[k] <= '9'; k++, digits++)
+        {
+            residue = residue * 10 + (field[k] - '0');
+        }
+        hasResidue = digits > 0 && k == RESIDUE_LEN;
+        residue = negative ? -residue : residue;
+    }
+    return matchSelection(selection, line + CHAIN_FIELD, 1, name + start, end - start, residue, hasResidue);
+}
+
+/**
+ * Gets an active selection and the chain, the name and the residue number of
+ * an atom, from a PDB line or an mmCIF row.
+ * Responsible for matching them to the filters. A chain of more than one
+ * letter, a missing name or a missing residue number match no filter.
+ * @param selection
+ * @param chain
+ * @param chainLength
+ * @param name
+ * @param nameLength
+ * @param residue
+ * @param hasResidue
+ * @return 1 if the atom is selected, 0 otherwise
+ */
+int matchSelection(const Selection *selection, const char *chain, int chainLength, const char *name, int nameLength,
+                   int residue, int hasResidue)
+{
+    int matched = 0;
+
+    if(selection->chains[0] != END_OF_STRING && (chainLength != 1 || strchr(selection->chains, chain[0]) == NULL))
+    {
+        return 0;
+    }
+    for(int i = 0; i < selection->nameCount && !matched; i++)
+    {
+        matched = (int)strlen(selection->names[i]) == nameLength && strncmp(selection->names[i], name, nameLength) == 0;
+    }
+    if(selection->nameCount > 0 && !matched)
+    {
+        return 0;
+    }
+    matched = 0;
+    for(int i = 0; i < selection->residueCount && hasResidue && !matched; i++)
+    {
+        matched = residue >= selection->residues[i][0] && residue <= selection->residues[i][1];
+    }
+    return selection->residueCount == 0 || matched;
+}
+
+/**
+ * Gets a selection expression and the selection to fill.
+ * Responsible for reading the space separated terms of the expression:
+ * hetatm, chain=A,B, name=CA,CB and resi=10-20,35.
+ * @param expression
+ * @param selection
+ * @return 0 for success, -1 if the expression is wrong
+ */
+int parseSelection(const char *expression, Selection *selection)
+{
+    static const char *keys[] = {SELECT_CHAIN, SELECT_NAME, SELECT_RESIDUE};
+
+    memset(selection, 0, sizeof(*selection));
+    selection->active = 1;
+    while(*expression != END_OF_STRING)
+    {
+        size_t length = strcspn(expression, SELECT_SEPARATOR);
+        int known = length == 0;
+
+        if(length == strlen(SELECT_HETATM) && strncmp(expression, SELECT_HETATM, length) == 0)
+        {
+            selection->hetatm = 1;
+            known = 1;
+        }
+        for(int k = 0; k < (int)(sizeof(keys) / sizeof(keys[0])) && !known; k++)
+        {
+            size_t keyLength = strlen(keys[k]);
+            if(length > keyLength && strncmp(expression, keys[k], keyLength) == 0)
+            {
+                if(parseSelectionItems(keys[k], expression + keyLength, length - keyLength, selection) != 0)
+                {
+                    return -1;
+                }
+                known = 1;
+            }
+        }
+        if(!known)
+        {
+            return -1;
+        }
+        expression += length;
+        expression += *expression != END_OF_STRING;
+    }
+    return 0;
+}
+
+/**
+ * Gets the key of a selection term, its comma separated items with their length
+ * and the selection to fill.
+ * Responsible for adding the chains, the names or the residue ranges of the term.
+ * @param key
+ * @param items
+ * @param length
+ * @param selection
+ * @return 0 for success, -1 if an item is wrong or there are too many
+ */
+int parseSelectionItems(const char *key, const char *items, size_t length, Selection *selection)
+{
+    const char *end = items + length;
+
+    while(items < end)
+    {
+        size_t itemLength = strcspn(items, SELECT_LIST_SEPARATOR SELECT_SEPARATOR);
+        itemLength = itemLength < (size_t)(end - items) ? itemLength : (size_t)(end - items);
+        if(itemLength == 0)
+        {
+            return -1;
+        }
+        if(strcmp(key, SELECT_CHAIN) == 0)
+        {
+            size_t chainCount = strlen(selection->chains);
+            if(itemLength != 1 || chainCount == SELECT_MAX_CHAINS)
+            {
+                return -1;
+            }
+            selection->chains[chainCount] = items[0];
+        }
+        else if(strcmp(key, SELECT_NAME) == 0)
+        {
+            if(itemLength > NAME_LEN || selection->nameCount == SELECT_MAX_ITEMS)
+            {
+                return -1;
+            }
+            memcpy(selection->names[selection->nameCount], items, itemLength);
+            selection->names[selection->nameCount++][itemLength] = END_OF_STRING;
+        }
+        else
+        {
+            char *after;
+            long first = strtol(items, &after, 10), last = first;
+            if(after == items || selection->residueCount == SELECT_MAX_ITEMS)
+            {
+                return -1;
+            }
+            if(after < items + itemLength && *after == SELECT_RANGE_SEPARATOR)
+            {
+                const char *lastStart = after + 1;
+                last = strtol(lastStart, &after, 10);
+                if(after == lastStart)
+                {
+                    return -1;
+                }
+            }
+            if(after != items + itemLength || first > last || first < INT_MIN || last > INT_MAX)
+            {
+                return -1;
+            }
+            selection->residues[selection->residueCount][0] = (int)first;
+            selection->residues[selection->residueCount++][1] = (int)last;
+        }
+        items += itemLength + 1;
+    }
+    return 0;
+}
+
+/**
+ * Gets a string line with its length, the parse context and the file result
+ * Responsible for parsing the line, gets the relevant substrings,
+ * adds them to the moments and to the atoms store.
+ * A coordinate that can't be converted, or an unknown element of a weighted
+ * run, is copied to the result.
+ * @param fileLine
+ * @param lineLength
+ * @param context
+ * @param result
+ * @return FILE_OK for success or the error status
+ */
+FileStatus parseLine(const char *fileLine, size_t lineLength, ParseContext *context, FileResult *result)
+{
+    static const int fields[COORDINATES] = {X_FIELD, Y_FIELD, Z_FIELD};
+    float coordinates[COORDINATES];
+    float mass = 0;
+
+    for(int k = 0; k < COORDINATES; k++)
+    {
+        int converted = context->options->parser == PARSER_FIXED_COLUMNS ?
+                        parseCoordinate(fileLine + fields[k], &coordinates[k]) :
+                        getFieldFloat(fileLine + fields[k], &coordinates[k]);
+        if(converted != 0)
+        {
+            memcpy(result->badField, fileLine + fields[k], COORDINATE_LEN);
+            result->badField[COORDINATE_LEN] = END_OF_STRING;
+            return FILE_BAD_COORDINATE;
+        }
+    }
+    if(context->options->mass && (mass = atomMass(fileLine, lineLength, result->badField)) == 0)
+    {
+        return FILE_UNKNOWN_ELEMENT;
+    }
+    return storeAtom(context, coordinates, mass);
+}
+
+/**
+ * Gets the parse context, the coordinates of an atom and its mass, 0 for
+ * a run without masses.
+ * Responsible for adding the atom to the moments and to the atoms store.
+ * @param context
+ * @param coordinates
+ * @param mass
+ * @return FILE_OK for success or FILE_NO_MEMORY
+ */
+FileStatus storeAtom(ParseContext *context, const float coordinates[COORDINATES], float mass)
+{
+    if(context->atoms != NULL && addAtom(context->atoms, coordinates[0], coordinates[1], coordinates[2]) != 0)
+    {
+        return FILE_NO_MEMORY;
+    }
+    if(context->options->mass)
+    {
+        addWeightedMoments(&context->moments, coordinates[0], coordinates[1], coordinates[2], mass);
+    }
+    else
+    {
+        addMoments(&context->moments, coordinates[0], coordinates[1], coordinates[2]);
+    }
+    return FILE_OK;
+}
+
+/**
+ * Gets an atom line with its length and the symbol to fill.
+ * Responsible for finding the element of the atom in columns 77-78 and looking
+ * its mass up in the table of the elements. When the line ends before them or
+ * they are blank the name of the atom is used as the PDB aligns it: a one letter
+ * element in column 14 (" CA " is carbon), a two letter element in columns
+ * 13-14 ("FE  "), the first letter when they aren't an element ("HD11").
+ * @param line
+ * @param lineLength
+ * @param element the symbol, kept for the error of an unknown element
+ * @return the mass, 0 for an unknown element
+ */
+float atomMass(const char *line, size_t lineLength, char element[ELEMENT_LEN + 1])
+{
+    char symbol[ELEMENT_LEN] = {' ', ' '};
+    int fromName = 0;
+    float mass;
+
+    if(lineLength >= ELEMENT_FIELD + ELEMENT_LEN && (line[ELEMENT_FIELD] != ' ' || line[ELEMENT_FIELD + 1] != ' '))
+    {
+        symbol[0] = line[ELEMENT_FIELD] == ' ' ? line[ELEMENT_FIELD + 1] : line[ELEMENT_FIELD];
+        symbol[1] = line[ELEMENT_FIELD] == ' ' ? ' ' : line[ELEMENT_FIELD + 1];
+    }
+    else if(line[NAME_FIELD] == ' ' || (line[NAME_FIELD] >= '0' && line[NAME_FIELD] <= '9'))
+    {
+        symbol[0] = line[NAME_FIELD + 1];
+    }
+    else
+    {
+        symbol[0] = line[NAME_FIELD];
+        symbol[1] = line[NAME_FIELD + 1];
+        fromName = 1;
+    }
+    for(int k = 0; k < ELEMENT_LEN; k++)
+    {
+        symbol[k] = symbol[k] >= 'a' && symbol[k] <= 'z' ? symbol[k] - 'a' + 'A' : symbol[k];
+        element[k] = symbol[k];
+    }
+    element[symbol[1] == ' ' ? 1 : ELEMENT_LEN] = END_OF_STRING;
+    mass = elementMass(symbol[0], symbol[1]);
+    if(mass == 0 && fromName && symbol[1] != ' ')
+    {
+        element[1] = END_OF_STRING;
+        mass = elementMass(symbol[0], ' ');
+    }
+    return mass;
+}
+
+/**
+ * Gets the letters of an element symbol in any case, a blank second letter
+ * for a one letter symbol.
+ * Return the mass of the element, 0 for an unknown element.
+ * @param first
+ * @param second
+ * @return the mass
+ */
+float elementMass(char first, char second)
+{
+    first = first >= 'a' && first <= 'z' ? first - 'a' + 'A' : first;
+    second = second >= 'a' && second <= 'z' ? second - 'a' + 'A' : second;
+    if(first < 'A' || first > 'Z' || (second != ' ' && (second < 'A' || second > 'Z')))
+    {
+        return 0;
+    }
+    return elementMasses[ELEMENT_INDEX(first, second)];
+}
+
+/**
+ * Gets the moments.
+ * Responsible for initializing the moments of an empty file.
+ * @param moments
+ */
+void initMoments(Moments *moments)
+{
+    moments->count = 0;
+    moments->mass = 0;
+    moments->deviations = 0;
+    for(int k = 0; k < COORDINATES; k++)
+    {
+        moments->mean[k] = 0;
+    }
+    for(int k = 0; k < TENSOR_TERMS; k++)
+    {
+        moments->comoments[k] = 0;
+    }
+}
+
+/**
+ * Gets the moments and the coordinates of an atom.
+ * Responsible for moving the mean toward the atom and adding its deviation,
+ * delta * (x - new mean) is the exact growth of the sum of squared deviations,
+ * and delta_x * (y - new mean_y) the growth of the xy comoment.
+ * @param moments
+ * @param x
+ * @param y
+ * @param z
+ */
+void addMoments(Moments *moments, float x, float y, float z)
+{
+    const double coordinates[COORDINATES] = {x, y, z};
+    double delta[COORDINATES], spread[COORDINATES];
+    double weight;
+
+    moments->count++;
+    weight = 1.0 / moments->count;
+    for(int k = 0; k < COORDINATES; k++)
+    {
+        delta[k] = coordinates[k] - moments->mean[k];
+        moments->mean[k] += delta[k] * weight;
+        spread[k] = coordinates[k] - moments->mean[k];
+        moments->deviations += delta[k] * spread[k];
+        moments->comoments[k] += delta[k] * spread[k];
+    }
+    moments->comoments[3] += delta[0] * spread[1];
+    moments->comoments[4] += delta[0] * spread[2];
+    moments->comoments[5] += delta[1] * spread[2];
+}
+
+/**
+ * Gets the moments of a file.
+ * Return the rotation radious, the root of the mean squared distance from the center.
+ * @param moments
+ * @return the rotation radious
+ */
+float momentsRotationRadius(const Moments *moments)
+{
+    return (float)sqrt(moments->deviations / momentsWeight(moments));
+}
+
+/**
+ * Gets the moments and the coordinates of an atom with its mass.
+ * Responsible for the weighted update of West, the mean moves by mass / total mass
+ * of the delta and every sum grows by mass * delta * (x - new mean).
+ * It is kept apart from addMoments so the unweighted run is as it was.
+ * @param moments
+ * @param x
+ * @param y
+ * @param z
+ * @param mass
+ */
+void addWeightedMoments(Moments *moments, float x, float y, float z, double mass)
+{
+    const double coordinates[COORDINATES] = {x, y, z};
+    double delta[COORDINATES], spread[COORDINATES];
+    double weight;
+
+    moments->count++;
+    moments->mass += mass;
+    weight = mass / moments->mass;
+    for(int k = 0; k < COORDINATES; k++)
+    {
+        delta[k] = coordinates[k] - moments->mean[k];
+        moments->mean[k] += delta[k] * weight;
+        spread[k] = mass * (coordinates[k] - moments->mean[k]);
+        moments->deviations += delta[k] * spread[k];
+        moments->comoments[k] += delta[k] * spread[k];
+    }
+    moments->comoments[3] += delta[0] * spread[1];
+    moments->comoments[4] += delta[0] * spread[2];
+    moments->comoments[5] += delta[1] * spread[2];
+}
+
+/**
+ * Gets the moments of a frame.
+ * Return what the sums are divided by, the total mass or the number of atoms.
+ * @param moments
+ * @return the weight of the moments
+ */
+double momentsWeight(const Moments *moments)
+{
+    return moments->mass > 0 ? moments->mass : moments->count;
+}
+
+/**
+ * Gets the moments of a frame and the frame to fill.
+ * Responsible for the gyration tensor of the frame, the comoments over the
+ * number of atoms, and its eigenvalues, asphericity and principal axes.
+ * @param moments
+ * @param frame
+ */
+void calGyrationShape(const Moments *moments, FrameResult *frame)
+{
+    double tensor[TENSOR_TERMS], eigenvalues[COORDINATES], axes[COORDINATES][COORDINATES];
+
+    for(int k = 0; k < TENSOR_TERMS; k++)
+    {
+        tensor[k] = moments->comoments[k] / momentsWeight(moments);
+    }
+    solveSymmetric3(tensor, eigenvalues, axes);
+    for(int k = 0; k < COORDINATES; k++)
+    {
+        frame->eigenvalues[k] = (float)eigenvalues[k];
+        for(int j = 0; j < COORDINATES; j++)
+        {
+            frame->axes[k][j] = (float)axes[k][j];
+        }
+    }
+    frame->asphericity = (float)(eigenvalues[0] - (eigenvalues[1] + eigenvalues[2]) / 2);
+}
+
+/**
+ * Gets a symmetric 3 x 3 tensor (xx, yy, zz, xy, xz, yz) and the eigenvalues and axes to fill.
+ * Responsible for the closed form eigenvalues of the trigonometric solution of
+ * the characteristic cubic, largest first, and their unit eigenvectors. The
+ * eigenvectors of the largest and the smallest eigenvalue come from the rows of
+ * tensor - eigenvalue * I, a repeated eigenvalue takes any axis perpendicular
+ * to the others. Every axis has its largest component positive but the middle
+ * one, that makes the axes right handed.
+ * @param tensor
+ * @param eigenvalues
+ * @param axes
+ */
+void solveSymmetric3(const double tensor[TENSOR_TERMS], double eigenvalues[3], double axes[3][3])
+{
+    double offDiagonal = tensor[3] * tensor[3] + tensor[4] * tensor[4] + tensor[5] * tensor[5];
+    double mean = (tensor[0] + tensor[1] + tensor[2]) / 3;
+    double spread = 0;
+    int found[COORDINATES] = {0, 0, 0};
+
+    for(int k = 0; k < COORDINATES; k++)
+    {
+        spread += (tensor[k] - mean) * (tensor[k] - mean);
+    }
+    spread = sqrt((spread + 2 * offDiagonal) / 6);
+    if(spread == 0)
+    {
+        eigenvalues[0] = eigenvalues[1] = eigenvalues[2] = mean;
+    }
+    else
+    {
+        //the determinant of (tensor - mean * I) / spread is 2 cos(3 phi)
+        double a = (tensor[0] - mean) / spread, b = (tensor[1] - mean) / spread, c = (tensor[2] - mean) / spread;
+        double d = tensor[3] / spread, e = tensor[4] / spread, f = tensor[5] / spread;
+        double half = (a * (b * c - f * f) - d * (d * c - f * e) + e * (d * f - b * e)) / 2;
+        double phi = acos(half <= -1 ? -1 : half >= 1 ? 1 : half) / 3;
+        eigenvalues[0] = mean + 2 * spread * cos(phi);
+        eigenvalues[2] = mean + 2 * spread * cos(phi + TWO_THIRDS_PI);
+        eigenvalues[1] = 3 * mean - eigenvalues[0] - eigenvalues[2];
+    }
+
+    found[0] = spread > 0 && calEigenvector(tensor, eigenvalues[0], axes[0]) == 0;
+    found[2] = spread > 0 && calEigenvector(tensor, eigenvalues[2], axes[2]) == 0;
+    if(!found[0] && !found[2]) //a round frame, every axis is principal
+    {
+        for(int k = 0; k < COORDINATES; k++)
+        {
+            for(int j = 0; j < COORDINATES; j++)
+            {
+                axes[k][j] = k == j;
+            }
+        }
+        return;
+    }
+    if(!found[0])
+    {
+        perpendicularAxis(axes[2], axes[0]);
+    }
+    if(!found[2])
+    {
+        perpendicularAxis(axes[0], axes[2]);
+    }
+    crossProduct(axes[2], axes[0], axes[1]);
+}
+
+/**
+ * Gets a symmetric 3 x 3 tensor, one of its eigenvalues and the axis to fill.
+ * Responsible for the eigenvector as the longest cross product of two rows of
+ * tensor - eigenvalue * I, all of them are perpendicular to it.
+ * @param tensor
+ * @param eigenvalue
+ * @param axis
+ * @return 0 for success, -1 if the eigenvalue is repeated and has no single axis
+ */
+int calEigenvector(const double tensor[TENSOR_TERMS], double eigenvalue, double axis[3])
+{
+    const double rows[COORDINATES][COORDINATES] = {{tensor[0] - eigenvalue, tensor[3], tensor[4]},
+                                                   {tensor[3], tensor[1] - eigenvalue, tensor[5]},
+                                                   {tensor[4], tensor[5], tensor[2] - eigenvalue}};
+    double best = 0, scale = 0, length, largest = 0;
+
+    for(int k = 0; k < COORDINATES; k++)
+    {
+        scale = fmax(scale, rows[k][0] * rows[k][0] + rows[k][1] * rows[k][1] + rows[k][2] * rows[k][2]);
+    }
+    for(int first = 0; first < COORDINATES; first++)
+    {
+        for(int second = first + 1; second < COORDINATES; second++)
+        {
+            double candidate[COORDINATES], squaredLength;
+            crossProduct(rows[first], rows[second], candidate);
+            squaredLength = candidate[0] * candidate[0] + candidate[1] * candidate[1] + candidate[2] * candidate[2];
+            if(squaredLength > best)
+            {
+                best = squaredLength;
+                memcpy(axis, candidate, sizeof(candidate));
+            }
+        }
+    }
+    length = sqrt(best);
+    if(scale == 0 || length <= SHAPE_EPSILON * scale)
+    {
+        return -1;
+    }
+    for(int k = 0; k < COORDINATES; k++)
+    {
+        axis[k] /= length;
+        largest = fabs(axis[k]) > fabs(largest) ? axis[k] : largest;
+    }
+    for(int k = 0; k < COORDINATES && largest < 0; k++)
+    {
+        axis[k] = -axis[k];
+    }
+    return 0;
+}
+
+/**
+ * Gets a unit axis and the axis to fill.
+ * Responsible for a unit axis perpendicular to it, across the coordinate it is the farthest from.
+ * @param axis
+ * @param result
+ */
+void perpendicularAxis(const double axis[3], double result[3])
+{
+    double other[COORDINATES] = {0, 0, 0}, length;
+    int smallest = 0;
+
+    for(int k = 1; k < COORDINATES; k++)
+    {
+        smallest = fabs(axis[k]) < fabs(axis[smallest]) ? k : smallest;
+    }
+    other[smallest] = 1;
+    crossProduct(axis, other, result);
+    length = sqrt(result[0] * result[0] + result[1] * result[1] + result[2] * result[2]);
+    for(int k = 0; k < COORDINATES; k++)
+    {
+        result[k] /= length;
+    }
+}
+
+/**
+ * Gets two vectors and the vector to fill.
+ * Responsible for the cross product first x second.
+ * @param first
+ * @param second
+ * @param result
+ */
+void crossProduct(const double first[3], const double second[3], double result[3])
+{
+    result[0] = first[1] * second[2] - first[2] * second[1];
+    result[1] = first[2] * second[0] - first[0] * second[2];
+    result[2] = first[0] * second[1] - first[1] * second[0];
+}
+
+/**
+ * Gets a pointer to a coordinate column inside a line and the float to fill.
+ * Responsible for copying the column to a string and converting it with getFloat.
+ * @param field
+ * @param result
+ * @return 0 for success, -1 if the column isn't a number
+ */
+int getFieldFloat(const char *field, float *result)
+{
+    char fieldString[COORDINATE_LEN + 1];
+
+    memcpy(fieldString, field, COORDINATE_LEN);
+    fieldString[COORDINATE_LEN] = END_OF_STRING;
+    return getFloat(fieldString, result);
+}
+
+/**
+ * Gets a pointer to a coordinate column inside a line and the float to fill.
+ * Responsible for converting the %8.3f column in place: optional spaces and sign,
+ * digits, a point and exactly 3 decimals are accumulated as an integer of
+ * thousandths. The single float division rounds like strtof does.
+ * Any other layout goes through getFloat, with the same validation.
+ * @param field
+ * @param result
+ * @return 0 for success, -1 if the column isn't a number
+ */
+int parseCoordinate(const char *field, float *result)
+{
+    const char *end = field + COORDINATE_LEN;
+    const char *point = end - COORDINATE_DECIMALS - 1;
+    const char *c = field;
+    int negative = 0;
+    int value = 0;
+
+    while(c < point && *c == ' ')
+    {
+        c++;
+    }
+    if(c < point && *c == '-')
+    {
+        negative = 1;
+        c++;
+    }
+    if(c == point || *point != '.') //no integer digits or not the common layout
+    {
+        return getFieldFloat(field, result);
+    }
+    for(; c < end; c++)
+    {
+        if(c == point)
+        {
+            continue;
+        }
+        if(*c < '0' || *c > '9')
+        {
+            return getFieldFloat(field, result);
+        }
+        value = value * 10 + (*c - '0');
+    }
+    *result = (negative ? -(float)value : (float)value) / COORDINATE_SCALE;
+    return 0;
+}
+
+
+/**
+ * Gets an atoms store.
+ * Responsible for initializing an empty store, memory is allocated by the first atom.
+ * @param atoms
+ */
+void initAtomStore(AtomStore *atoms)
+{
+    for(int k = 0; k < COORDINATES; k++)
+    {
+        atoms->lane[k] = NULL;
+    }
+    atoms->count = 0;
+    atoms->capacity = 0;
+}
+
+/**
+ * Gets an atoms store and the coordinates of an atom.
+ * Responsible for adding the atom at the end of the lanes, when the lanes are
+ * full they are moved to new aligned lanes of double size.
+ * @param atoms
+ * @param x
+ * @param y
+ * @param z
+ * @return 0 for success, -1 if the memory ran out
+ */
+int addAtom(AtomStore *atoms, float x, float y, float z)
+{
+    if(atoms->count == atoms->capacity)
+    {
+        int capacity = atoms->capacity == 0 ? STORE_INITIAL_CAPACITY : atoms->capacity * 2;
+        float *lanes[COORDINATES];
+        for(int k = 0; k < COORDINATES; k++)
+        {
+            void *lane;
+            if(posix_memalign(&lane, STORE_ALIGNMENT, sizeof(float) * capacity) != 0)
+            {
+                while(k-- > 0)
+                {
+                    free(lanes[k]);
+                }
+                return -1;
+            }
+            lanes[k] = lane;
+        }
+        for(int k = 0; k < COORDINATES; k++)
+        {
+            if(atoms->count > 0)
+            {
+                memcpy(lanes[k], atoms->lane[k], sizeof(float) * atoms->count);
+            }
+            free(atoms->lane[k]);
+            atoms->lane[k] = lanes[k];
+        }
+        atoms->capacity = capacity;
+    }
+    atoms->lane[0][atoms->count] = x;
+    atoms->lane[1][atoms->count] = y;
+    atoms->lane[2][atoms->count] = z;
+    atoms->count++;
+    return 0;
+}
+
+/**
+ * Gets an atoms store.
+ * Responsible for releasing the lanes of the store.
+ * @param atoms
+ */
+void freeAtomStore(AtomStore *atoms)
+{
+    for(int k = 0; k < COORDINATES; k++)
+    {
+        free(atoms->lane[k]);
+        atoms->lane[k] = NULL;
+    }
+    atoms->count = 0;
+    atoms->capacity = 0;
+}
+
+
+/**
+ * Gets a path and an empty buffer.
+ * Responsible for opening the file and reading it with mapPdbBuffer.
+ * @param path
+ * @param buffer
+ * @return 0 for success, -1 if the file couldn't open or be read to the heap
+ */
+int openPdbBuffer(const char *path, PdbBuffer *buffer)
+{
+    int fd = open(path, O_RDONLY);
+
+    buffer->data = NULL;
+    buffer->size = 0;
+    buffer->mapped = 0;
+    if(fd < 0)
+    {
+        return -1;
+    }
+    return mapPdbBuffer(fd, buffer);
+}
+
+/**
+ * Gets an open file and an empty buffer.
+ * Responsible for mapping the whole file to memory, inputs that can't be
+ * mapped are read to the heap instead. A failed read leaves an empty buffer.
+ * The file is closed.
+ * @param fd
+ * @param buffer
+ * @return 0 for success, -1 if the memory ran out
+ */
+int mapPdbBuffer(int fd, PdbBuffer *buffer)
+{
+    struct stat status;
+    char *data = NULL;
+    size_t size = 0, capacity = 0;
+    ssize_t bytes = 0;
+
+    buffer->data = NULL;
+    buffer->size = 0;
+    buffer->mapped = 0;
+    if(fstat(fd, &status) == 0 && S_ISREG(status.st_mode))
+    {
+        if(status.st_size > 0)
+        {
+            void *map = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(map != MAP_FAILED)
+            {
+                posix_madvise(map, status.st_size, POSIX_MADV_SEQUENTIAL);
+                buffer->data = map;
+                buffer->size = status.st_size;
+                buffer->mapped = 1;
+            }
+        }
+        if(buffer->mapped || status.st_size == 0)
+        {
+            close(fd);
+            return 0;
+        }
+    }
+
+    do
+    {
+        if(size == capacity)
+        {
+            char *grown = realloc(data, capacity + READ_CHUNK);
+            if(grown == NULL)
+            {
+                free(data);
+                close(fd);
+                return -1;
+            }
+            data = grown;
+            capacity += READ_CHUNK;
+        }
+        bytes = read(fd, data + size, capacity - size);
+        size += bytes > 0 ? bytes : 0;
+    } while(bytes > 0);
+    close(fd);
+    if(bytes != 0) //the read stopped on an error, nothing is trusted
+    {
+        free(data);
+        return 0;
+    }
+    buffer->data = data;
+    buffer->size = size;
+    return 0;
+}
+
+/**
+ * Gets a buffer.
+ * Responsible for unmapping or freeing the content of the buffer.
+ * @param buffer
+ */
+void closePdbBuffer(PdbBuffer *buffer)
+{
+    if(buffer->mapped)
+    {
+        munmap((void *)buffer->data, buffer->size);
+    }
+    else
+    {
+        free((void *)buffer->data);
+    }
+    buffer->data = NULL;
+    buffer->size = 0;
+}
+
+/**
+ * Gets a path, whether the atoms will be kept and the input to fill.
+ * Responsible for opening the file and choosing its reader: the streaming
+ * window for a text file when the atoms aren't kept, and the mapped buffer
+ * otherwise, which a compressed file is decompressed from.
+ * @param path
+ * @param keepAtoms
+ * @param input
+ * @return 0 for success, -1 if the file couldn't open
+ */
+int openPdbInput(const char *path, int keepAtoms, PdbInput *input)
+{
+    input->buffer.data = NULL;
+    input->buffer.size = 0;
+    input->buffer.mapped = 0;
+    input->compression = COMPRESSION_NONE;
+    input->noMemory = 0;
+    input->fd = open(path, O_RDONLY);
+    input->open = input->fd >= 0;
+    if(!input->open)
+    {
+        return -1;
+    }
+    input->compression = detectCompression(input->fd);
+    if(input->compression != COMPRESSION_NONE || keepAtoms)
+    {
+        input->noMemory = mapPdbBuffer(input->fd, &input->buffer) != 0;
+        input->fd = -1;
+    }
+    return 0;
+}
+
+/**
+ * Gets an opened input.
+ * Responsible for getting the file from the disk now, a mapped file is read
+ * page by page and the kernel is asked to read ahead a file read by descriptor.
+ * @param input
+ */
+void warmPdbInput(const PdbInput *input)
+{
+    volatile char sink = 0;
+
+    if(input->buffer.mapped)
+    {
+        for(size_t i = 0; i < input->buffer.size; i += PREFETCH_PAGE)
+        {
+            sink ^= input->buffer.data[i];
+        }
+    }
+    else if(input->fd >= 0)
+    {
+        posix_fadvise(input->fd, 0, 0, POSIX_FADV_WILLNEED);
+    }
+    (void)sink;
+}
+
+/**
+ * Gets an opened input, the parse context and the file result.
+ * Responsible for parsing the input with its reader and closing it.
+ * A file of one mmCIF model has no model, as a PDB file without MODEL records.
+ * @param input
+ * @param context
+ * @param result
+ * @return FILE_OK for success or the error status
+ */
+FileStatus parsePdbInput(PdbInput *input, ParseContext *context, FileResult *result)
+{
+    FileStatus status;
+
+    if(!input->open) // if the file couldn't open
+    {
+        return FILE_OPEN_FAILED;
+    }
+    if(input->noMemory)
+    {
+        return FILE_NO_MEMORY;
+    }
+    if(input->compression != COMPRESSION_NONE)
+    {
+        status = parseCompressed(&input->buffer, input->compression, context, result);
+    }
+    else if(input->fd >= 0)
+    {
+        status = parsePdbStream(input->fd, context, result);
+    }
+    else
+    {
+        status = parsePdbBuffer(&input->buffer, context, result);
+    }
+    closePdbInput(input);
+    if(context->format == INPUT_CIF)
+    {
+        endCifInput(context);
+    }
+    return status;
+}
+
+/**
+ * Gets an opened input.
+ * Responsible for closing the file or releasing its buffer.
+ * @param input
+ */
+void closePdbInput(PdbInput *input)
+{
+    if(input->fd >= 0)
+    {
+        close(input->fd);
+        input->fd = -1;
+    }
+    closePdbBuffer(&input->buffer);
+}
+
+/**
+ * Gets an open file.
+ * Responsible for recognizing a gzip or zstd file by its magic number, only
+ * regular files are checked so nothing of a pipe is consumed.
+ * @param fd
+ * @return the compression of the file
+ */
+Compression detectCompression(int fd)
+{
+    struct stat status;
+    char magic[COMPRESSION_MAGIC_LEN];
+    ssize_t bytes;
+
+    if(fstat(fd, &status) != 0 || !S_ISREG(status.st_mode))
+    {
+        return COMPRESSION_NONE;
+    }
+    bytes = read(fd, magic, COMPRESSION_MAGIC_LEN);
+    if(lseek(fd, 0, SEEK_SET) != 0)
+    {
+        return COMPRESSION_NONE;
+    }
+    if(bytes >= GZIP_MAGIC_LEN && memcmp(magic, GZIP_MAGIC, GZIP_MAGIC_LEN) == 0)
+    {
+        return COMPRESSION_GZIP;
+    }
+    if(bytes >= ZSTD_MAGIC_LEN && memcmp(magic, ZSTD_MAGIC, ZSTD_MAGIC_LEN) == 0)
+    {
+        return COMPRESSION_ZSTD;
+    }
+    return COMPRESSION_NONE;
+}
+
+/**
+ * Gets the mapped compressed file, its compression, the parse context and the file result.
+ * Responsible for starting the decompression thread and parsing the text it
+ * writes to the pipe with the streaming window.
+ * @param buffer
+ * @param compression
+ * @param context
+ * @param result
+ * @return FILE_OK for success or the error status
+ */
+FileStatus parseCompressed(const PdbBuffer *buffer, Compression compression, ParseContext *context, FileResult *result)
+{
+    Decompressor decompressor;
+    pthread_t thread;
+    int ends[2];
+    FileStatus status;
+
+#ifndef HAVE_ZLIB
+    if(compression == COMPRESSION_GZIP)
+    {
+        return FILE_NO_DECOMPRESSOR;
+    }
+#endif
+#ifndef HAVE_ZSTD
+    if(compression == COMPRESSION_ZSTD)
+    {
+        return FILE_NO_DECOMPRESSOR;
+    }
+#endif
+    if(pipe(ends) != 0)
+    {
+        return FILE_NO_MEMORY;
+    }
+    decompressor.compression = compression;
+    decompressor.source = buffer;
+    decompressor.sink = ends[1];
+    decompressor.failed = 0;
+    if(pthread_create(&thread, NULL, decompressWorker, &decompressor) != 0)
+    {
+        close(ends[0]);
+        close(ends[1]);
+        return FILE_NO_MEMORY;
+    }
+    status = parsePdbStream(ends[0], context, result);
+    close(ends[0]); //a thread still writing after an error gets EPIPE and stops
+    pthread_join(thread, NULL);
+    //a truncated file ends with a cut line, the decompression error explains it better
+    return decompressor.failed ? FILE_BAD_COMPRESSION : status;
+}
+
+/**
+ * Gets a decompressor.
+ * Responsible for the decompression thread, the text is written to the sink
+ * which is closed at the end so the parser sees the end of the file.
+ * Only corrupt data fails the decompressor, a sink closed by the parser just stops it.
+ * SIGPIPE is blocked here so a parser that stopped early only ends the thread.
+ * @param decompressorPointer
+ * @return NULL
+ */
+void *decompressWorker(void *decompressorPointer)
+{
+    Decompressor *decompressor = decompressorPointer;
+    sigset_t pipeSignal;
+
+    sigemptyset(&pipeSignal);
+    sigaddset(&pipeSignal, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipeSignal, NULL);
+    switch(decompressor->compression)
+    {
+#ifdef HAVE_ZLIB
+        case COMPRESSION_GZIP:
+            decompressor->failed = inflateGzip(decompressor) != 0;
+            break;
+#endif
+#ifdef HAVE_ZSTD
+        case COMPRESSION_ZSTD:
+            decompressor->failed = inflateZstd(decompressor) != 0;
+            break;
+#endif
+        default:
+            decompressor->failed = 1;
+            break;
+    }
+    close(decompressor->sink);
+    return NULL;
+}
+
+/**
+ * Gets a file, data and its size.
+ * Responsible for writing all the data, a pipe may take it in parts.
+ * @param fd
+ * @param data
+ * @param size
+ * @return 0 for success, -1 if the write failed
+ */
+int writeAll(int fd, const char *data, size_t size)
+{
+    while(size > 0)
+    {
+        ssize_t bytes = write(fd, data, size);
+        if(bytes < 0 && errno != EINTR)
+        {
+            return -1;
+        }
+        bytes = bytes > 0 ? bytes : 0;
+        data += bytes;
+        size -= bytes;
+    }
+    return 0;
+}
+
+#ifdef HAVE_ZLIB
+/**
+ * Gets a decompressor of a gzip file.
+ * Responsible for inflating the file to the sink, concatenated gzip members
+ * are read one after the other and the bytes after the last member are
+ * ignored, as gzread does.
+ * @param decompressor
+ * @return 0 for success or a closed sink, -1 for a corrupt or truncated file
+ */
+int inflateGzip(Decompressor *decompressor)
+{
+    char block[DECOMPRESS_BLOCK];
+    const PdbBuffer *source = decompressor->source;
+    z_stream stream;
+    size_t offset = 0; //the compressed bytes handed to zlib
+    int stopped = 0, error;
+
+    memset(&stream, 0, sizeof(stream));
+    if(inflateInit2(&stream, GZIP_WINDOW_BITS) != Z_OK)
+    {
+        return -1;
+    }
+    do
+    {
+        if(stream.avail_in == 0)
+        {
+            size_t slice = source->size - offset < DECOMPRESS_BLOCK ? source->size - offset : DECOMPRESS_BLOCK;
+            stream.next_in = (Bytef *)source->data + offset;
+            stream.avail_in = (uInt)slice;
+            offset += slice;
+        }
+        stream.next_out = (Bytef *)block;
+        stream.avail_out = sizeof(block);
+        error = inflate(&stream, Z_NO_FLUSH);
+        stopped = writeAll(decompressor->sink, block, sizeof(block) - stream.avail_out) != 0;
+        if(error == Z_STREAM_END)
+        {
+            size_t next = offset - stream.avail_in;
+            if(source->size - next >= GZIP_MAGIC_LEN && memcmp(source->data + next, GZIP_MAGIC, GZIP_MAGIC_LEN) == 0)
+            {
+                error = inflateReset(&stream);
+            }
+        }
+    } while(!stopped && error == Z_OK);
+    inflateEnd(&stream);
+    return !stopped && error != Z_STREAM_END ? -1 : 0;
+}
+#endif
+
+#ifdef HAVE_ZSTD
+/**
+ * Gets a decompressor of a zstd file.
+ * Responsible for decompressing the file to the sink with the streaming API,
+ * a file that ends inside a frame is an error.
+ * @param decompressor
+ * @return 0 for success or a closed sink, -1 for a corrupt or truncated file
+ */
+int inflateZstd(Decompressor *decompressor)
+{
+    char output[DECOMPRESS_BLOCK];
+    const PdbBuffer *source = decompressor->source;
+    ZSTD_DStream *stream = ZSTD_createDStream();
+    size_t pending = 0; //0 when the last frame is complete
+    int stopped = 0, failed = stream == NULL || ZSTD_isError(ZSTD_initDStream(stream));
+
+    for(size_t offset = 0; !failed && !stopped && offset < source->size; offset += DECOMPRESS_BLOCK)
+    {
+        size_t slice = source->size - offset < DECOMPRESS_BLOCK ? source->size - offset : DECOMPRESS_BLOCK;
+        ZSTD_inBuffer in = {source->data + offset, slice, 0};
+        ZSTD_outBuffer out = {output, sizeof(output), 0};
+        do
+        {
+            out.pos = 0;
+            pending = ZSTD_decompressStream(stream, &out, &in);
+            failed = ZSTD_isError(pending);
+            stopped = !failed && writeAll(decompressor->sink, output, out.pos) != 0;
+        } while(!failed && !stopped && (in.pos < in.size || out.pos == out.size));
+    }
+    failed = failed || (!stopped && pending != 0);
+    ZSTD_freeDStream(stream);
+    return failed ? -1 : 0;
+}
+#endif
+
+/**
+ * Gets a buffer, the parse context and the file result.
+ * Responsible for scanning the buffer for the line starts and parsing the ATOM
+ * lines in place, the lines are never copied out of the buffer. A BinaryCIF
+ * buffer is decoded instead.
+ * Stops at the first ATOM line that is too short or can't be parsed.
+ * @param buffer
+ * @param context
+ * @param result
+ * @return FILE_OK for success or the error status
+ */
+FileStatus parsePdbBuffer(const PdbBuffer *buffer, ParseContext *context, FileResult *result)
+{
+    const char *line = buffer->data;
+    const char *end = buffer->data + buffer->size;
+
+    if(context->stats != NULL)
+    {
+        context->stats->bytes += buffer->size;
+    }
+    if(isBinaryCif(buffer->data, buffer->size))
+    {
+        return parseBinaryCif(buffer->data, buffer->size, context, result);
+    }
+    while(line < end)
+    {
+        const char *lineEnd = memchr(line, NEW_LINE, end - line);
+        size_t lineLength = lineEnd == NULL ? (size_t)(end - line) : (size_t)(lineEnd - line) + 1;
+        FileStatus status = parseRecord(line, lineLength, context, result);
+
+        if(status != FILE_OK)
+        {
+            return status;
+        }
+        line += lineLength;
+    }
+    return FILE_OK;
+}
+
+/**
+ * Gets an open file, the parse context and the file result.
+ * Responsible for reading the file through one fixed window and parsing every
+ * complete line in it, the unfinished line moves to the front of the window.
+ * The memory doesn't depend on the size of the file. A line longer than the
+ * window is parsed by its start and the rest of it is skipped. A BinaryCIF
+ * file can't be decoded by parts, it is read whole to the heap.
+ * @param fd
+ * @param context
+ * @param result
+ * @return FILE_OK for success or the error status
+ */
+FileStatus parsePdbStream(int fd, ParseContext *context, FileResult *result)
+{
+    char window[STREAM_BUFFER];
+    size_t kept = 0;
+    int skipping = 0; //the rest of a line that was already parsed by its start
+    int first = 1;
+    ssize_t bytes;
+
+    while((bytes = read(fd, window + kept, STREAM_BUFFER - kept)) > 0)
+    {
+        const char *line = window;
+        if(context->stats != NULL)
+        {
+            context->stats->bytes += bytes;
+        }
+        if(first && isBinaryCif(window, bytes))
+        {
+            return parseBinaryStream(fd, window, bytes, context, result);
+        }
+        first = 0;
+        const char *end = window + kept + bytes;
+        const char *lineEnd;
+
+        while((lineEnd = memchr(line, NEW_LINE, end - line)) != NULL)
+        {
+            size_t lineLength = (size_t)(lineEnd - line) + 1;
+            FileStatus status = skipping ? FILE_OK : parseRecord(line, lineLength, context, result);
+            if(status != FILE_OK)
+            {
+                return status;
+            }
+            skipping = 0;
+            line += lineLength;
+        }
+        kept = end - line;
+        if(kept == STREAM_BUFFER)
+        {
+            FileStatus status = skipping ? FILE_OK : parseRecord(line, kept, context, result);
+            if(status != FILE_OK)
+            {
+                return status;
+            }
+            skipping = 1;
+            kept = 0;
+        }
+        memmove(window, line, kept);
+    }
+    if(bytes < 0) //the read stopped on an error, nothing is trusted
+    {
+        return FILE_NO_ATOMS;
+    }
+    return kept > 0 && !skipping ? parseRecord(window, kept, context, result) : FILE_OK;
+}
+
+/**
+ * Gets a line with its length, the parse context and the file result.
+ * Responsible for parsing the ATOM lines, ending a frame on ENDMDL and starting
+ * one on MODEL, the other records are skipped. The lines of an mmCIF file,
+ * found by its first line, go to its tokenizer instead.
+ * @param line
+ * @param lineLength
+ * @param context
+ * @param result
+ * @return FILE_OK for success or the error status
+ */
+FileStatus parseRecord(const char *line, size_t lineLength, ParseContext *context, FileResult *result)
+{
+    if(context->stats != NULL)
+    {
+        context->stats->lines++;
+    }
+    if(context->format != INPUT_PDB)
+    {
+        if(context->format == INPUT_UNDETECTED)
+        {
+            context->format = detectFormat(line, lineLength);
+        }
+        if(context->format == INPUT_CIF)
+        {
+            return parseCifLine(line, lineLength, context, result);
+        }
+    }
+    if(lineLength < LINE_STARTER_LEN)
+    {
+        return FILE_OK;
+    }
+    if(strncmp(line, END_MODEL_STARTER, LINE_STARTER_LEN) == 0)
+    {
+        return finishFrame(context, result);
+    }
+    if(strncmp(line, MODEL_STARTER, LINE_STARTER_LEN) == 0)
+    {
+        char serial[MODEL_SERIAL_LEN + 1] = {0};
+        FileStatus status = finishFrame(context, result); //a model that had no ENDMDL
+        if(lineLength > MODEL_SERIAL_FIELD)
+        {
+            size_t serialLength = lineLength - MODEL_SERIAL_FIELD;
+            memcpy(serial, line + MODEL_SERIAL_FIELD, serialLength < MODEL_SERIAL_LEN ? serialLength : MODEL_SERIAL_LEN);
+        }
+        context->model = serial[0] != END_OF_STRING && atoi(serial) > 0 ? atoi(serial) : context->frameCount + 1;
+        return status;
+    }
+    if(!isAtomRecord(line, &context->options->selection))
+    {
+        return FILE_OK;
+    }
+    if(lineLength <= MIN_LINE_LEN)
+    {
+        result->lineLength = lineLength;
+        return FILE_SHORT_LINE;
+    }
+    if(context->options->selection.active && !selectAtom(line, &context->options->selection))
+    {
+        return FILE_OK;
+    }
+    return parseLine(line, lineLength, context, result);
+}
+
+
+/**
+ * Gets the path of a source file.
+ * Return the path of its cache, allocated, or NULL if the memory ran out.
+ * @param path
+ * @return the cache path
+ */
+char *cachePath(const char *path)
+{
+    size_t length = strlen(path);
+    char *cache = malloc(length + CACHE_TEMP_SUFFIX_LEN);
+
+    if(cache != NULL)
+    {
+        memcpy(cache, path, length);
+        strcpy(cache + length, CACHE_SUFFIX);
+    }
+    return cache;
+}
+
+/**
+ * Gets the path of a source file, its status and an empty buffer.
+ * Responsible for mapping the cache of the source and checking that it belongs
+ * to this version of the source and that every frame is inside the file.
+ * @param path
+ * @param source
+ * @param cache
+ * @return 0 if the cache is mapped and valid, -1 if it is missing or stale
+ */
+int openCache(const char *path, const struct stat *source, PdbBuffer *cache)
+{
+    char *name = cachePath(path);
+    const CacheHeader *header;
+    const CacheFrame *frames;
+    int valid;
+
+    if(name == NULL)
+    {
+        return -1;
+    }
+    valid = openPdbBuffer(name, cache) == 0;
+    free(name);
+    if(!valid)
+    {
+        return -1;
+    }
+    header = (const CacheHeader *)cache->data;
+    valid = cache->mapped && cache->size >= sizeof(CacheHeader) &&
+            memcmp(header->magic, CACHE_MAGIC, CACHE_MAGIC_LEN) == 0 &&
+            header->version == CACHE_VERSION && header->byteOrder == CACHE_BYTE_ORDER &&
+            header->sourceSize == (int64_t)source->st_size && header->sourceMtime == (int64_t)source->st_mtime &&
+            header->tableOffset >= CACHE_ALIGNMENT && header->tableOffset <= (int64_t)cache->size &&
+            header->frameCount <= (cache->size - header->tableOffset) / sizeof(CacheFrame);
+    frames = valid ? (const CacheFrame *)(cache->data + header->tableOffset) : NULL;
+    for(uint32_t i = 0; valid && i < header->frameCount; i++)
+    {
+        int64_t padded = (frames[i].atomCount + CACHE_LANE_PADDING - 1) / CACHE_LANE_PADDING * CACHE_LANE_PADDING;
+        valid = frames[i].atomCount > 0 && frames[i].offset % CACHE_ALIGNMENT == 0 && frames[i].offset > 0 &&
+                frames[i].offset <= header->tableOffset - padded * COORDINATES * (int64_t)sizeof(float);
+    }
+    if(!valid)
+    {
+        closePdbBuffer(cache);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Gets a mapped valid cache, the parse context and the file result.
+ * Responsible for handing every frame of the cache to finishFrame, the lanes
+ * are used in place from the mapping. The moments are accumulated over the
+ * atoms in their order in the source so the results equal a parse of the text.
+ * @param cache
+ * @param context
+ * @param result
+ * @return FILE_OK for success or the error status
+ */
+FileStatus analyzeCache(const PdbBuffer *cache, ParseContext *context, FileResult *result)
+{
+    const CacheHeader *header = (const CacheHeader *)cache->data;
+    const CacheFrame *frames = (const CacheFrame *)(cache->data + header->tableOffset);
+
+    if(context->stats != NULL)
+    {
+        context->stats->bytes += cache->size;
+    }
+    for(uint32_t i = 0; i < header->frameCount; i++)
+    {
+        int count = frames[i].atomCount;
+        int64_t padded = (count + CACHE_LANE_PADDING - 1) / CACHE_LANE_PADDING * CACHE_LANE_PADDING;
+        float *x = (float *)(cache->data + frames[i].offset);
+        AtomStore view = {{x, x + padded, x + 2 * padded}, count, count};
+        FileStatus status;
+
+        for(int k = 0; k < count; k++)
+        {
+            addMoments(&context->moments, view.lane[0][k], view.lane[1][k], view.lane[2][k]);
+        }
+        context->atoms = &view;
+        context->model = frames[i].model;
+        status = finishFrame(context, result);
+        context->atoms = NULL;
+        if(status != FILE_OK)
+        {
+            return status;
+        }
+    }
+    return FILE_OK;
+}
+
+/**
+ * Gets the path of a source file and the writer to fill.
+ * Responsible for creating the temporary file of the cache and writing the
+ * space of its header, the header itself is written by endCache.
+ * @param path
+ * @param writer
+ * @return 0 for success, -1 if the cache can't be written
+ */
+int beginCache(const char *path, CacheWriter *writer)
+{
+    char header[CACHE_ALIGNMENT] = {0};
+    int fd;
+
+    writer->file = NULL;
+    writer->frames = NULL;
+    writer->frameCount = 0;
+    writer->frameCapacity = 0;
+    writer->offset = CACHE_ALIGNMENT;
+    writer->failed = 0;
+    writer->tempPath = cachePath(path);
+    if(writer->tempPath == NULL)
+    {
+        return -1;
+    }
+    sprintf(writer->tempPath + strlen(writer->tempPath), ".%ld.%d.tmp", (long)getpid(),
+            __atomic_fetch_add(&cacheSerial, 1, __ATOMIC_RELAXED) % INT_MAX);
+    fd = open(writer->tempPath, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if(fd >= 0)
+    {
+        writer->file = fdopen(fd, "wb");
+        if(writer->file == NULL)
+        {
+            close(fd);
+        }
+    }
+    if(writer->file == NULL || fwrite(header, sizeof(header), 1, writer->file) != 1)
+    {
+        endCache(path, NULL, writer, 0);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Gets a cache writer, the serial of a model and its atoms.
+ * Responsible for appending the lanes of the frame to the cache, each lane is
+ * padded to CACHE_ALIGNMENT bytes. A failed write only drops the cache.
+ * @param writer
+ * @param model
+ * @param atoms
+ */
+void writeCacheFrame(CacheWriter *writer, int model, const AtomStore *atoms)
+{
+    static const float padding[CACHE_LANE_PADDING] = {0};
+    int padded = (atoms->count + CACHE_LANE_PADDING - 1) / CACHE_LANE_PADDING * CACHE_LANE_PADDING;
+
+    if(writer->failed)
+    {
+        return;
+    }
+    if(writer->frameCount == writer->frameCapacity)
+    {
+        int capacity = writer->frameCapacity == 0 ? INITIAL_FRAMES : writer->frameCapacity * 2;
+        CacheFrame *frames = realloc(writer->frames, sizeof(CacheFrame) * capacity);
+        if(frames == NULL)
+        {
+            writer->failed = 1;
+            return;
+        }
+        writer->frames = frames;
+        writer->frameCapacity = capacity;
+    }
+    writer->frames[writer->frameCount].model = model;
+    writer->frames[writer->frameCount].atomCount = atoms->count;
+    writer->frames[writer->frameCount].offset = writer->offset;
+    writer->frameCount++;
+    for(int k = 0; k < COORDINATES && !writer->failed; k++)
+    {
+        size_t rest = padded - atoms->count;
+        writer->failed = fwrite(atoms->lane[k], sizeof(float), atoms->count, writer->file) != (size_t)atoms->count ||
+                         fwrite(padding, sizeof(float), rest, writer->file) != rest;
+    }
+    writer->offset += (int64_t)padded * COORDINATES * sizeof(float);
+}
+
+/**
+ * Gets the path of a source file, its status from before the parse, a cache
+ * writer and whether to keep the cache.
+ * Responsible for writing the frames table and the header and renaming the
+ * cache to its place. The cache is dropped if it failed, if it isn't kept or
+ * if the source changed while it was parsed.
+ * @param path
+ * @param source
+ * @param writer
+ * @param keep
+ */
+void endCache(const char *path, const struct stat *source, CacheWriter *writer, int keep)
+{
+    struct stat after;
+    CacheHeader header;
+
+    keep = keep && !writer->failed && stat(path, &after) == 0 &&
+           after.st_size == source->st_size && after.st_mtime == source->st_mtime;
+    if(keep)
+    {
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, CACHE_MAGIC, CACHE_MAGIC_LEN);
+        header.version = CACHE_VERSION;
+        header.byteOrder = CACHE_BYTE_ORDER;
+        header.sourceSize = source->st_size;
+        header.sourceMtime = source->st_mtime;
+        header.tableOffset = writer->offset;
+        header.frameCount = writer->frameCount;
+        keep = fwrite(writer->frames, sizeof(CacheFrame), writer->frameCount, writer->file) ==
+               (size_t)writer->frameCount && fseek(writer->file, 0, SEEK_SET) == 0 &&
+               fwrite(&header, sizeof(header), 1, writer->file) == 1;
+    }
+    if(writer->file != NULL && fclose(writer->file) != 0)
+    {
+        keep = 0;
+    }
+    if(writer->file != NULL)
+    {
+        char *name = keep ? cachePath(path) : NULL;
+        if(name == NULL || rename(writer->tempPath, name) != 0)
+        {
+            remove(writer->tempPath);
+        }
+        free(name);
+    }
+    free(writer->tempPath);
+    free(writer->frames);
+}
+
+
+/**
+ * Gets bytes with their size and a seed.
+ * Return the xxHash64 of the bytes, read in the byte order of the host as the caches.
+ * @param data
+ * @param size
+ * @param seed
+ * @return the hash
+ */
+uint64_t hashBytes(const void *data, size_t size, uint64_t seed)
+{
+    const unsigned char *bytes = data, *end = bytes + size;
+    uint64_t hash, lane;
+
+    if(size >= HASH_STRIPE)
+    {
+        uint64_t accumulators[HASH_LANES] = {seed + HASH_PRIME_1 + HASH_PRIME_2, seed + HASH_PRIME_2, seed,
+                                             seed - HASH_PRIME_1};
+        for(; end - bytes >= HASH_STRIPE; bytes += HASH_STRIPE)
+        {
+            for(int k = 0; k < HASH_LANES; k++)
+            {
+                memcpy(&lane, bytes + k * sizeof(lane), sizeof(lane));
+                accumulators[k] = hashRound(accumulators[k], lane);
+            }
+        }
+        hash = ROTATE_LEFT(accumulators[0], 1) + ROTATE_LEFT(accumulators[1], 7) +
+               ROTATE_LEFT(accumulators[2], 12) + ROTATE_LEFT(accumulators[3], 18);
+        for(int k = 0; k < HASH_LANES; k++)
+        {
+            hash = (hash ^ hashRound(0, accumulators[k])) * HASH_PRIME_1 + HASH_PRIME_4;
+        }
+    }
+    else
+    {
+        hash = seed + HASH_PRIME_5;
+    }
+    hash += size;
+    for(; end - bytes >= (long)sizeof(lane); bytes += sizeof(lane))
+    {
+        memcpy(&lane, bytes, sizeof(lane));
+        hash ^= hashRound(0, lane);
+        hash = ROTATE_LEFT(hash, 27) * HASH_PRIME_1 + HASH_PRIME_4;
+    }
+    if(end - bytes >= (long)sizeof(uint32_t))
+    {
+        uint32_t word;
+        memcpy(&word, bytes, sizeof(word));
+        hash ^= word * HASH_PRIME_1;
+        hash = ROTATE_LEFT(hash, 23) * HASH_PRIME_2 + HASH_PRIME_3;
+        bytes += sizeof(word);
+    }
+    for(; bytes < end; bytes++)
+    {
+        hash ^= *bytes * HASH_PRIME_5;
+        hash = ROTATE_LEFT(hash, 11) * HASH_PRIME_1;
+    }
+    hash ^= hash >> 33;
+    hash *= HASH_PRIME_2;
+    hash ^= hash >> 29;
+    hash *= HASH_PRIME_3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+/**
+ * Gets an accumulator of the hash and eight bytes of the input.
+ * Return the accumulator with the bytes mixed in.
+ * @param accumulator
+ * @param lane
+ * @return the accumulator
+ */
+uint64_t hashRound(uint64_t accumulator, uint64_t lane)
+{
+    accumulator += lane * HASH_PRIME_2;
+    accumulator = ROTATE_LEFT(accumulator, 31);
+    return accumulator * HASH_PRIME_1;
+}
+
+/**
+ * Gets the options.
+ * Return the hash of every option the results depend on, the threads, the kernels
+ * and the readers give the same results and aren't part of it.
+ * @param options
+ * @return the key of the options
+ */
+uint64_t hashOptions(const Options *options)
+{
+    char text[ERROR_MESSAGE_LEN];
+    int length = snprintf(text, sizeof(text), "%d %.9g %d %d %d %.9g %d %d %d", options->engine, options->tolerance,
+                          options->parser, options->twoPass, options->maxDistance, options->contactCutoff,
+                          options->shape, options->mass, options->deterministic);
+
+    return hashBytes(&options->selection, sizeof(options->selection), hashBytes(text, length, RESULT_CACHE_VERSION));
+}
+
+/**
+ * Gets the directory of the result cache, the two hashes of the name and its suffix.
+ * Return the path of the file, allocated with room for a temporary suffix, or NULL if the memory ran out.
+ * A second hash of 0 is left out of the name.
+ * @param directory
+ * @param first
+ * @param second
+ * @param suffix
+ * @return the path
+ */
+char *resultCachePath(const char *directory, uint64_t first, uint64_t second, const char *suffix)
+{
+    size_t length = strlen(directory);
+    char *name = malloc(length + RESULT_NAME_LEN);
+
+    if(name != NULL && second != 0)
+    {
+        sprintf(name, "%s/%016llx-%016llx%s", directory, (unsigned long long)first, (unsigned long long)second,
+                suffix);
+    }
+    else if(name != NULL)
+    {
+        sprintf(name, "%s/%016llx%s", directory, (unsigned long long)first, suffix);
+    }
+    return name;
+}
+
+/**
+ * Gets the path of a regular file, its status, the options and the hash to fill.
+ * Responsible for taking the content hash of the file from the index of the
+ * path, with trustMtime and when the size and the mtime are the ones it was
+ * hashed at, so the file isn't read at all.
+ * @param path
+ * @param source
+ * @param options
+ * @param hash
+ * @return 0 for success, -1 if the content must be hashed
+ */
+int readContentHash(const char *path, const struct stat *source, const Options *options, uint64_t *hash)
+{
+    size_t pathLength = strlen(path);
+    char *indexName;
+    PdbBuffer buffer;
+    int valid = 0;
+
+    if(!options->trustMtime)
+    {
+        return -1;
+    }
+    indexName = resultCachePath(options->resultCache, hashBytes(path, pathLength, 0), 0, RESULT_INDEX_SUFFIX);
+    if(indexName != NULL && openPdbBuffer(indexName, &buffer) == 0)
+    {
+        const ResultIndexHeader *index = (const ResultIndexHeader *)buffer.data;
+        valid = buffer.size == sizeof(ResultIndexHeader) + pathLength &&
+                memcmp(index->magic, RESULT_INDEX_MAGIC, CACHE_MAGIC_LEN) == 0 &&
+                index->version == RESULT_CACHE_VERSION && index->pathLength == pathLength &&
+                index->sourceSize == (int64_t)source->st_size &&
+                index->sourceMtime == (int64_t)source->st_mtime &&
+                memcmp(index + 1, path, pathLength) == 0;
+        *hash = valid ? index->contentHash : 0;
+        closePdbBuffer(&buffer);
+    }
+    free(indexName);
+    return valid ? 0 : -1;
+}
+
+/**
+ * Gets the path of a regular file, its status when it was opened, the
+ * options and the hash of its content.
+ * Responsible for writing the index of the path with trustMtime, so the next
+ * run of the same size and mtime takes the hash from it.
+ * @param path
+ * @param source
+ * @param options
+ * @param hash
+ */
+void writeContentHash(const char *path, const struct stat *source, const Options *options, uint64_t hash)
+{
+    size_t pathLength = strlen(path);
+    ResultIndexHeader index;
+    char *indexName;
+
+    if(!options->trustMtime)
+    {
+        return;
+    }
+    indexName = resultCachePath(options->resultCache, hashBytes(path, pathLength, 0), 0, RESULT_INDEX_SUFFIX);
+    if(indexName == NULL)
+    {
+        return;
+    }
+    memset(&index, 0, sizeof(index));
+    memcpy(index.magic, RESULT_INDEX_MAGIC, CACHE_MAGIC_LEN);
+    index.version = RESULT_CACHE_VERSION;
+    index.pathLength = (uint32_t)pathLength;
+    index.sourceSize = source->st_size;
+    index.sourceMtime = source->st_mtime;
+    index.contentHash = hash;
+    replaceFile(indexName, &index, sizeof(index), path, pathLength);
+    free(indexName);
+}
+
+/**
+ * Gets the content hash of a file, the parse context and the file result.
+ * Responsible for handing the frames of the entry of the content and the
+ * options to the sink of the context, as if the file was analyzed.
+ * @param contentHash
+ * @param context
+ * @param result
+ * @return 0 if the entry was found and valid, -1 if the file must be analyzed
+ */
+int loadResults(uint64_t contentHash, ParseContext *context, FileResult *result)
+{
+    const Options *options = context->options;
+    char *name = resultCachePath(options->resultCache, contentHash, options->resultKey, RESULT_ENTRY_SUFFIX);
+    const ResultEntryHeader *header;
+    PdbBuffer entry;
+    int valid;
+
+    if(name == NULL)
+    {
+        return -1;
+    }
+    valid = openPdbBuffer(name, &entry) == 0;
+    free(name);
+    if(!valid)
+    {
+        return -1;
+    }
+    header = (const ResultEntryHeader *)entry.data;
+    valid = entry.size >= sizeof(ResultEntryHeader) &&
+            memcmp(header->magic, RESULT_CACHE_MAGIC, CACHE_MAGIC_LEN) == 0 &&
+            header->version == RESULT_CACHE_VERSION && header->frameSize == sizeof(FrameResult) &&
+            header->contentHash == contentHash && header->optionsKey == options->resultKey &&
+            header->frameCount > 0 &&
+            header->frameCount == (entry.size - sizeof(ResultEntryHeader)) / sizeof(FrameResult);
+    for(uint32_t i = 0; valid && i < header->frameCount; i++)
+    {
+        FrameResult frame;
+        memcpy(&frame, entry.data + sizeof(ResultEntryHeader) + i * sizeof(FrameResult), sizeof(frame));
+        frame.neighborCounts = NULL;
+        if(context->stats != NULL)
+        {
+            context->stats->atoms += frame.atomCount;
+            context->stats->frames++;
+        }
+        context->frameCount++;
+        if(context->emitFrame(context->path, result, &frame) != 0)
+        {
+            result->status = FILE_NO_MEMORY;
+            break;
+        }
+    }
+    closePdbBuffer(&entry);
+    return valid ? 0 : -1;
+}
+
+/**
+ * Gets a result writer and a frame that ended.
+ * Responsible for keeping a copy of the frame, a frame that can't be kept only drops the entry.
+ * @param writer
+ * @param frame
+ */
+void recordResultFrame(ResultWriter *writer, const FrameResult *frame)
+{
+    if(writer->failed)
+    {
+        return;
+    }
+    if(writer->frameCount == writer->frameCapacity)
+    {
+        int capacity = writer->frameCapacity == 0 ? INITIAL_FRAMES : writer->frameCapacity * 2;
+        FrameResult *frames = realloc(writer->frames, sizeof(FrameResult) * capacity);
+        if(frames == NULL)
+        {
+            writer->failed = 1;
+            return;
+        }
+        writer->frames = frames;
+        writer->frameCapacity = capacity;
+    }
+    writer->frames[writer->frameCount] = *frame;
+    writer->frames[writer->frameCount++].neighborCounts = NULL;
+}
+
+/**
+ * Gets the path of a file, its status from before the analysis, its content
+ * hash, the options and the writer of its frames.
+ * Responsible for writing the entry of the frames, unless the writer failed
+ * or the file changed while it was analyzed, and freeing the writer.
+ * @param path
+ * @param source
+ * @param contentHash
+ * @param options
+ * @param writer
+ */
+void storeResults(const char *path, const struct stat *source, uint64_t contentHash, const Options *options,
+                  ResultWriter *writer)
+{
+    struct stat after;
+    ResultEntryHeader header;
+    char *name;
+
+    if(!writer->failed && stat(path, &after) == 0 && after.st_size == source->st_size &&
+       after.st_mtime == source->st_mtime &&
+       (name = resultCachePath(options->resultCache, contentHash, options->resultKey, RESULT_ENTRY_SUFFIX)) != NULL)
+    {
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, RESULT_CACHE_MAGIC, CACHE_MAGIC_LEN);
+        header.version = RESULT_CACHE_VERSION;
+        header.frameSize = sizeof(FrameResult);
+        header.contentHash = contentHash;
+        header.optionsKey = options->resultKey;
+        header.frameCount = writer->frameCount;
+        replaceFile(name, &header, sizeof(header), writer->frames, sizeof(FrameResult) * writer->frameCount);
+        free(name);
+    }
+    free(writer->frames);
+    writer->frames = NULL;
+}
+
+/**
+ * Gets the name of a file with room for a temporary suffix, a header and the
+ * data after it.
+ * Responsible for writing the file under a temporary name and renaming it to
+ * its place, so a reader sees the old file or the whole new one.
+ * @param name
+ * @param header
+ * @param headerSize
+ * @param data
+ * @param dataSize
+ * @return 0 for success, -1 if the file couldn't be written
+ */
+int replaceFile(const char *name, const void *header, size_t headerSize, const void *data, size_t dataSize)
+{
+    size_t length = strlen(name);
+    char *tempPath = malloc(length + CACHE_TEMP_SUFFIX_LEN);
+    FILE *file = NULL;
+    int fd, written = 0;
+
+    if(tempPath == NULL)
+    {
+        return -1;
+    }
+    sprintf(tempPath, "%s.%ld.%d.tmp", name, (long)getpid(), __atomic_fetch_add(&cacheSerial, 1, __ATOMIC_RELAXED) % INT_MAX);
+    fd = open(tempPath, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if(fd >= 0)
+    {
+        file = fdopen(fd, "wb");
+        if(file == NULL)
+        {
+            close(fd);
+        }
+    }
+    if(file != NULL)
+    {
+        written = fwrite(header, headerSize, 1, file) == 1 && (dataSize == 0 || fwrite(data, dataSize, 1, file) == 1);
+        written = fclose(file) == 0 && written;
+        written = written && rename(tempPath, name) == 0;
+        if(!written)
+        {
+            remove(tempPath);
+        }
+    }
+    free(tempPath);
+    return written ? 0 : -1;
+}
+
+/**
+ * Gets a pointer to the input and the float to fill
+ * Responsible for converting the input value to a float.
+ * @param input
+ * @param result
+ * @return 0 for success, -1 if the input isn't a number
+ */
+int getFloat(char* input, float *result)
+{
+    char *end;
+    errno = 0;
+    *result = strtof(input, &end);
+    if(*result == 0 && (errno != 0 || end == input))
+    {
+        return -1;
+    }
+    return 0;
+}
+
+
+/**
+ * Gets the atoms store ,empty array of gravity
+ * center with 3 coordinates.
+ * Responsible for calculation of the gravity center, and fills the results in
+ * the initialize gravity center array.
+ * @param atoms
+ * @param gravityCenter
+ */
+void calCenterOfGravity(const AtomStore *atoms, float gravityCenter[3])
+{
+    const float *x = atoms->lane[0], *y = atoms->lane[1], *z = atoms->lane[2];
+    float xCorSum, yCorSum, zCorSum;
+    xCorSum = yCorSum = zCorSum = 0.0;
+    for (int i = 0; i < atoms->count; i++)
+    {
+        xCorSum += x[i];
+        yCorSum += y[i];
+        zCorSum += z[i];
+
+    }
+    gravityCenter[0] = (xCorSum / atoms->count);
+    gravityCenter[1] = (yCorSum / atoms->count);
+    gravityCenter[2] = (zCorSum / atoms->count);
+
+}
+
+
+/**
+ * Gets 6 coordinates.
+ * Responsible for calculation of the distance between them.
+ * Return float distance result.
+ * @param xCor1
+ * @param yCor1
+ * @param zCor1
+ * @param xCor2
+ * @param yCor2
+ * @param zCor2
+ * @return result
+ */
+float calDistance(float xCor1, float yCor1, float zCor1, float xCor2, float yCor2, float zCor2)
+{
+    return ((xCor1-xCor2)*(xCor1-xCor2) + ((yCor1-yCor2) * (yCor1-yCor2))
+                  + ((zCor1-zCor2) * (zCor1-zCor2)));
+}
+
+/**
+ * Gets the atoms store, an array
+ * represents the gravity center.
+ * Responsible for calculation of the distance og each atom in the array
+ * comparing to the gravity center coordinadtes.
+ * Return the rotation radious that was found by formula.
+ * @param atoms
+ * @param gravityCenter
+ * @return the rotation radious
+ */
+float calRotationRadious(const AtomStore *atoms, float gravityCenter[3])
+{
+    float rotationSum = rotationSumKernel(atoms->lane[0], atoms->lane[1], atoms->lane[2], atoms->count,
+                                          gravityCenter[0], gravityCenter[1], gravityCenter[2]);
+
+    rotationSum = sqrt(rotationSum / atoms->count);
+    return rotationSum;
+
+}
+
+/**
+ * Gets the atoms store, the center of gravity and the radius of gyration to fill.
+ * Responsible for Cg and Rg by pairwise sums in double: the ranges are halved
+ * down to PAIRWISE_BLOCK atoms that are added in order, so the order of the
+ * additions depends only on the number of atoms, not on the kernels or the threads.
+ * @param atoms
+ * @param gravityCenter
+ * @param rotationRadius
+ */
+void calPairwiseMoments(const AtomStore *atoms, float gravityCenter[3], float *rotationRadius)
+{
+    double center[COORDINATES];
+
+    for(int k = 0; k < COORDINATES; k++)
+    {
+        center[k] = pairwiseSum(atoms->lane[k], 0, atoms->count) / atoms->count;
+        gravityCenter[k] = (float)center[k];
+    }
+    *rotationRadius = (float)sqrt(pairwiseSquares(atoms, center, 0, atoms->count) / atoms->count);
+}
+
+/**
+ * Gets a lane and a range of it.
+ * Return the sum of the range, by halves down to PAIRWISE_BLOCK values.
+ * @param lane
+ * @param start
+ * @param end
+ * @return the sum
+ */
+double pairwiseSum(const float *lane, int start, int end)
+{
+    double sum = 0;
+
+    if(end - start > PAIRWISE_BLOCK)
+    {
+        int middle = start + (end - start) / 2;
+        return pairwiseSum(lane, start, middle) + pairwiseSum(lane, middle, end);
+    }
+    for(int i = start; i < end; i++)
+    {
+        sum += lane[i];
+    }
+    return sum;
+}
+
+/**
+ * Gets the atoms store, a center and a range of the atoms.
+ * Return the sum of the squared distances of the range from the center,
+ * by halves down to PAIRWISE_BLOCK atoms.
+ * @param atoms
+ * @param center
+ * @param start
+ * @param end
+ * @return the sum
+ */
+double pairwiseSquares(const AtomStore *atoms, const double center[3], int start, int end)
+{
+    double sum = 0;
+
+    if(end - start > PAIRWISE_BLOCK)
+    {
+        int middle = start + (end - start) / 2;
+        return pairwiseSquares(atoms, center, start, middle) + pairwiseSquares(atoms, center, middle, end);
+    }
+    for(int i = start; i < end; i++)
+    {
+        double dx = atoms->lane[0][i] - center[0], dy = atoms->lane[1][i] - center[1];
+        double dz = atoms->lane[2][i] - center[2];
+        sum += dx * dx + dy * dy + dz * dz;
+    }
+    return sum;
+}
+
+/**
+ * Gets the atoms store, the options, the workspace and the upper bound to fill.
+ * Responsible for calculation of the max distance between two atoms
+ * by 3 coordinates, with the engine and the threads of the options.
+ * The exact engines return the same value, the brute force one is kept for
+ * cross checking, and their upper bound is the distance itself.
+ * Return the max distance.
+ * @param atoms
+ * @param options
+ * @param workspace
+ * @param upperBound
+ * @return the max distance
+ */
+float calMaxDistance(const AtomStore *atoms, const Options *options, Workspace *workspace, float *upperBound)
+{
+    float maxSquaredDistance;
+    workspace->pairedAtoms = atoms->count;
+    if(options->engine == DMAX_ENGINE_APPROXIMATE)
+    {
+        return calMaxDistanceApproximate(atoms, options, workspace, upperBound);
+    }
+    if(options->engine == DMAX_ENGINE_BRUTE_FORCE)
+    {
+        maxSquaredDistance = calMaxSquaredDistanceBruteForce(atoms, options->threads);
+    }
+    else if(options->engine == DMAX_ENGINE_PRUNED)
+    {
+        maxSquaredDistance = calMaxSquaredDistancePruned(atoms, options->threads, workspace);
+    }
+    else
+    {
+        maxSquaredDistance = calMaxSquaredDistanceHull(atoms, options->threads, workspace);
+    }
+    *upperBound = sqrt(maxSquaredDistance);
+    return *upperBound;
+}
+
+/**
+ * Gets the atoms store, the options, the workspace and the upper bound to fill.
+ * Responsible for bounding the max distance by the exact one of only the atoms
+ * that can still be in a pair longer than the tolerance of the options allows.
+ * The extremes of the bounding box and the atom farthest from its center, at
+ * R, are paired for a lower bound L of a real pair. An atom at r from the
+ * center is in no pair longer than r + R, so the atoms with
+ * r < (1 + tolerance) L - R are dropped, all their pairs are within the
+ * tolerance of L. The exact hull of the k kept atoms is the lower bound and
+ * the upper one is the larger of it and (1 + tolerance) L, they are the same
+ * when no atom was dropped or the kept ones beat (1 + tolerance) L.
+ * The work is 3 passes over the n atoms plus the hull of the kept ones,
+ * O(n + k log k), k is the shell of the atoms near R and thins as the
+ * tolerance grows, all the atoms in the worst case of a hollow sphere.
+ * The kept atoms are copied to the candidates of the workspace, falls back to
+ * the exact hull of all the atoms if the memory ran out.
+ * Return the lower bound.
+ * @param atoms
+ * @param options
+ * @param workspace
+ * @param upperBound
+ * @return the lower bound of the max distance
+ */
+float calMaxDistanceApproximate(const AtomStore *atoms, const Options *options, Workspace *workspace,
+                                float *upperBound)
+{
+    AtomStore *candidates = &workspace->candidateAtoms;
+    const float *x = atoms->lane[0], *y = atoms->lane[1], *z = atoms->lane[2];
+    int seeds[2 * COORDINATES + 1] = {0};
+    double center[COORDINATES], radius = 0, lower = 0, upper, cut;
+
+    if(atoms->count < 2)
+    {
+        *upperBound = 0;
+        return 0;
+    }
+    for(int i = 0; i < atoms->count; i++)
+    {
+        for(int k = 0; k < COORDINATES; k++)
+        {
+            const float *lane = atoms->lane[k];
+            seeds[2 * k] = lane[i] < lane[seeds[2 * k]] ? i : seeds[2 * k];
+            seeds[2 * k + 1] = lane[i] > lane[seeds[2 * k + 1]] ? i : seeds[2 * k + 1];
+        }
+    }
+    for(int k = 0; k < COORDINATES; k++)
+    {
+        center[k] = ((double)atoms->lane[k][seeds[2 * k]] + atoms->lane[k][seeds[2 * k + 1]]) / 2;
+    }
+    for(int i = 0; i < atoms->count; i++)
+    {
+        double dx = x[i] - center[0], dy = y[i] - center[1], dz = z[i] - center[2];
+        double squaredRadius = dx * dx + dy * dy + dz * dz;
+        if(squaredRadius > radius)
+        {
+            radius = squaredRadius;
+            seeds[2 * COORDINATES] = i;
+        }
+    }
+    radius = sqrt(radius);
+    for(int a = 0; a < 2 * COORDINATES + 1; a++)
+    {
+        for(int b = a + 1; b < 2 * COORDINATES + 1; b++)
+        {
+            lower = fmax(lower, calDistance(x[seeds[a]], y[seeds[a]], z[seeds[a]],
+                                            x[seeds[b]], y[seeds[b]], z[seeds[b]]));
+        }
+    }
+    lower = sqrt(lower);
+
+    //the radii are widened by PRUNE_MARGIN so the float rounding never drops an atom of a longer pair
+    cut = (1 + options->tolerance) * lower - radius;
+    candidates->count = 0;
+    for(int i = 0; i < atoms->count; i++)
+    {
+        double dx = x[i] - center[0], dy = y[i] - center[1], dz = z[i] - center[2];
+        if(sqrt(dx * dx + dy * dy + dz * dz) * (1 + PRUNE_MARGIN) >= cut && addAtom(candidates, x[i], y[i], z[i]) != 0)
+        {
+            *upperBound = sqrt(calMaxSquaredDistanceHull(atoms, options->threads, workspace));
+            return *upperBound;
+        }
+    }
+    if(candidates->count == atoms->count)
+    {
+        //nothing was dropped, the hull of the candidates is the exact one
+        *upperBound = sqrt(calMaxSquaredDistanceHull(atoms, options->threads, workspace));
+        return *upperBound;
+    }
+    if(candidates->count >= 2)
+    {
+        lower = fmax(lower, sqrt(calMaxSquaredDistanceHull(candidates, options->threads, workspace)));
+    }
+    else
+    {
+        workspace->pairedAtoms = 2 * COORDINATES + 1;
+    }
+    //the pairs of the dropped atoms are at most cut + radius, (1 + tolerance) L
+    upper = cut + radius;
+    if(upper <= lower)
+    {
+        *upperBound = (float)lower;
+        return *upperBound;
+    }
+    *upperBound = (float)upper;
+    if(*upperBound < upper)
+    {
+        *upperBound = nextafterf(*upperBound, INFINITY);
+    }
+    return (float)lower;
+}
+
+/**
+ * Gets the atoms store and the number of threads.
+ * Responsible for passing over all the pairs of atoms, large stores are split
+ * between the threads.
+ * Return the max squared distance, the root is taken once by the caller.
+ * @param atoms
+ * @param threads
+ * @return the max squared distance
+ */
+float calMaxSquaredDistanceBruteForce(const AtomStore *atoms, int threads)
+{
+#ifdef HAVE_OFFLOAD
+    if(atoms->count >= offloadMinAtoms)
+    {
+        return calMaxSquaredDistanceDevice(atoms);
+    }
+#endif
+    if(threads > 1 && atoms->count >= PARALLEL_DMAX_MIN_ATOMS)
+    {
+        return calFarthestPairTiled(atoms, threads).squaredDistance;
+    }
+
+    return calMaxSquaredDistanceRows(atoms, rowMaxKernel);
+}
+
+/**
+ * Gets the atoms store and a distance kernel.
+ * Responsible for the max squared distance of all the pairs, one row after
+ * the other with the kernel.
+ * Return the max squared distance.
+ * @param atoms
+ * @param kernel
+ * @return the max squared distance
+ */
+float calMaxSquaredDistanceRows(const AtomStore *atoms, RowMaxKernel kernel)
+{
+    const float *x = atoms->lane[0], *y = atoms->lane[1], *z = atoms->lane[2];
+    float maxDistance = 0.0;
+    float tempDistance;
+    int farthest;
+
+    //Passing all over the atoms in the array
+    for(int i = 0; i < atoms->count -1; i++)
+    {
+        tempDistance = kernel(x, y, z, x[i], y[i], z[i], i + 1, atoms->count, &farthest);
+        if(maxDistance < tempDistance)
+        {//checks if the distance is bigger
+            maxDistance = tempDistance;
+        }
+
+    }
+    return maxDistance;
+}
+
+/**
+ * Gets the atoms store and the number of threads.
+ * Responsible for finding the max distance by passing only over the pairs of
+ * the convex hull vertices, the two farthest atoms are always hull vertices.
+ * The vertices are copied to their own store so the pairs stream over lanes.
+ * The hull and the vertices use the buffers of the workspace.
+ * Falls back to all the atoms if the hull can't be built (flat or tiny input).
+ * Return the max squared distance.
+ * @param atoms
+ * @param threads
+ * @param workspace
+ * @return the max squared distance
+ */
+float calMaxSquaredDistanceHull(const AtomStore *atoms, int threads, Workspace *workspace)
+{
+    AtomStore *hullAtoms = &workspace->hullAtoms;
+    int vertexCount;
+
+    if(reserveWorkspace(workspace, atoms->count) != 0)
+    {
+        return calMaxSquaredDistanceBruteForce(atoms, threads);
+    }
+    vertexCount = findHullVertices(atoms, &workspace->hull, workspace->hullVertices);
+    if(vertexCount < 0)
+    {
+        return calMaxSquaredDistanceBruteForce(atoms, threads);
+    }
+
+    hullAtoms->count = 0;
+    for(int i = 0; i < vertexCount; i++)
+    {
+        int atom = workspace->hullVertices[i];
+        if(addAtom(hullAtoms, atoms->lane[0][atom], atoms->lane[1][atom], atoms->lane[2][atom]) != 0)
+        {
+            return calMaxSquaredDistanceBruteForce(atoms, threads);
+        }
+    }
+    workspace->pairedAtoms = hullAtoms->count;
+    return calMaxSquaredDistanceBruteForce(hullAtoms, threads);
+}
+
+/**
+ * Gets the atoms store, the number of threads and the workspace.
+ * Responsible for finding the max distance by passing over the pairs that can
+ * still beat the best one: by the triangle inequality a pair is at most as far
+ * as the sum of the distances of its atoms from the center of gravity.
+ * The atoms are copied from the farthest from the center, the best distance is
+ * started from the extremes of the bounding box, and every row ends at the
+ * first atom whose bound is below the best, the rows end when the next atom is.
+ * The bounds are widened by PRUNE_MARGIN so the farthest pair is never cut
+ * and the result is the one of the brute force engine.
+ * The copies use the buffers of the workspace, falls back to the brute force
+ * if the memory ran out.
+ * Return the max squared distance.
+ * @param atoms
+ * @param threads
+ * @param workspace
+ * @return the max squared distance
+ */
+float calMaxSquaredDistancePruned(const AtomStore *atoms, int threads, Workspace *workspace)
+{
+    AtomStore *rankedAtoms = &workspace->rankedAtoms;
+    RankedAtom *ranked = workspace->ranked;
+    const float *x = atoms->lane[0], *y = atoms->lane[1], *z = atoms->lane[2];
+    float gravityCenter[COORDINATES];
+    int extremes[2 * COORDINATES] = {0};
+    float maxDistance = 0;
+    double bound = 0;
+    int rows = 0;
+
+    if(atoms->count < 2)
+    {
+        return 0;
+    }
+    if(atoms->count > workspace->rankedCapacity)
+    {
+        ranked = realloc(workspace->ranked, sizeof(RankedAtom) * atoms->count);
+        if(ranked == NULL)
+        {
+            return calMaxSquaredDistanceBruteForce(atoms, threads);
+        }
+        workspace->ranked = ranked;
+        workspace->rankedCapacity = atoms->count;
+    }
+
+    calCenterOfGravity(atoms, gravityCenter);
+    for(int i = 0; i < atoms->count; i++)
+    {
+        float dx = x[i] - gravityCenter[0], dy = y[i] - gravityCenter[1], dz = z[i] - gravityCenter[2];
+        ranked[i].radius = sqrtf(dx * dx + dy * dy + dz * dz);
+        ranked[i].atom = i;
+        for(int k = 0; k < COORDINATES; k++)
+        {
+            const float *lane = atoms->lane[k];
+            extremes[2 * k] = lane[i] < lane[extremes[2 * k]] ? i : extremes[2 * k];
+            extremes[2 * k + 1] = lane[i] > lane[extremes[2 * k + 1]] ? i : extremes[2 * k + 1];
+        }
+    }
+    qsort(ranked, atoms->count, sizeof(RankedAtom), compareRankedAtoms);
+    rankedAtoms->count = 0;
+    for(int i = 0; i < atoms->count; i++)
+    {
+        int atom = ranked[i].atom;
+        if(addAtom(rankedAtoms, x[atom], y[atom], z[atom]) != 0)
+        {
+            return calMaxSquaredDistanceBruteForce(atoms, threads);
+        }
+    }
+
+    //the pairs of the extremes only bound the pruning, the rows find the same pairs again
+    for(int a = 0; a < 2 * COORDINATES; a++)
+    {
+        for(int b = a + 1; b < 2 * COORDINATES; b++)
+        {
+            float squaredDistance = calDistance(x[extremes[a]], y[extremes[a]], z[extremes[a]],
+                                                x[extremes[b]], y[extremes[b]], z[extremes[b]]);
+            bound = squaredDistance > bound ? squaredDistance : bound;
+        }
+    }
+    bound = sqrt(bound);
+
+    x = rankedAtoms->lane[0];
+    y = rankedAtoms->lane[1];
+    z = rankedAtoms->lane[2];
+    for(int i = 0; i < atoms->count - 1; i++)
+    {
+        int low = i + 1, high = atoms->count, farthest;
+        float tempDistance;
+        if((ranked[i].radius + ranked[i + 1].radius) * (1 + PRUNE_MARGIN) < bound)
+        {
+            break;
+        }
+        //the row ends at the first atom whose bound is below the best, the radii only decrease
+        while(low < high)
+        {
+            int middle = low + (high - low) / 2;
+            if((ranked[i].radius + ranked[middle].radius) * (1 + PRUNE_MARGIN) < bound)
+            {
+                high = middle;
+            }
+            else
+            {
+                low = middle + 1;
+            }
+        }
+        tempDistance = rowMaxKernel(x, y, z, x[i], y[i], z[i], i + 1, low, &farthest);
+        if(maxDistance < tempDistance)
+        {
+            maxDistance = tempDistance;
+            bound = sqrt(maxDistance) > bound ? sqrt(maxDistance) : bound;
+        }
+        rows++;
+    }
+    workspace->pairedAtoms = rows + 1;
+    return maxDistance;
+}
+
+/**
+ * Gets two ranked atoms.
+ * Responsible for ordering the atoms from the farthest from the center,
+ * and by their order in the frame at the same distance.
+ * @param first
+ * @param second
+ * @return negative, 0 or positive as for qsort
+ */
+int compareRankedAtoms(const void *first, const void *second)
+{
+    const RankedAtom *a = first, *b = second;
+
+    if(a->radius != b->radius)
+    {
+        return a->radius > b->radius ? -1 : 1;
+    }
+    return (a->atom > b->atom) - (a->atom < b->atom);
+}
+
+/**
+ * Gets the atoms store and the number of threads.
+ * Responsible for splitting the pairs i < j to tiles that the threads take one
+ * by one, every thread keeps its own farthest pair and they are reduced at the end.
+ * Return the farthest pair, of the lowest indices when there are ties.
+ * @param atoms
+ * @param threads
+ * @return the farthest pair
+ */
+FarthestPair calFarthestPairTiled(const AtomStore *atoms, int threads)
+{
+    PairTiles tiles;
+    PairWorker *workers = malloc(sizeof(PairWorker) * threads);
+    pthread_t *handles = malloc(sizeof(pthread_t) * threads);
+    FarthestPair best = {0, 0, 0};
+    int started = 0;
+
+    tiles.atoms = atoms;
+    tiles.blockCount = (atoms->count + DMAX_TILE - 1) / DMAX_TILE;
+    tiles.tileCount = (long)tiles.blockCount * (tiles.blockCount + 1) / 2;
+    tiles.nextTile = 0;
+    if(workers == NULL || handles == NULL)
+    {
+        PairWorker single;
+        free(workers);
+        free(handles);
+        single.tiles = &tiles;
+        pairWorker(&single);
+        return single.best;
+    }
+
+    //this thread is the first worker
+    for(int t = 0; t < threads; t++)
+    {
+        workers[t].tiles = &tiles;
+    }
+    while(started + 1 < threads && pthread_create(&handles[started + 1], NULL, pairWorker,
+                                                  &workers[started + 1]) == 0)
+    {
+        started++;
+    }
+    pairWorker(&workers[0]);
+    best = workers[0].best;
+    for(int t = 1; t <= started; t++)
+    {
+        pthread_join(handles[t], NULL);
+        updateFarthestPair(&best, workers[t].best.squaredDistance, workers[t].best.first, workers[t].best.second);
+    }
+    free(workers);
+    free(handles);
+    return best;
+}
+
+/**
+ * Gets the number of a tile of the triangle and the number of tiles along a side.
+ * Responsible for finding the row and the column of the tile, row r holds
+ * the tiles (r, r) ... (r, blockCount - 1).
+ * @param tile
+ * @param blockCount
+ * @param row
+ * @param column
+ */
+void locateTile(long tile, int blockCount, int *row, int *column)
+{
+    int low = 0, high = blockCount - 1;
+
+    while(low < high)
+    {
+        int middle = (low + high + 1) / 2;
+        long rowStart = (long)middle * blockCount - (long)middle * (middle - 1) / 2;
+        if(rowStart <= tile)
+        {
+            low = middle;
+        }
+        else
+        {
+            high = middle - 1;
+        }
+    }
+    *row = low;
+    *column = low + (int)(tile - ((long)low * blockCount - (long)low * (low - 1) / 2));
+}
+
+/**
+ * Gets a worker of the tiled max distance.
+ * Responsible for taking tiles until there are none left and keeping the
+ * farthest pair of the tiles in the worker.
+ * @param workerPointer
+ * @return NULL
+ */
+void *pairWorker(void *workerPointer)
+{
+    PairWorker *worker = workerPointer;
+    PairTiles *tiles = worker->tiles;
+    const float *x = tiles->atoms->lane[0], *y = tiles->atoms->lane[1], *z = tiles->atoms->lane[2];
+    int count = tiles->atoms->count;
+    long tile;
+
+    worker->best.squaredDistance = 0;
+    worker->best.first = worker->best.second = 0;
+    while((tile = __atomic_fetch_add(&tiles->nextTile, 1, __ATOMIC_RELAXED)) < tiles->tileCount)
+    {
+        int rowBlock, columnBlock;
+        locateTile(tile, tiles->blockCount, &rowBlock, &columnBlock);
+        int rowEnd = (rowBlock + 1) * DMAX_TILE < count ? (rowBlock + 1) * DMAX_TILE : count;
+        int columnEnd = (columnBlock + 1) * DMAX_TILE < count ? (columnBlock + 1) * DMAX_TILE : count;
+
+        for(int i = rowBlock * DMAX_TILE; i < rowEnd; i++)
+        {
+            int farthest;
+            int columnStart = columnBlock == rowBlock ? i + 1 : columnBlock * DMAX_TILE;
+            float tempDistance = rowMaxKernel(x, y, z, x[i], y[i], z[i], columnStart, columnEnd, &farthest);
+            if(tempDistance > worker->best.squaredDistance)
+            {
+                worker->best.squaredDistance = tempDistance;
+                worker->best.first = i;
+                worker->best.second = farthest;
+            }
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Gets the farthest pair so far and a candidate pair.
+ * Responsible for keeping the farther pair, ties keep the lower indices so
+ * the result doesn't depend on the order of the threads.
+ * @param best
+ * @param squaredDistance
+ * @param first
+ * @param second
+ */
+void updateFarthestPair(FarthestPair *best, float squaredDistance, int first, int second)
+{
+    if(squaredDistance > best->squaredDistance
+       || (squaredDistance == best->squaredDistance
+           && (first < best->first || (first == best->first && second < best->second))))
+    {
+        best->squaredDistance = squaredDistance;
+        best->first = first;
+        best->second = second;
+    }
+}
+
+/**
+ * Gets the name of the kernels, "auto" picks the widest the CPU supports.
+ * Responsible for setting the distance kernels used by all the threads.
+ * @param name
+ * @return 0 for success, -1 if the kernels are unknown or not supported
+ */
+int selectKernels(const char *name)
+{
+    int automatic = strcmp(name, SIMD_AUTO) == 0;
+
+    rowMaxKernel = rowMaxScalar;
+    rotationSumKernel = rotationSumScalar;
+#ifdef X86_KERNELS
+    __builtin_cpu_init();
+    if((automatic || strcmp(name, SIMD_AVX512) == 0) && __builtin_cpu_supports("avx512f"))
+    {
+        rowMaxKernel = rowMaxAvx512;
+        rotationSumKernel = rotationSumAvx512;
+        return 0;
+    }
+    if((automatic || strcmp(name, SIMD_AVX2) == 0) && __builtin_cpu_supports("avx2"))
+    {
+        rowMaxKernel = rowMaxAvx2;
+        rotationSumKernel = rotationSumAvx2;
+        return 0;
+    }
+#endif
+#ifdef NEON_KERNELS
+    if(automatic || strcmp(name, SIMD_NEON) == 0) //NEON is part of every aarch64 CPU
+    {
+        rowMaxKernel = rowMaxNeon;
+        rotationSumKernel = rotationSumNeon;
+        return 0;
+    }
+#endif
+    return automatic || strcmp(name, SIMD_SCALAR) == 0 ? 0 : -1;
+}
+
+/**
+ * Gets the kernels to fill.
+ * Responsible for listing the scalar kernels first and then every vector
+ * kernel the CPU supports.
+ * @param rowMax
+ * @param rotationSum
+ * @return the number of kernels
+ */
+int listKernels(RowMaxKernel rowMax[KERNEL_SETS], RotationSumKernel rotationSum[KERNEL_SETS])
+{
+    int count = 0;
+
+    rowMax[count] = rowMaxScalar;
+    rotationSum[count++] = rotationSumScalar;
+#ifdef X86_KERNELS
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2"))
+    {
+        rowMax[count] = rowMaxAvx2;
+        rotationSum[count++] = rotationSumAvx2;
+    }
+    if(__builtin_cpu_supports("avx512f"))
+    {
+        rowMax[count] = rowMaxAvx512;
+        rotationSum[count++] = rotationSumAvx512;
+    }
+#endif
+#ifdef NEON_KERNELS
+    rowMax[count] = rowMaxNeon;
+    rotationSum[count++] = rotationSumNeon;
+#endif
+    return count;
+}
+
+/**
+ * Gets the lanes of the atoms, an atom and a range of atoms.
+ * Responsible for the max squared distance from the atom, one pair at a time.
+ * Return the max squared distance and the first atom at it.
+ * @param x
+ * @param y
+ * @param z
+ * @param px
+ * @param py
+ * @param pz
+ * @param start
+ * @param end
+ * @param farthest
+ * @return the max squared distance
+ */
+float rowMaxScalar(const float *x, const float *y, const float *z, float px, float py, float pz,
+                   int start, int end, int *farthest)
+{
+    float maxDistance = 0;
+
+    *farthest = -1;
+    for(int j = start; j < end; j++)
+    {
+        float tempDistance = calDistance(px, py, pz, x[j], y[j], z[j]);
+        if(maxDistance < tempDistance)
+        {
+            maxDistance = tempDistance;
+            *farthest = j;
+        }
+    }
+    return maxDistance;
+}
+
+/**
+ * Gets the lanes of the atoms, their number and a center.
+ * Responsible for summing the squared distances from the center, one atom at a time.
+ * @param x
+ * @param y
+ * @param z
+ * @param count
+ * @param cx
+ * @param cy
+ * @param cz
+ * @return the sum
+ */
+float rotationSumScalar(const float *x, const float *y, const float *z, int count, float cx, float cy, float cz)
+{
+    float rotationSum = 0;
+
+    for(int i = 0; i < count; i++)
+    {
+        rotationSum += calDistance(cx, cy, cz, x[i], y[i], z[i]);
+    }
+    return rotationSum;
+}
+
+/**
+ * Gets the max of every vector lane, the index of each, the number of lanes and the result index.
+ * Responsible for the max of the lanes, ties go to the lowest index so the
+ * vector kernels find the same atom as the scalar one.
+ * @param best
+ * @param bestIndex
+ * @param width
+ * @param farthest
+ * @return the max of the lanes
+ */
+float reduceRowMax(const float *best, const int *bestIndex, int width, int *farthest)
+{
+    float maxDistance = 0;
+
+    *farthest = -1;
+    for(int lane = 0; lane < width; lane++)
+    {
+        if(bestIndex[lane] >= 0 && (best[lane] > maxDistance
+                                    || (best[lane] == maxDistance && bestIndex[lane] < *farthest)))
+        {
+            maxDistance = best[lane];
+            *farthest = bestIndex[lane];
+        }
+    }
+    return maxDistance;
+}
+
+#ifdef X86_KERNELS
+/*
+ * The vector kernels square and add in the order of calDistance without fused
+ * multiply-add, so every pair gives the same float as the scalar kernel.
+ */
+
+/**
+ * AVX2 version of rowMaxScalar, 8 atoms at a time.
+ */
+__attribute__((target("avx2")))
+float rowMaxAvx2(const float *x, const float *y, const float *z, float px, float py, float pz,
+                 int start, int end, int *farthest)
+{
+    float best[AVX2_WIDTH];
+    int bestIndex[AVX2_WIDTH];
+    __m256 vx = _mm256_set1_ps(px), vy = _mm256_set1_ps(py), vz = _mm256_set1_ps(pz);
+    __m256 vBest = _mm256_setzero_ps();
+    __m256i vBestIndex = _mm256_set1_epi32(-1);
+    __m256i vIndex = _mm256_setr_epi32(start, start + 1, start + 2, start + 3,
+                                       start + 4, start + 5, start + 6, start + 7);
+    __m256i vStep = _mm256_set1_epi32(AVX2_WIDTH);
+    float maxDistance;
+    int j = start;
+
+    for(; j + AVX2_WIDTH <= end; j += AVX2_WIDTH)
+    {
+        __m256 dx = _mm256_sub_ps(vx, _mm256_loadu_ps(x + j));
+        __m256 dy = _mm256_sub_ps(vy, _mm256_loadu_ps(y + j));
+        __m256 dz = _mm256_sub_ps(vz, _mm256_loadu_ps(z + j));
+        __m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)),
+                                        _mm256_mul_ps(dz, dz));
+        __m256 farther = _mm256_cmp_ps(distance, vBest, _CMP_GT_OQ);
+        vBest = _mm256_blendv_ps(vBest, distance, farther);
+        vBestIndex = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(vBestIndex),
+                                                          _mm256_castsi256_ps(vIndex), farther));
+        vIndex = _mm256_add_epi32(vIndex, vStep);
+    }
+    _mm256_storeu_ps(best, vBest);
+    _mm256_storeu_si256((__m256i *)bestIndex, vBestIndex);
+    maxDistance = reduceRowMax(best, bestIndex, AVX2_WIDTH, farthest);
+    for(; j < end; j++)
+    {
+        float tempDistance = calDistance(px, py, pz, x[j], y[j], z[j]);
+        if(maxDistance < tempDistance)
+        {
+            maxDistance = tempDistance;
+            *farthest = j;
+        }
+    }
+    return maxDistance;
+}
+
+/**
+ * AVX2 version of rotationSumScalar, 8 partial sums that are added at the end.
+ */
+__attribute__((target("avx2")))
+float rotationSumAvx2(const float *x, const float *y, const float *z, int count, float cx, float cy, float cz)
+{
+    float sums[AVX2_WIDTH];
+    __m256 vx = _mm256_set1_ps(cx), vy = _mm256_set1_ps(cy), vz = _mm256_set1_ps(cz);
+    __m256 vSum = _mm256_setzero_ps();
+    float rotationSum = 0;
+    int i = 0;
+
+    for(; i + AVX2_WIDTH <= count; i += AVX2_WIDTH)
+    {
+        __m256 dx = _mm256_sub_ps(vx, _mm256_load_ps(x + i));
+        __m256 dy = _mm256_sub_ps(vy, _mm256_load_ps(y + i));
+        __m256 dz = _mm256_sub_ps(vz, _mm256_load_ps(z + i));
+        vSum = _mm256_add_ps(vSum, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)),
+                                                 _mm256_mul_ps(dz, dz)));
+    }
+    _mm256_storeu_ps(sums, vSum);
+    for(int lane = 0; lane < AVX2_WIDTH; lane++)
+    {
+        rotationSum += sums[lane];
+    }
+    for(; i < count; i++)
+    {
+        rotationSum += calDistance(cx, cy, cz, x[i], y[i], z[i]);
+    }
+    return rotationSum;
+}
+
+/**
+ * AVX-512 version of rowMaxScalar, 16 atoms at a time.
+ * AVX-512 brings fused multiply-add along, so contraction is turned off here.
+ */
+__attribute__((target("avx512f"), optimize("fp-contract=off")))
+float rowMaxAvx512(const float *x, const float *y, const float *z, float px, float py, float pz,
+                   int start, int end, int *farthest)
+{
+    float best[AVX512_WIDTH];
+    int bestIndex[AVX512_WIDTH];
+    __m512 vx = _mm512_set1_ps(px), vy = _mm512_set1_ps(py), vz = _mm512_set1_ps(pz);
+    __m512 vBest = _mm512_setzero_ps();
+    __m512i vBestIndex = _mm512_set1_epi32(-1);
+    __m512i vIndex = _mm512_add_epi32(_mm512_set1_epi32(start),
+                                      _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+    __m512i vStep = _mm512_set1_epi32(AVX512_WIDTH);
+    float maxDistance;
+    int j = start;
+
+    for(; j + AVX512_WIDTH <= end; j += AVX512_WIDTH)
+    {
+        __m512 dx = _mm512_sub_ps(vx, _mm512_loadu_ps(x + j));
+        __m512 dy = _mm512_sub_ps(vy, _mm512_loadu_ps(y + j));
+        __m512 dz = _mm512_sub_ps(vz, _mm512_loadu_ps(z + j));
+        __m512 distance = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(dx, dx), _mm512_mul_ps(dy, dy)),
+                                        _mm512_mul_ps(dz, dz));
+        __mmask16 farther = _mm512_cmp_ps_mask(distance, vBest, _CMP_GT_OQ);
+        vBest = _mm512_mask_blend_ps(farther, vBest, distance);
+        vBestIndex = _mm512_mask_blend_epi32(farther, vBestIndex, vIndex);
+        vIndex = _mm512_add_epi32(vIndex, vStep);
+    }
+    _mm512_storeu_ps(best, vBest);
+    _mm512_storeu_si512(bestIndex, vBestIndex);
+    maxDistance = reduceRowMax(best, bestIndex, AVX512_WIDTH, farthest);
+    for(; j < end; j++)
+    {
+        float tempDistance = calDistance(px, py, pz, x[j], y[j], z[j]);
+        if(maxDistance < tempDistance)
+        {
+            maxDistance = tempDistance;
+            *farthest = j;
+        }
+    }
+    return maxDistance;
+}
+
+/**
+ * AVX-512 version of rotationSumScalar, 16 partial sums that are added at the end.
+ */
+__attribute__((target("avx512f"), optimize("fp-contract=off")))
+float rotationSumAvx512(const float *x, const float *y, const float *z, int count, float cx, float cy, float cz)
+{
+    float sums[AVX512_WIDTH];
+    __m512 vx = _mm512_set1_ps(cx), vy = _mm512_set1_ps(cy), vz = _mm512_set1_ps(cz);
+    __m512 vSum = _mm512_setzero_ps();
+    float rotationSum = 0;
+    int i = 0;
+
+    for(; i + AVX512_WIDTH <= count; i += AVX512_WIDTH)
+    {
+        __m512 dx = _mm512_sub_ps(vx, _mm512_load_ps(x + i));
+        __m512 dy = _mm512_sub_ps(vy, _mm512_load_ps(y + i));
+        __m512 dz = _mm512_sub_ps(vz, _mm512_load_ps(z + i));
+        vSum = _mm512_add_ps(vSum, _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(dx, dx), _mm512_mul_ps(dy, dy)),
+                                                 _mm512_mul_ps(dz, dz)));
+    }
+    _mm512_storeu_ps(sums, vSum);
+    for(int lane = 0; lane < AVX512_WIDTH; lane++)
+    {
+        rotationSum += sums[lane];
+    }
+    for(; i < count; i++)
+    {
+        rotationSum += calDistance(cx, cy, cz, x[i], y[i], z[i]);
+    }
+    return rotationSum;
+}
+#endif
+
+#ifdef NEON_KERNELS
+/**
+ * NEON version of rowMaxScalar, 4 atoms at a time.
+ */
+float rowMaxNeon(const float *x, const float *y, const float *z, float px, float py, float pz,
+                 int start, int end, int *farthest)
+{
+    float best[NEON_WIDTH];
+    int bestIndex[NEON_WIDTH];
+    const int first[NEON_WIDTH] = {0, 1, 2, 3};
+    float32x4_t vx = vdupq_n_f32(px), vy = vdupq_n_f32(py), vz = vdupq_n_f32(pz);
+    float32x4_t vBest = vdupq_n_f32(0);
+    int32x4_t vBestIndex = vdupq_n_s32(-1);
+    int32x4_t vIndex = vaddq_s32(vdupq_n_s32(start), vld1q_s32(first));
+    int32x4_t vStep = vdupq_n_s32(NEON_WIDTH);
+    float maxDistance;
+    int j = start;
+
+    for(; j + NEON_WIDTH <= end; j += NEON_WIDTH)
+    {
+        float32x4_t dx = vsubq_f32(vx, vld1q_f32(x + j));
+        float32x4_t dy = vsubq_f32(vy, vld1q_f32(y + j));
+        float32x4_t dz = vsubq_f32(vz, vld1q_f32(z + j));
+        float32x4_t distance = vaddq_f32(vaddq_f32(vmulq_f32(dx, dx), vmulq_f32(dy, dy)), vmulq_f32(dz, dz));
+        uint32x4_t farther = vcgtq_f32(distance, vBest);
+        vBest = vbslq_f32(farther, distance, vBest);
+        vBestIndex = vbslq_s32(farther, vIndex, vBestIndex);
+        vIndex = vaddq_s32(vIndex, vStep);
+    }
+    vst1q_f32(best, vBest);
+    vst1q_s32(bestIndex, vBestIndex);
+    maxDistance = reduceRowMax(best, bestIndex, NEON_WIDTH, farthest);
+    for(; j < end; j++)
+    {
+        float tempDistance = calDistance(px, py, pz, x[j], y[j], z[j]);
+        if(maxDistance < tempDistance)
+        {
+            maxDistance = tempDistance;
+            *farthest = j;
+        }
+    }
+    return maxDistance;
+}
+
+/**
+ * NEON version of rotationSumScalar, 4 partial sums that are added at the end.
+ */
+float rotationSumNeon(const float *x, const float *y, const float *z, int count, float cx, float cy, float cz)
+{
+    float32x4_t vx = vdupq_n_f32(cx), vy = vdupq_n_f32(cy), vz = vdupq_n_f32(cz);
+    float32x4_t vSum = vdupq_n_f32(0);
+    float rotationSum;
+    int i = 0;
+
+    for(; i + NEON_WIDTH <= count; i += NEON_WIDTH)
+    {
+        float32x4_t dx = vsubq_f32(vx, vld1q_f32(x + i));
+        float32x4_t dy = vsubq_f32(vy, vld1q_f32(y + i));
+        float32x4_t dz = vsubq_f32(vz, vld1q_f32(z + i));
+        vSum = vaddq_f32(vSum, vaddq_f32(vaddq_f32(vmulq_f32(dx, dx), vmulq_f32(dy, dy)), vmulq_f32(dz, dz)));
+    }
+    rotationSum = vaddvq_f32(vSum);
+    for(; i < count; i++)
+    {
+        rotationSum += calDistance(cx, cy, cz, x[i], y[i], z[i]);
+    }
+    return rotationSum;
+}
+#endif
+
+/**
+ * Gets a face, the atoms store and an atom index.
+ * Return the signed distance of the atom from the plane of the face,
+ * positive values are outside the hull.
+ * @param face
+ * @param atoms
+ * @param atom
+ * @return the signed distance
+ */
+double faceDistance(const HullFace *face, const AtomStore *atoms, int atom)
+{
+    return face->normal[0] * atoms->lane[0][atom] + face->normal[1] * atoms->lane[1][atom]
+           + face->normal[2] * atoms->lane[2][atom] - face->offset;
+}
+
+/**
+ * Gets the hull state, the atoms store and three vertices.
+ * Responsible for appending a new face and calculating its plane.
+ * Return the index of the face or NO_FACE if the memory ran out.
+ * @param hull
+ * @param atoms
+ * @param a
+ * @param b
+ * @param c
+ * @return the face index
+ */
+int addHullFace(Hull *hull, const AtomStore *atoms, int a, int b, int c)
+{
+    HullFace *face;
+    double ab[3], ac[3], length;
+
+    if(hull->faceCount == hull->faceCapacity)
+    {
+        HullFace *faces = realloc(hull->faces, sizeof(HullFace) * hull->faceCapacity * 2);
+        if(faces == NULL)
+        {
+            return NO_FACE;
+        }
+        hull->faces = faces;
+        hull->faceCapacity *= 2;
+    }
+    face = &hull->faces[hull->faceCount];
+    face->vertex[0] = a;
+    face->vertex[1] = b;
+    face->vertex[2] = c;
+    face->neighbor[0] = face->neighbor[1] = face->neighbor[2] = NO_FACE;
+    face->outsideHead = -1;
+    face->alive = 1;
+    face->mark = 0;
+
+    for(int k = 0; k < COORDINATES; k++)
+    {
+        ab[k] = (double)atoms->lane[k][b] - atoms->lane[k][a];
+        ac[k] = (double)atoms->lane[k][c] - atoms->lane[k][a];
+    }
+    face->normal[0] = ab[1] * ac[2] - ab[2] * ac[1];
+    face->normal[1] = ab[2] * ac[0] - ab[0] * ac[2];
+    face->normal[2] = ab[0] * ac[1] - ab[1] * ac[0];
+    length = sqrt(face->normal[0] * face->normal[0] + face->normal[1] * face->normal[1]
+                  + face->normal[2] * face->normal[2]);
+    if(length > 0)
+    {
+        face->normal[0] /= length;
+        face->normal[1] /= length;
+        face->normal[2] /= length;
+    }
+    face->offset = face->normal[0] * atoms->lane[0][a] + face->normal[1] * atoms->lane[1][a]
+                   + face->normal[2] * atoms->lane[2][a];
+    return hull->faceCount++;
+}
+
+/**
+ * Gets the hull state, the atoms store, and the first face to try.
+ * Responsible for moving the atom to the conflict list of the first face
+ * it is outside of, atoms that are inside all of the faces are dropped.
+ * @param hull
+ * @param atoms
+ * @param atom
+ * @param firstFace
+ */
+void assignOutside(Hull *hull, const AtomStore *atoms, int atom, int firstFace)
+{
+    for(int f = firstFace; f < hull->faceCount; f++)
+    {
+        HullFace *face = &hull->faces[f];
+        if(face->alive && faceDistance(face, atoms, atom) > hull->epsilon)
+        {
+            hull->nextOutside[atom] = face->outsideHead;
+            face->outsideHead = atom;
+            return;
+        }
+    }
+}
+
+/**
+ * Gets the atoms store and the hull state.
+ * Responsible for building the first tetrahedron from the extreme atoms.
+ * Return 0 for success, -1 if all the atoms lie on a plane.
+ * @param atoms
+ * @param hull
+ * @return 0 for success
+ */
+int buildTetrahedron(const AtomStore *atoms, Hull *hull)
+{
+    int extremes[2 * COORDINATES] = {0};
+    int simplex[TETRAHEDRON_FACES] = {0};
+    double best, maxCoordinate = 0;
+
+    for(int i = 0; i < atoms->count; i++)
+    {
+        for(int k = 0; k < COORDINATES; k++)
+        {
+            if(atoms->lane[k][i] < atoms->lane[k][extremes[2 * k]])
+            {
+                extremes[2 * k] = i;
+            }
+            if(atoms->lane[k][i] > atoms->lane[k][extremes[2 * k + 1]])
+            {
+                extremes[2 * k + 1] = i;
+            }
+            if(fabs(atoms->lane[k][i]) > maxCoordinate)
+            {
+                maxCoordinate = fabs(atoms->lane[k][i]);
+            }
+        }
+    }
+    hull->epsilon = HULL_EPSILON_SCALE * DBL_EPSILON * (maxCoordinate > 1 ? maxCoordinate : 1);
+
+    //the two farthest extremes
+    best = -1;
+    for(int a = 0; a < 2 * COORDINATES; a++)
+    {
+        for(int b = a + 1; b < 2 * COORDINATES; b++)
+        {
+            int p0 = extremes[a], p1 = extremes[b];
+            double distance = calDistance(atoms->lane[0][p0], atoms->lane[1][p0], atoms->lane[2][p0],
+                                          atoms->lane[0][p1], atoms->lane[1][p1], atoms->lane[2][p1]);
+            if(distance > best)
+            {
+                best = distance;
+                simplex[0] = extremes[a];
+                simplex[1] = extremes[b];
+            }
+        }
+    }
+    if(sqrt(best) <= hull->epsilon)
+    {
+        return -1;
+    }
+
+    //the farthest atom from the line between them
+    best = 0;
+    for(int i = 0; i < atoms->count; i++)
+    {
+        double u[3], v[3], cross[3];
+        for(int k = 0; k < COORDINATES; k++)
+        {
+            u[k] = (double)atoms->lane[k][simplex[1]] - atoms->lane[k][simplex[0]];
+            v[k] = (double)atoms->lane[k][i] - atoms->lane[k][simplex[0]];
+        }
+        cross[0] = u[1] * v[2] - u[2] * v[1];
+        cross[1] = u[2] * v[0] - u[0] * v[2];
+        cross[2] = u[0] * v[1] - u[1] * v[0];
+        double distance = cross[0] * cross[0] + cross[1] * cross[1] + cross[2] * cross[2];
+        if(distance > best)
+        {
+            best = distance;
+            simplex[2] = i;
+        }
+    }
+    if(best == 0)
+    {
+        return -1;
+    }
+
+    //the farthest atom from the plane of the three
+    if(addHullFace(hull, atoms, simplex[0], simplex[1], simplex[2]) == NO_FACE)
+    {
+        return -1;
+    }
+    best = 0;
+    for(int i = 0; i < atoms->count; i++)
+    {
+        double distance = fabs(faceDistance(&hull->faces[0], atoms, i));
+        if(distance > best)
+        {
+            best = distance;
+            simplex[3] = i;
+        }
+    }
+    if(best <= hull->epsilon)
+    {
+        return -1;
+    }
+    hull->faceCount = 0;
+
+    for(int f = 0; f < TETRAHEDRON_FACES; f++)
+    {
+        int a = simplex[f], b = simplex[(f + 1) % TETRAHEDRON_FACES];
+        int c = simplex[(f + 2) % TETRAHEDRON_FACES], opposite = simplex[(f + 3) % TETRAHEDRON_FACES];
+        if(addHullFace(hull, atoms, a, b, c) == NO_FACE)
+        {
+            return -1;
+        }
+        if(faceDistance(&hull->faces[f], atoms, opposite) > 0)
+        {
+            hull->faceCount--;
+            addHullFace(hull, atoms, a, c, b);
+        }
+    }
+
+    //every edge of the tetrahedron is shared by the face that walks it the other way
+    for(int f = 0; f < TETRAHEDRON_FACES; f++)
+    {
+        for(int k = 0; k < COORDINATES; k++)
+        {
+            int from = hull->faces[f].vertex[k], to = hull->faces[f].vertex[(k + 1) % 3];
+            for(int g = 0; g < TETRAHEDRON_FACES; g++)
+            {
+                for(int m = 0; m < COORDINATES; m++)
+                {
+                    if(g != f && hull->faces[g].vertex[m] == to && hull->faces[g].vertex[(m + 1) % 3] == from)
+                    {
+                        hull->faces[f].neighbor[k] = g;
+                    }
+                }
+            }
+        }
+    }
+
+    for(int i = 0; i < atoms->count; i++)
+    {
+        if(i != simplex[0] && i != simplex[1] && i != simplex[2] && i != simplex[3])
+        {
+            assignOutside(hull, atoms, i, 0);
+        }
+    }
+    return 0;
+}
+
+/**
+ * Gets the hull state, the atoms store, a face and the farthest atom outside of it.
+ * Responsible for removing all the faces the atom can see and closing the hole
+ * with a cone of new faces from the horizon to the atom.
+ * Return 0 for success, -1 if the hull became inconsistent.
+ * @param hull
+ * @param atoms
+ * @param start
+ * @param eye
+ * @param iteration
+ * @return 0 for success
+ */
+int addHullPoint(Hull *hull, const AtomStore *atoms, int start, int eye, int iteration)
+{
+    int visibleMark = 2 * iteration, hiddenMark = 2 * iteration + 1;
+    int stackSize = 0, horizonSize = 0, firstNewFace = hull->faceCount, orphans = -1;
+
+    hull->faces[start].mark = visibleMark;
+    hull->stack[stackSize++] = start;
+    while(stackSize > 0)
+    {
+        int f = hull->stack[--stackSize];
+        for(int k = 0; k < COORDINATES; k++)
+        {
+            int n = hull->faces[f].neighbor[k];
+            if(hull->faces[n].mark != visibleMark && hull->faces[n].mark != hiddenMark)
+            {
+                hull->faces[n].mark = faceDistance(&hull->faces[n], atoms, eye) > hull->epsilon ?
+                                      visibleMark : hiddenMark;
+                if(hull->faces[n].mark == visibleMark)
+                {
+                    hull->stack[stackSize++] = n;
+                }
+            }
+            if(hull->faces[n].mark == hiddenMark)
+            {
+                if(horizonSize == hull->horizonCapacity)
+                {
+                    HorizonEdge *horizon = realloc(hull->horizon, sizeof(HorizonEdge) * hull->horizonCapacity * 2);
+                    if(horizon == NULL)
+                    {
+                        return -1;
+                    }
+                    hull->horizon = horizon;
+                    hull->horizonCapacity *= 2;
+                }
+                hull->horizon[horizonSize].from = hull->faces[f].vertex[k];
+                hull->horizon[horizonSize].to = hull->faces[f].vertex[(k + 1) % 3];
+                hull->horizon[horizonSize].outerFace = n;
+                horizonSize++;
+            }
+        }
+        //the conflict atoms of the removed face are collected to be reassigned
+        for(int atom = hull->faces[f].outsideHead; atom != -1;)
+        {
+            int next = hull->nextOutside[atom];
+            hull->nextOutside[atom] = orphans;
+            orphans = atom;
+            atom = next;
+        }
+        hull->faces[f].outsideHead = -1;
+        hull->faces[f].alive = 0;
+    }
+
+    for(int e = 0; e < horizonSize; e++)
+    {
+        int f = addHullFace(hull, atoms, hull->horizon[e].from, hull->horizon[e].to, eye);
+        if(f == NO_FACE || hull->startOf[hull->horizon[e].from] != NO_FACE)
+        {
+            return -1;
+        }
+        hull->startOf[hull->horizon[e].from] = f;
+        HullFace *outer = &hull->faces[hull->horizon[e].outerFace];
+        hull->faces[f].neighbor[0] = hull->horizon[e].outerFace;
+        for(int k = 0; k < COORDINATES; k++)
+        {
+            if(outer->vertex[k] == hull->horizon[e].to)
+            {
+                outer->neighbor[k] = f;
+            }
+        }
+    }
+    for(int f = firstNewFace; f < hull->faceCount; f++)
+    {
+        int next = hull->startOf[hull->faces[f].vertex[1]];
+        if(next == NO_FACE)
+        {
+            return -1;
+        }
+        hull->faces[f].neighbor[1] = next;
+        hull->faces[next].neighbor[2] = f;
+    }
+    for(int f = firstNewFace; f < hull->faceCount; f++)
+    {
+        hull->startOf[hull->faces[f].vertex[0]] = NO_FACE;
+    }
+
+    while(orphans != -1)
+    {
+        int next = hull->nextOutside[orphans];
+        if(orphans != eye)
+        {
+            assignOutside(hull, atoms, orphans, firstNewFace);
+        }
+        orphans = next;
+    }
+    return 0;
+}
+
+/**
+ * Gets the atoms store, the hull buffers reserved for the atoms and an array for the result.
+ * Responsible for building the convex hull of the atoms with the quickhull algorithm.
+ * Atoms closer to the hull than the rounding tolerance are treated as inside.
+ * The buffers of the hull are grown when needed and kept for the next frame.
+ * Return the number of hull vertices or -1 if the hull couldn't be built.
+ * @param atoms
+ * @param hull
+ * @param hullVertices
+ * @return the number of vertices
+ */
+int findHullVertices(const AtomStore *atoms, Hull *hull, int *hullVertices)
+{
+    int result = 0, iteration = 1, vertexCount = 0;
+
+    hull->faceCount = 0;
+    if(atoms->count < TETRAHEDRON_FACES || buildTetrahedron(atoms, hull) != 0)
+    {
+        result = -1;
+    }
+    for(int i = 0; i < atoms->count && result == 0; i++)
+    {
+        hull->startOf[i] = NO_FACE;
+    }
+
+    for(int f = 0; f < hull->faceCount && result == 0; f++)
+    {
+        int eye = -1;
+        double farthest = 0;
+        if(!hull->faces[f].alive || hull->faces[f].outsideHead == -1)
+        {
+            continue;
+        }
+        for(int atom = hull->faces[f].outsideHead; atom != -1; atom = hull->nextOutside[atom])
+        {
+            double distance = faceDistance(&hull->faces[f], atoms, atom);
+            if(distance > farthest)
+            {
+                farthest = distance;
+                eye = atom;
+            }
+        }
+        //every alive face could be visible at once
+        if(hull->faceCount > hull->stackCapacity)
+        {
+            int *stack = realloc(hull->stack, sizeof(int) * hull->faceCount * 2);
+            if(stack == NULL)
+            {
+                result = -1;
+                break;
+            }
+            hull->stack = stack;
+            hull->stackCapacity = hull->faceCount * 2;
+        }
+        result = addHullPoint(hull, atoms, f, eye, iteration++);
+    }
+
+    if(result == 0)
+    {
+        //startOf is free again and is reused to mark the vertices
+        for(int f = 0; f < hull->faceCount; f++)
+        {
+            for(int k = 0; k < COORDINATES && hull->faces[f].alive; k++)
+            {
+                int vertex = hull->faces[f].vertex[k];
+                if(hull->startOf[vertex] == NO_FACE)
+                {
+                    hull->startOf[vertex] = f;
+                    hullVertices[vertexCount++] = vertex;
+                }
+            }
+        }
+        result = vertexCount;
+    }
+    return result;
+}
+
+//*********************************** cell grid ***********************************************
+
+/**
+ * Gets a cell grid.
+ * Responsible for starting it empty, the buffers are allocated by the first build.
+ * @param grid
+ */
+void initCellGrid(CellGrid *grid)
+{
+    initAtomStore(&grid->atoms);
+    grid->order = NULL;
+    grid->cellOf = NULL;
+    grid->atomCapacity = 0;
+    grid->cellStart = NULL;
+    grid->cellCapacity = 0;
+    grid->cellCount = 0;
+    for(int k = 0; k < COORDINATES; k++)
+    {
+        grid->dimension[k] = 0;
+        grid->origin[k] = 0;
+    }
+    grid->cellSize = 0;
+}
+
+/**
+ * Gets a cell grid, the atoms of a frame and the cutoff of the queries to come.
+ * Responsible for covering the bounding box of the atoms with cells of the cutoff
+ * size (larger when the cells would be more than GRID_CELLS_PER_ATOM per atom,
+ * as for a flat or a stretched frame) and sorting the atoms by cell with a
+ * counting sort, O(n) for n atoms. The buffers only grow from frame to frame.
+ * @param grid
+ * @param atoms
+ * @param cutoff must be positive
+ * @return 0 for success, -1 if the memory ran out
+ */
+int buildCellGrid(CellGrid *grid, const AtomStore *atoms, float cutoff)
+{
+    float low[COORDINATES] = {0, 0, 0}, high[COORDINATES] = {0, 0, 0};
+    long cellLimit = (atoms->count > 0 ? atoms->count : 1) * (long)GRID_CELLS_PER_ATOM;
+    long cellCount;
+
+    for(int k = 0; k < COORDINATES && atoms->count > 0; k++)
+    {
+        low[k] = high[k] = atoms->lane[k][0];
+        for(int i = 1; i < atoms->count; i++)
+        {
+            low[k] = fminf(low[k], atoms->lane[k][i]);
+            high[k] = fmaxf(high[k], atoms->lane[k][i]);
+        }
+    }
+    grid->cellSize = cutoff;
+    do
+    {
+        cellCount = 1;
+        for(int k = 0; k < COORDINATES; k++)
+        {
+            grid->dimension[k] = (int)((high[k] - low[k]) / grid->cellSize) + 1;
+            grid->origin[k] = low[k];
+            cellCount *= grid->dimension[k];
+        }
+        if(cellCount > cellLimit)
+        {
+            grid->cellSize *= 2;
+        }
+    } while(cellCount > cellLimit);
+
+    if(cellCount + 1 > grid->cellCapacity)
+    {
+        int *cellStart = realloc(grid->cellStart, sizeof(int) * (cellCount + 1));
+        if(cellStart == NULL)
+        {
+            return -1;
+        }
+        grid->cellStart = cellStart;
+        grid->cellCapacity = (int)cellCount + 1;
+    }
+    if(atoms->count > grid->atomCapacity)
+    {
+        int *order = realloc(grid->order, sizeof(int) * atoms->count);
+        int *cellOf = order == NULL ? NULL : realloc(grid->cellOf, sizeof(int) * atoms->count);
+        grid->order = order != NULL ? order : grid->order;
+        grid->cellOf = cellOf != NULL ? cellOf : grid->cellOf;
+        if(cellOf == NULL)
+        {
+            return -1;
+        }
+        grid->atomCapacity = atoms->count;
+    }
+    grid->cellCount = (int)cellCount;
+
+    //counts the atoms of every cell, turns the counts to starts and places the atoms
+    memset(grid->cellStart, 0, sizeof(int) * (cellCount + 1));
+    for(int i = 0; i < atoms->count; i++)
+    {
+        int cell[COORDINATES];
+        grid->cellOf[i] = gridCell(grid, atoms->lane[0][i], atoms->lane[1][i], atoms->lane[2][i], cell);
+        grid->cellStart[grid->cellOf[i] + 1]++;
+    }
+    for(int c = 0; c < grid->cellCount; c++)
+    {
+        grid->cellStart[c + 1] += grid->cellStart[c];
+    }
+    for(int i = 0; i < atoms->count; i++)
+    {
+        grid->order[grid->cellStart[grid->cellOf[i]]++] = i;
+    }
+    //every start moved to the end of its cell, the start of the next one
+    for(int c = grid->cellCount; c > 0; c--)
+    {
+        grid->cellStart[c] = grid->cellStart[c - 1];
+    }
+    grid->cellStart[0] = 0;
+
+    grid->atoms.count = 0;
+    for(int i = 0; i < atoms->count; i++)
+    {
+        int atom = grid->order[i];
+        if(addAtom(&grid->atoms, atoms->lane[0][atom], atoms->lane[1][atom], atoms->lane[2][atom]) != 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Gets a cell grid.
+ * Responsible for freeing all its buffers.
+ * @param grid
+ */
+void freeCellGrid(CellGrid *grid)
+{
+    freeAtomStore(&grid->atoms);
+    free(grid->order);
+    free(grid->cellOf);
+    free(grid->cellStart);
+    initCellGrid(grid);
+}
+
+/**
+ * Gets a cell grid, a point and the cell coordinates to fill.
+ * Responsible for finding the cell of the point, a point out of the grid
+ * is taken to the nearest cell on the border.
+ * @param grid
+ * @param x
+ * @param y
+ * @param z
+ * @param cell
+ * @return the number of the cell
+ */
+int gridCell(const CellGrid *grid, float x, float y, float z, int cell[3])
+{
+    float point[COORDINATES] = {x, y, z};
+    for(int k = 0; k < COORDINATES; k++)
+    {
+        float position = (point[k] - grid->origin[k]) / grid->cellSize;
+        cell[k] = position < 0 ? 0 : (int)position;
+        cell[k] = cell[k] < grid->dimension[k] ? cell[k] : grid->dimension[k] - 1;
+    }
+    return cell[0] + grid->dimension[0] * (cell[1] + grid->dimension[1] * cell[2]);
+}
+
+/**
+ * Gets a cell grid, a point, a cutoff and a visitor with its data.
+ * Responsible for visiting every atom of the grid within the cutoff of the point,
+ * looking only at the cells the cutoff reaches.
+ * @param grid
+ * @param point
+ * @param cutoff
+ * @param visitor
+ * @param data
+ */
+void visitNeighbors(const CellGrid *grid, const float point[3], float cutoff, NeighborVisitor visitor, void *data)
+{
+    const float *x = grid->atoms.lane[0], *y = grid->atoms.lane[1], *z = grid->atoms.lane[2];
+    float squaredCutoff = cutoff * cutoff;
+    int low[COORDINATES], high[COORDINATES];
+
+    if(grid->cellCount == 0)
+    {
+        return;
+    }
+    gridCell(grid, point[0] - cutoff, point[1] - cutoff, point[2] - cutoff, low);
+    gridCell(grid, point[0] + cutoff, point[1] + cutoff, point[2] + cutoff, high);
+    for(int cz = low[2]; cz <= high[2]; cz++)
+    {
+        for(int cy = low[1]; cy <= high[1]; cy++)
+        {
+            //the cells of a row are contiguous and so are their atoms
+            int rowCell = grid->dimension[0] * (cy + grid->dimension[1] * cz);
+            int end = grid->cellStart[rowCell + high[0] + 1];
+            for(int i = grid->cellStart[rowCell + low[0]]; i < end; i++)
+            {
+                float dx = x[i] - point[0], dy = y[i] - point[1], dz = z[i] - point[2];
+                float squaredDistance = dx * dx + dy * dy + dz * dz;
+                if(squaredDistance <= squaredCutoff)
+                {
+                    visitor(data, -1, i, squaredDistance);
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Gets a cell grid, a range of cells, a cutoff (at most the cutoff it was built for)
+ * and a visitor with its data.
+ * Responsible for visiting every pair of atoms within the cutoff whose first atom
+ * is in the range, each pair once: the pairs inside a cell, and the pairs with
+ * the neighbor cells of a larger number (half of the 26). Ranges that don't
+ * overlap visit different pairs, so they can be given to different threads.
+ * A NULL visitor only counts the pairs.
+ * @param grid
+ * @param firstCell
+ * @param lastCell one past the last cell of the range
+ * @param cutoff
+ * @param visitor
+ * @param data
+ * @return the number of pairs visited
+ */
+long visitCellPairs(const CellGrid *grid, int firstCell, int lastCell, float cutoff,
+                    NeighborVisitor visitor, void *data)
+{
+    const float *x = grid->atoms.lane[0], *y = grid->atoms.lane[1], *z = grid->atoms.lane[2];
+    float squaredCutoff = cutoff * cutoff;
+    long pairs = 0;
+
+    for(int c = firstCell; c < lastCell; c++)
+    {
+        int cx = c % grid->dimension[0];
+        int cy = c / grid->dimension[0] % grid->dimension[1];
+        int cz = c / grid->dimension[0] / grid->dimension[1];
+        for(int nz = cz; nz <= cz + 1 && nz < grid->dimension[2]; nz++)
+        {
+            for(int ny = nz == cz ? cy : cy - 1; ny <= cy + 1 && ny < grid->dimension[1]; ny++)
+            {
+                int rowCell = grid->dimension[0] * (ny + grid->dimension[1] * nz);
+                int low = nz == cz && ny == cy ? cx : cx - 1, high = cx + 1;
+                int start, end;
+                if(ny < 0)
+                {
+                    continue;
+                }
+                low = low < 0 ? 0 : low;
+                high = high < grid->dimension[0] ? high : grid->dimension[0] - 1;
+                start = grid->cellStart[rowCell + low];
+                end = grid->cellStart[rowCell + high + 1];
+                for(int i = grid->cellStart[c]; i < grid->cellStart[c + 1]; i++)
+                {
+                    //inside its own cell an atom only meets the atoms after it
+                    for(int j = start > i ? start : i + 1; j < end; j++)
+                    {
+                        float dx = x[i] - x[j], dy = y[i] - y[j], dz = z[i] - z[j];
+                        float squaredDistance = dx * dx + dy * dy + dz * dz;
+                        if(squaredDistance <= squaredCutoff)
+                        {
+                            if(visitor != NULL)
+                            {
+                                visitor(data, i, j, squaredDistance);
+                            }
+                            pairs++;
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return pairs;
+}
+
+/**
+ * Gets the atoms of a frame, a cutoff, the number of threads, the workspace and
+ * the neighbors to fill, or NULL.
+ * Responsible for counting the pairs of atoms within the cutoff on the cell grid,
+ * with the threads taking chunks of cells. Every thread counts the neighbors of
+ * the atoms in its own array, the arrays are added up in the order of the frame.
+ * @param atoms
+ * @param cutoff
+ * @param threads
+ * @param workspace
+ * @param neighborCounts zeroed, one per atom
+ * @return the number of pairs, -1 if the memory ran out
+ */
+long long calContacts(const AtomStore *atoms, float cutoff, int threads, Workspace *workspace, int *neighborCounts)
+{
+    CellGrid *grid = &workspace->grid;
+    ContactCells cells;
+    ContactWorker *workers;
+    pthread_t *handles;
+    long long contacts = 0;
+    int started = 0, failed = 0;
+
+    if(buildCellGrid(grid, atoms, cutoff) != 0)
+    {
+        return -1;
+    }
+#ifdef HAVE_OFFLOAD
+    if(atoms->count >= offloadMinAtoms)
+    {
+        return calContactsDevice(atoms, grid, cutoff, neighborCounts);
+    }
+#endif
+    threads = atoms->count < PARALLEL_CONTACTS_MIN_ATOMS ? 1 : threads;
+    workers = calloc(threads, sizeof(ContactWorker));
+    handles = malloc(sizeof(pthread_t) * threads);
+    failed = workers == NULL || handles == NULL;
+    for(int t = 0; t < threads && !failed; t++)
+    {
+        workers[t].cells = &cells;
+        if(neighborCounts != NULL)
+        {
+            workers[t].neighborCounts = calloc(atoms->count, sizeof(int));
+            failed = workers[t].neighborCounts == NULL;
+        }
+    }
+    if(failed)
+    {
+        for(int t = 0; t < threads && workers != NULL; t++)
+        {
+            free(workers[t].neighborCounts);
+        }
+        free(workers);
+        free(handles);
+        return -1;
+    }
+
+    cells.grid = grid;
+    cells.cutoff = cutoff;
+    cells.nextCell = 0;
+    //this thread is the first worker
+    while(started + 1 < threads && pthread_create(&handles[started + 1], NULL, contactWorker,
+                                                  &workers[started + 1]) == 0)
+    {
+        started++;
+    }
+    contactWorker(&workers[0]);
+    for(int t = 1; t <= started; t++)
+    {
+        pthread_join(handles[t], NULL);
+    }
+    for(int t = 0; t <= started; t++)
+    {
+        contacts += workers[t].contacts;
+        for(int i = 0; neighborCounts != NULL && i < atoms->count; i++)
+        {
+            neighborCounts[grid->order[i]] += workers[t].neighborCounts[i];
+        }
+    }
+    for(int t = 0; t < threads; t++)
+    {
+        free(workers[t].neighborCounts);
+    }
+    free(workers);
+    free(handles);
+    return contacts;
+}
+
+/**
+ * Gets a worker of the contacts.
+ * Responsible for taking chunks of cells until there are none left and
+ * counting their pairs in the worker.
+ * @param workerPointer
+ * @return NULL
+ */
+void *contactWorker(void *workerPointer)
+{
+    ContactWorker *worker = workerPointer;
+    ContactCells *cells = worker->cells;
+    int cellCount = cells->grid->cellCount;
+    int first;
+
+    worker->contacts = 0;
+    while((first = __atomic_fetch_add(&cells->nextCell, CONTACT_CHUNK, __ATOMIC_RELAXED)) < cellCount)
+    {
+        int last = first + CONTACT_CHUNK < cellCount ? first + CONTACT_CHUNK : cellCount;
+        worker->contacts += visitCellPairs(cells->grid, first, last, cells->cutoff,
+                                           worker->neighborCounts != NULL ? countNeighbor : NULL,
+                                           worker->neighborCounts);
+    }
+    return NULL;
+}
+
+/**
+ * Gets the neighbors of a worker and a pair of atoms within the cutoff.
+ * Responsible for counting the pair for both atoms.
+ * @param data
+ * @param first
+ * @param second
+ * @param squaredDistance
+ */
+void countNeighbor(void *data, int first, int second, float squaredDistance)
+{
+    int *neighborCounts = data;
+    (void)squaredDistance;
+    neighborCounts[first]++;
+    neighborCounts[second]++;
+}
+
+//*********************************** mmCIF *************************************************
+
+/**
+ * Gets a reader.
+ * Responsible for starting it outside of any loop and without models.
+ * @param reader
+ */
+void initCifReader(CifReader *reader)
+{
+    startCifLoop(reader);
+    reader->state = CIF_OUTSIDE;
+    reader->textField = 0;
+    reader->model = NO_MODEL;
+    reader->models = 0;
+}
+
+/**
+ * Gets the first line of a file that isn't blank or a comment so far.
+ * Return INPUT_CIF for a line starting with data_, INPUT_PDB for any other
+ * text and INPUT_UNDETECTED for a blank or a comment line.
+ * @param line
+ * @param lineLength
+ * @return the format
+ */
+InputFormat detectFormat(const char *line, size_t lineLength)
+{
+    const char *end = line + lineLength;
+
+    while(line < end && IS_CIF_BLANK(*line))
+    {
+        line++;
+    }
+    if(line == end || *line == CIF_COMMENT)
+    {
+        return INPUT_UNDETECTED;
+    }
+    if((size_t)(end - line) >= CIF_DATA_STARTER_LEN && strncasecmp(line, CIF_DATA_STARTER, CIF_DATA_STARTER_LEN) == 0)
+    {
+        return INPUT_CIF;
+    }
+    return INPUT_PDB;
+}
+
+/**
+ * Gets a line of an mmCIF file with its length, the parse context and the file result.
+ * Responsible for splitting the line to tokens: blank separated words, quoted
+ * values whose quote ends only before a blank, and a comment to the end of the
+ * line. A text field, the lines between two lines starting with ';', is one value.
+ * @param line
+ * @param lineLength
+ * @param context
+ * @param result
+ * @return FILE_OK for success or the error status
+ */
+FileStatus parseCifLine(const char *line, size_t lineLength, ParseContext *context, FileResult *result)
+{
+    CifReader *reader = &context->cif;
+    const char *cursor = line, *end = line + lineLength;
+
+    if(lineLength > 0 && line[0] == CIF_TEXT_FIELD)
+    {
+        FileStatus status;
+        reader->textField = !reader->textField;
+        if(reader->textField) //the text is skipped, the value is kept empty
+        {
+            return FILE_OK;
+        }
+        status = parseCifToken(cursor++, 0, 1, context, result);
+        if(status != FILE_OK)
+        {
+            return status;
+        }
+    }
+    else if(reader->textField)
+    {
+        return FILE_OK;
+    }
+    while(cursor < end)
+    {
+        const char *start;
+        size_t length;
+        int quoted = 0;
+        FileStatus status;
+
+        while(cursor < end && IS_CIF_BLANK(*cursor))
+        {
+            cursor++;
+        }
+        if(cursor == end || *cursor == CIF_COMMENT)
+        {
+            break;
+        }
+        start = cursor;
+        if(*cursor == '\'' || *cursor == '"')
+        {
+            char quote = *cursor;
+            start = ++cursor;
+            while(cursor < end && !(*cursor == quote && (cursor + 1 == end || IS_CIF_BLANK(cursor[1]))))
+            {
+                cursor++;
+            }
+            length = cursor - start;
+            cursor += cursor < end;
+            quoted = 1;
+        }
+        else
+        {
+            while(cursor < end && !IS_CIF_BLANK(*cursor))
+            {
+                cursor++;
+            }
+            length = cursor - start;
+        }
+        status = parseCifToken(start, length, quoted, context, result);
+        if(status != FILE_OK)
+        {
+            return status;
+        }
+    }
+    return FILE_OK;
+}
+
+/**
+ * Gets a token of an mmCIF file with its length, whether it was quoted, the
+ * parse context and the file result.
+ * Responsible for following the loops: the _atom_site tags of a loop give the
+ * columns of the read items and every full row of its values is an atom.
+ * The values of the other loops and of the single items are skipped.
+ * @param token
+ * @param length
+ * @param quoted
+ * @param context
+ * @param result
+ * @return FILE_OK for success or the error status
+ */
+FileStatus parseCifToken(const char *token, size_t length, int quoted, ParseContext *context, FileResult *result)
+{
+    CifReader *reader = &context->cif;
+
+    if(!quoted && length == CIF_LOOP_LEN && strncasecmp(token, CIF_LOOP, CIF_LOOP_LEN) == 0)
+    {
+        startCifLoop(reader);
+        return FILE_OK;
+    }
+    if(!quoted && length >= CIF_DATA_STARTER_LEN && strncasecmp(token, CIF_DATA_STARTER, CIF_DATA_STARTER_LEN) == 0)
+    {
+        reader->state = CIF_OUTSIDE;
+        return FILE_OK;
+    }
+    if(!quoted && token[0] == '_')
+    {
+        if(reader->state != CIF_LOOP_TAGS)
+        {
+            reader->state = CIF_PAIR_VALUE;
+            return FILE_OK;
+        }
+        if(length > CIF_ATOM_SITE_LEN && strncasecmp(token, CIF_ATOM_SITE, CIF_ATOM_SITE_LEN) == 0)
+        {
+            reader->atomLoop = 1;
+            for(int k = 0; k < CIF_FIELD_COUNT && reader->columnCount < CIF_MAX_COLUMNS; k++)
+            {
+                if(strlen(cifFieldNames[k]) == length - CIF_ATOM_SITE_LEN &&
+                   strncasecmp(token + CIF_ATOM_SITE_LEN, cifFieldNames[k], length - CIF_ATOM_SITE_LEN) == 0)
+                {
+                    reader->fieldColumn[k] = reader->columnCount;
+                    reader->columnField[reader->columnCount] = (signed char)k;
+                }
+            }
+        }
+        reader->columnCount++;
+        return FILE_OK;
+    }
+    switch(reader->state)
+    {
+        case CIF_LOOP_TAGS: //the first value ends the tags
+            reader->atomLoop = reader->atomLoop && reader->fieldColumn[CIF_X] >= 0 && reader->fieldColumn[CIF_Y] >= 0
+                               && reader->fieldColumn[CIF_Z] >= 0;
+            reader->state = reader->atomLoop ? CIF_ATOM_ROWS : CIF_OTHER_ROWS;
+            reader->column = 0;
+            return reader->atomLoop ? parseCifToken(token, length, quoted, context, result) : FILE_OK;
+        case CIF_PAIR_VALUE:
+            reader->state = CIF_OUTSIDE;
+            return FILE_OK;
+        case CIF_ATOM_ROWS:
+        {
+            int field = reader->column < CIF_MAX_COLUMNS ? reader->columnField[reader->column] : -1;
+            if(field >= 0)
+            {
+                size_t kept = length < CIF_VALUE_LEN ? length : CIF_VALUE_LEN;
+                memcpy(reader->values[field], token, kept);
+                reader->values[field][kept] = END_OF_STRING;
+                reader->valueLength[field] = (int)kept;
+            }
+            if(++reader->column < reader->columnCount)
+            {
+                return FILE_OK;
+            }
+            reader->column = 0;
+            return parseCifRow(context, result);
+        }
+        default:
+            return FILE_OK;
+    }
+}
+
+/**
+ * Gets a reader.
+ * Responsible for starting the tags of a new loop without any read item.
+ * @param reader
+ */
+void startCifLoop(CifReader *reader)
+{
+    reader->state = CIF_LOOP_TAGS;
+    reader->atomLoop = 0;
+    reader->columnCount = 0;
+    reader->column = 0;
+    for(int k = 0; k < CIF_MAX_COLUMNS; k++)
+    {
+        reader->columnField[k] = -1;
+    }
+    for(int k = 0; k < CIF_FIELD_COUNT; k++)
+    {
+        reader->fieldColumn[k] = -1;
+        reader->valueLength[k] = 0;
+    }
+}
+
+/**
+ * Gets the parse context after a full row of the atoms loop and the file result.
+ * Responsible for converting the values of the row to an atom, the author
+ * names, chains and residues are preferred as they are the ones of a PDB file.
+ * A coordinate that can't be converted is copied to the result.
+ * @param context
+ * @param result
+ * @return FILE_OK for success or the error status
+ */
+FileStatus parseCifRow(ParseContext *context, FileResult *result)
+{
+    CifReader *reader = &context->cif;
+    CifAtom atom;
+    const char *text;
+    int length;
+
+    for(int k = 0; k < COORDINATES; k++)
+    {
+        if(getFloat(reader->values[CIF_X + k], &atom.coordinates[k]) != 0)
+        {
+            memcpy(result->badField, reader->values[CIF_X + k], COORDINATE_LEN);
+            result->badField[COORDINATE_LEN] = END_OF_STRING;
+            return FILE_BAD_COORDINATE;
+        }
+    }
+    cifRowValue(reader, CIF_GROUP, &atom.group, &atom.groupLength);
+    cifRowValue(reader, CIF_SYMBOL, &atom.symbol, &atom.symbolLength);
+    if(!cifRowValue(reader, CIF_AUTH_NAME, &atom.name, &atom.nameLength))
+    {
+        cifRowValue(reader, CIF_LABEL_NAME, &atom.name, &atom.nameLength);
+    }
+    if(!cifRowValue(reader, CIF_AUTH_CHAIN, &atom.chain, &atom.chainLength))
+    {
+        cifRowValue(reader, CIF_LABEL_CHAIN, &atom.chain, &atom.chainLength);
+    }
+    atom.hasResidue = (cifRowValue(reader, CIF_AUTH_RESIDUE, &text, &length) ||
+                       cifRowValue(reader, CIF_LABEL_RESIDUE, &text, &length)) &&
+                      parseCifInteger(text, length, &atom.residue) == 0;
+    atom.hasModel = cifRowValue(reader, CIF_MODEL, &text, &length) && parseCifInteger(text, length, &atom.model) == 0;
+    return addCifAtom(&atom, context, result);
+}
+
+/**
+ * Gets a reader after a full row, an item and the text to fill.
+ * Responsible for finding the value of the item in the row.
+ * @param reader
+ * @param field
+ * @param text NULL when the loop hasn't the item or its value is '?' or '.'
+ * @param length
+ * @return 1 if the row has a value of the item, 0 otherwise
+ */
+int cifRowValue(const CifReader *reader, CifField field, const char **text, int *length)
+{
+    const char *value = reader->values[field];
+    int valueLength = reader->valueLength[field];
+
+    *text = NULL;
+    *length = 0;
+    if(reader->fieldColumn[field] < 0 || (valueLength == 1 && (value[0] == '?' || value[0] == '.')))
+    {
+        return 0;
+    }
+    *text = value;
+    *length = valueLength;
+    return 1;
+}
+
+/**
+ * Gets a text that isn't terminated, its length and the integer to fill.
+ * Responsible for converting a whole text of an optional sign and digits.
+ * @param text
+ * @param length
+ * @param value
+ * @return 0 for success, -1 if the text isn't an integer
+ */
+int parseCifInteger(const char *text, int length, int *value)
+{
+    int k = 0, negative = 0;
+    long result = 0;
+
+    if(k < length && (text[k] == '-' || text[k] == '+'))
+    {
+        negative = text[k++] == '-';
+    }
+    if(k == length)
+    {
+        return -1;
+    }
+    for(; k < length; k++)
+    {
+        if(text[k] < '0' || text[k] > '9' || result > INT_MAX / 10)
+        {
+            return -1;
+        }
+        result = result * 10 + (text[k] - '0');
+    }
+    *value = (int)(negative ? -result : result);
+    return 0;
+}
+
+/**
+ * Gets an atom of an mmCIF or a BinaryCIF file, the parse context and the file result.
+ * Responsible for ending the frame of the previous model when the model changes,
+ * and keeping the atom as parseRecord keeps an ATOM line: the HETATM atoms
+ * only when the selection takes them, the selection, and the mass of the
+ * element of type_symbol or of the first letter of the name.
+ * @param atom
+ * @param context
+ * @param result
+ * @return FILE_OK for success or the error status
+ */
+FileStatus addCifAtom(const CifAtom *atom, ParseContext *context, FileResult *result)
+{
+    const Options *options = context->options;
+    CifReader *reader = &context->cif;
+    float mass = 0;
+
+    if(atom->hasModel && (reader->models == 0 || atom->model != reader->model))
+    {
+        FileStatus status = finishFrame(context, result);
+        if(status != FILE_OK)
+        {
+            return status;
+        }
+        reader->model = atom->model;
+        reader->models++;
+        context->model = atom->model;
+    }
+    if(atom->group != NULL && !equalsText(atom->group, atom->groupLength, CIF_ATOM_GROUP) &&
+       !(options->selection.hetatm && equalsText(atom->group, atom->groupLength, HETATM_STARTER)))
+    {
+        return FILE_OK;
+    }
+    if(options->selection.active && !matchSelection(&options->selection, atom->chain, atom->chainLength, atom->name,
+                                                    atom->nameLength, atom->residue, atom->hasResidue))
+    {
+        return FILE_OK;
+    }
+    if(options->mass)
+    {
+        const char *symbol = atom->symbol != NULL ? atom->symbol : atom->name;
+        int length = atom->symbol != NULL ? atom->symbolLength : atom->name != NULL;
+        mass = length == 1 || length == ELEMENT_LEN ? elementMass(symbol[0], length == 1 ? ' ' : symbol[1]) : 0;
+        if(mass == 0)
+        {
+            int kept = length < COORDINATE_LEN ? length : COORDINATE_LEN;
+            if(kept > 0)
+            {
+                memcpy(result->badField, symbol, kept);
+            }
+            result->badField[kept] = END_OF_STRING;
+            return FILE_UNKNOWN_ELEMENT;
+        }
+    }
+    return storeAtom(context, atom->coordinates, mass);
+}
+
+/**
+ * Gets the parse context of an mmCIF or a BinaryCIF file that was parsed.
+ * Responsible for leaving the last frame of a file of one model without a model.
+ * @param context
+ */
+void endCifInput(ParseContext *context)
+{
+    if(context->cif.models < 2)
+    {
+        context->model = NO_MODEL;
+    }
+}
+
+/**
+ * Gets the first bytes of a file and their number.
+ * Return 1 if they start a MessagePack map, the root of a BinaryCIF file,
+ * 0 otherwise. No text starts with these bytes.
+ * @param data
+ * @param size
+ * @return the result
+ */
+int isBinaryCif(const char *data, size_t size)
+{
+    unsigned char first = size > 0 ? (unsigned char)data[0] : 0;
+
+    return (first >= 0x80 && first <= 0x8f) || first == 0xde || first == 0xdf; //fixmap, map 16 and map 32
+}
+
+/**
+ * Gets an open file, the bytes already read from it with their number, the
+ * parse context and the file result.
+ * Responsible for reading the rest of the file to the heap and decoding it.
+ * @param fd
+ * @param start
+ * @param size
+ * @param context
+ * @param result
+ * @return FILE_OK for success or the error status
+ */
+FileStatus parseBinaryStream(int fd, const char *start, size_t size, ParseContext *context, FileResult *result)
+{
+    size_t capacity = size + READ_CHUNK;
+    char *data = malloc(capacity);
+    ssize_t bytes;
+    FileStatus status;
+
+    if(data == NULL)
+    {
+        return FILE_NO_MEMORY;
+    }
+    memcpy(data, start, size);
+    do
+    {
+        if(size == capacity)
+        {
+            char *grown = realloc(data, capacity * 2);
+            if(grown == NULL)
+            {
+                free(data);
+                return FILE_NO_MEMORY;
+            }
+            data = grown;
+            capacity *= 2;
+        }
+        bytes = read(fd, data + size, capacity - size);
+        if(bytes > 0)
+        {
+            size += bytes;
+            if(context->stats != NULL)
+            {
+                context->stats->bytes += bytes;
+            }
+        }
+    } while(bytes > 0);
+    //the read stopped on an error, nothing is trusted
+    status = bytes < 0 ? FILE_NO_ATOMS : parseBinaryCif(data, size, context, result);
+    free(data);
+    return status;
+}
+
+/**
+ * Gets the whole content of a BinaryCIF file with its size, the parse context
+ * and the file result.
+ * Responsible for finding the _atom_site category of the first data block and
+ * handing its atoms on. A file without it has no atoms.
+ * @param data
+ * @param size
+ * @param context
+ * @param result
+ * @return FILE_OK for success or the error status
+ */
+FileStatus parseBinaryCif(const char *data, size_t size, ParseContext *context, FileResult *result)
+{
+    MsgReader root = {(const uint8_t *)data, size, 0}, blocks, categories;
+    uint64_t count;
+    double number;
+
+    context->format = INPUT_CIF;
+    if(findMsgKey(root, "dataBlocks", &blocks) != 0 || readMsgHeader(&blocks, &count, &number) != MSG_ARRAY)
+    {
+        return FILE_BAD_BINARY_CIF;
+    }
+    if(count == 0)
+    {
+        return FILE_OK;
+    }
+    if(findMsgKey(blocks, "categories", &categories) != 0 ||
+       readMsgHeader(&categories, &count, &number) != MSG_ARRAY)
+    {
+        return FILE_BAD_BINARY_CIF;
+    }
+    for(uint64_t i = 0; i < count; i++)
+    {
+        MsgReader name;
+        const char *text;
+        size_t length;
+
+        if(findMsgKey(categories, "name", &name) != 0 || readMsgString(&name, &text, &length) != 0)
+        {
+            return FILE_BAD_BINARY_CIF;
+        }
+        if(equalsText(text, length, CIF_ATOM_SITE_CATEGORY))
+        {
+            return parseBinaryAtoms(categories, context, result);
+        }
+        if(skipMsgValue(&categories) != 0)
+        {
+            return FILE_BAD_BINARY_CIF;
+        }
+    }
+    return FILE_OK;
+}
+
+/**
+ * Gets the _atom_site category of a BinaryCIF file, the parse context and the file result.
+ * Responsible for decoding the columns of the read items and handing every
+ * row on as an atom. A missing coordinate is a coordinate that can't be converted.
+ * @param category
+ * @param context
+ * @param result
+ * @return FILE_OK for success or the error status
+ */
+FileStatus parseBinaryAtoms(MsgReader category, ParseContext *context, FileResult *result)
+{
+    CifColumn columns[CIF_FIELD_COUNT];
+    MsgReader rows, list;
+    uint64_t count;
+    double rowCount, number;
+    FileStatus status = FILE_OK;
+
+    memset(columns, 0, sizeof(columns));
+    if(findMsgKey(category, "rowCount", &rows) != 0 || readMsgNumber(&rows, &rowCount) != 0 || rowCount < 0 ||
+       rowCount > INT_MAX || findMsgKey(category, "columns", &list) != 0 ||
+       readMsgHeader(&list, &count, &number) != MSG_ARRAY)
+    {
+        return FILE_BAD_BINARY_CIF;
+    }
+    for(uint64_t i = 0; i < count && status == FILE_OK; i++)
+    {
+        MsgReader name;
+        const char *text;
+        size_t length;
+
+        if(findMsgKey(list, "name", &name) != 0 || readMsgString(&name, &text, &length) != 0)
+        {
+            status = FILE_BAD_BINARY_CIF;
+        }
+        for(int k = 0; k < CIF_FIELD_COUNT && status == FILE_OK; k++)
+        {
+            if(columns[k].values == NULL && equalsText(text, length, cifFieldNames[k]))
+            {
+                status = decodeCifColumn(list, &columns[k]);
+                if(status == FILE_OK && (columns[k].count < rowCount ||
+                                         (columns[k].mask != NULL && columns[k].maskCount < rowCount)))
+                {
+                    status = FILE_BAD_BINARY_CIF;
+                }
+            }
+        }
+        if(status == FILE_OK && skipMsgValue(&list) != 0)
+        {
+            status = FILE_BAD_BINARY_CIF;
+        }
+    }
+    for(int k = 0; k < COORDINATES && status == FILE_OK; k++)
+    {
+        if(columns[CIF_X + k].values != NULL && columns[CIF_X + k].text != NULL) //the coordinates are numbers
+        {
+            status = FILE_BAD_BINARY_CIF;
+        }
+    }
+    if(columns[CIF_X].values == NULL || columns[CIF_Y].values == NULL || columns[CIF_Z].values == NULL)
+    {
+        rowCount = 0;
+    }
+    for(int row = 0; row < (int)rowCount && status == FILE_OK; row++)
+    {
+        CifAtom atom;
+
+        for(int k = 0; k < COORDINATES && status == FILE_OK; k++)
+        {
+            const CifColumn *column = &columns[CIF_X + k];
+            if(column->mask != NULL && column->mask[row] != 0)
+            {
+                strcpy(result->badField, column->mask[row] == 1 ? "." : "?");
+                status = FILE_BAD_COORDINATE;
+            }
+            atom.coordinates[k] = (float)column->values[row];
+        }
+        if(status != FILE_OK)
+        {
+            break;
+        }
+        cifColumnString(&columns[CIF_GROUP], row, &atom.group, &atom.groupLength);
+        cifColumnString(&columns[CIF_SYMBOL], row, &atom.symbol, &atom.symbolLength);
+        if(!cifColumnString(&columns[CIF_AUTH_NAME], row, &atom.name, &atom.nameLength))
+        {
+            cifColumnString(&columns[CIF_LABEL_NAME], row, &atom.name, &atom.nameLength);
+        }
+        if(!cifColumnString(&columns[CIF_AUTH_CHAIN], row, &atom.chain, &atom.chainLength))
+        {
+            cifColumnString(&columns[CIF_LABEL_CHAIN], row, &atom.chain, &atom.chainLength);
+        }
+        atom.hasResidue = cifColumnInteger(&columns[CIF_AUTH_RESIDUE], row, &atom.residue) ||
+                          cifColumnInteger(&columns[CIF_LABEL_RESIDUE], row, &atom.residue);
+        atom.hasModel = cifColumnInteger(&columns[CIF_MODEL], row, &atom.model);
+        status = addCifAtom(&atom, context, result);
+    }
+    for(int k = 0; k < CIF_FIELD_COUNT; k++)
+    {
+        freeCifColumn(&columns[k]);
+    }
+    return status;
+}
+
+/**
+ * Gets a column of a BinaryCIF category and the column to fill.
+ * Responsible for decoding its data and its mask.
+ * @param column
+ * @param decoded
+ * @return FILE_OK for success or the error status
+ */
+FileStatus decodeCifColumn(MsgReader column, CifColumn *decoded)
+{
+    MsgReader data, mask;
+    uint64_t length;
+    double number;
+    FileStatus status;
+
+    memset(decoded, 0, sizeof(*decoded));
+    if(findMsgKey(column, "data", &data) != 0)
+    {
+        return FILE_BAD_BINARY_CIF;
+    }
+    status = decodeCifData(data, 1, decoded);
+    if(status == FILE_OK && findMsgKey(column, "mask", &mask) == 0)
+    {
+        MsgReader peek = mask;
+        if(readMsgHeader(&peek, &length, &number) == MSG_MAP) //a column without missing values has a nil mask
+        {
+            CifColumn masks;
+            status = decodeCifData(mask, 0, &masks);
+            decoded->mask = masks.values;
+            decoded->maskCount = masks.count;
+        }
+    }
+    if(status != FILE_OK)
+    {
+        freeCifColumn(decoded);
+    }
+    return status;
+}
+
+/**
+ * Gets the encoded data of a BinaryCIF column, its bytes and its encodings,
+ * whether it may hold strings and the column to fill.
+ * Responsible for decoding it.
+ * @param encoded
+ * @param strings
+ * @param decoded
+ * @return FILE_OK for success or the error status
+ */
+FileStatus decodeCifData(MsgReader encoded, int strings, CifColumn *decoded)
+{
+    MsgReader data, encodings;
+    const char *raw;
+    size_t rawLength;
+
+    memset(decoded, 0, sizeof(*decoded));
+    if(findMsgKey(encoded, "data", &data) != 0 || readMsgString(&data, &raw, &rawLength) != 0 ||
+       findMsgKey(encoded, "encoding", &encodings) != 0)
+    {
+        return FILE_BAD_BINARY_CIF;
+    }
+    return decodeCifValues((const uint8_t *)raw, rawLength, encodings, strings, decoded);
+}
+
+/**
+ * Gets the bytes of an encoded column with their number, the array of its
+ * encodings, whether it may hold strings and the column to fill.
+ * Responsible for undoing the encodings from the last one applied to the first:
+ * a ByteArray turns the bytes to numbers, the other encodings transform the
+ * numbers and a StringArray turns the bytes to the indexes of its strings.
+ * @param raw
+ * @param rawLength
+ * @param encodings
+ * @param strings
+ * @param decoded
+ * @return FILE_OK for success or the error status
+ */
+FileStatus decodeCifValues(const uint8_t *raw, size_t rawLength, MsgReader encodings, int strings, CifColumn *decoded)
+{
+    MsgReader steps[CIF_MAX_ENCODINGS];
+    uint64_t stepCount;
+    double number, *values = NULL;
+    size_t count = 0;
+    FileStatus status = FILE_OK;
+
+    memset(decoded, 0, sizeof(*decoded));
+    if(readMsgHeader(&encodings, &stepCount, &number) != MSG_ARRAY || stepCount == 0 ||
+       stepCount > CIF_MAX_ENCODINGS)
+    {
+        return FILE_BAD_BINARY_CIF;
+    }
+    for(uint64_t i = 0; i < stepCount; i++)
+    {
+        steps[i] = encodings;
+        if(skipMsgValue(&encodings) != 0)
+        {
+            return FILE_BAD_BINARY_CIF;
+        }
+    }
+    for(int i = (int)stepCount - 1; i >= 0 && status == FILE_OK; i--)
+    {
+        MsgReader kindValue;
+        const char *kind;
+        size_t kindLength;
+
+        if(findMsgKey(steps[i], "kind", &kindValue) != 0 || readMsgString(&kindValue, &kind, &kindLength) != 0)
+        {
+            status = FILE_BAD_BINARY_CIF;
+        }
+        else if(equalsText(kind, kindLength, "ByteArray"))
+        {
+            status = values == NULL ? decodeByteArray(steps[i], raw, rawLength, &values, &count) : FILE_BAD_BINARY_CIF;
+        }
+        else if(equalsText(kind, kindLength, "StringArray"))
+        {
+            status = values == NULL && strings ? decodeStringArray(steps[i], decoded, raw, rawLength, &values, &count)
+                                               : FILE_BAD_BINARY_CIF;
+        }
+        else
+        {
+            status = values != NULL ? decodeCifStep(steps[i], kind, kindLength, &values, &count) : FILE_BAD_BINARY_CIF;
+        }
+    }
+    if(status == FILE_OK && (values == NULL || count > INT_MAX))
+    {
+        status = FILE_BAD_BINARY_CIF;
+    }
+    if(status != FILE_OK)
+    {
+        free(values);
+        freeCifColumn(decoded);
+        return status;
+    }
+    decoded->values = values;
+    decoded->count = (int)count;
+    return FILE_OK;
+}
+
+/**
+ * Gets a ByteArray encoding, the bytes of a column with their number and the
+ * values to fill.
+ * Responsible for reading the little endian numbers of the type of the encoding.
+ * @param step
+ * @param raw
+ * @param rawLength
+ * @param values allocated
+ * @param count
+ * @return FILE_OK for success or the error status
+ */
+FileStatus decodeByteArray(MsgReader step, const uint8_t *raw, size_t rawLength, double **values, size_t *count)
+{
+    double type;
+    int size;
+
+    if(findMsgNumber(step, "type", &type) != 0 || !(type >= 0 && type <= BCIF_FLOAT64))
+    {
+        return FILE_BAD_BINARY_CIF;
+    }
+    switch((int)type)
+    {
+        case BCIF_INT8:
+        case BCIF_UINT8:
+            size = 1;
+            break;
+        case BCIF_INT16:
+        case BCIF_UINT16:
+            size = 2;
+            break;
+        case BCIF_INT32:
+        case BCIF_UINT32:
+        case BCIF_FLOAT32:
+            size = 4;
+            break;
+        case BCIF_FLOAT64:
+            size = 8;
+            break;
+        default:
+            return FILE_BAD_BINARY_CIF;
+    }
+    if(rawLength % size != 0)
+    {
+        return FILE_BAD_BINARY_CIF;
+    }
+    *count = rawLength / size;
+    *values = malloc((*count > 0 ? *count : 1) * sizeof(double));
+    if(*values == NULL)
+    {
+        return FILE_NO_MEMORY;
+    }
+    for(size_t i = 0; i < *count; i++)
+    {
+        const uint8_t *bytes = raw + i * size;
+        uint64_t bits = 0;
+        for(int k = size - 1; k >= 0; k--)
+        {
+            bits = bits << 8 | bytes[k];
+        }
+        switch((int)type)
+        {
+            case BCIF_INT8:
+                (*values)[i] = (int8_t)bits;
+                break;
+            case BCIF_INT16:
+                (*values)[i] = (int16_t)bits;
+                break;
+            case BCIF_INT32:
+                (*values)[i] = (int32_t)bits;
+                break;
+            case BCIF_FLOAT32:
+            {
+                uint32_t word = (uint32_t)bits;
+                float single;
+                memcpy(&single, &word, sizeof(single));
+                (*values)[i] = single;
+                break;
+            }
+            case BCIF_FLOAT64:
+                memcpy(&(*values)[i], &bits, sizeof(double));
+                break;
+            default:
+                (*values)[i] = (double)bits;
+                break;
+        }
+    }
+    return FILE_OK;
+}
+
+/**
+ * Gets a StringArray encoding, the column to fill with its strings, the bytes
+ * of the indexes with their number and the values to fill.
+ * Responsible for decoding the indexes of the strings of the rows with the data
+ * encoding and the bounds of the strings with the offset encoding.
+ * @param step
+ * @param decoded
+ * @param raw
+ * @param rawLength
+ * @param values allocated, the indexes
+ * @param count
+ * @return FILE_OK for success or the error status
+ */
+FileStatus decodeStringArray(MsgReader step, CifColumn *decoded, const uint8_t *raw, size_t rawLength,
+                             double **values, size_t *count)
+{
+    MsgReader dataEncoding, offsetEncoding, text, offsetData;
+    CifColumn indexes, offsets;
+    const char *offsetBytes;
+    size_t offsetLength;
+    FileStatus status;
+
+    if(findMsgKey(step, "dataEncoding", &dataEncoding) != 0 || findMsgKey(step, "offsetEncoding", &offsetEncoding) != 0 ||
+       findMsgKey(step, "stringData", &text) != 0 || readMsgString(&text, &decoded->text, &decoded->textLength) != 0 ||
+       findMsgKey(step, "offsets", &offsetData) != 0 || readMsgString(&offsetData, &offsetBytes, &offsetLength) != 0)
+    {
+        return FILE_BAD_BINARY_CIF;
+    }
+    status = decodeCifValues((const uint8_t *)offsetBytes, offsetLength, offsetEncoding, 0, &offsets);
+    if(status != FILE_OK)
+    {
+        return status;
+    }
+    for(int k = 0; k < offsets.count; k++)
+    {
+        if(!(offsets.values[k] >= 0 && offsets.values[k] <= (double)decoded->textLength) ||
+           (k > 0 && offsets.values[k] < offsets.values[k - 1]))
+        {
+            free(offsets.values);
+            return FILE_BAD_BINARY_CIF;
+        }
+    }
+    decoded->offsets = offsets.values;
+    decoded->offsetCount = offsets.count;
+    status = decodeCifValues(raw, rawLength, dataEncoding, 0, &indexes);
+    *values = indexes.values;
+    *count = indexes.count;
+    return status;
+}
+
+/**
+ * Gets an encoding of numbers with its kind and the values to transform.
+ * Responsible for undoing FixedPoint, IntervalQuantization, RunLength, Delta
+ * and IntegerPacking, the values are replaced by the decoded ones.
+ * @param step
+ * @param kind
+ * @param kindLength
+ * @param values
+ * @param count
+ * @return FILE_OK for success or the error status
+ */
+FileStatus decodeCifStep(MsgReader step, const char *kind, size_t kindLength, double **values, size_t *count)
+{
+    double *in = *values;
+
+    if(equalsText(kind, kindLength, "FixedPoint"))
+    {
+        double factor;
+        if(findMsgNumber(step, "factor", &factor) != 0 || factor == 0)
+        {
+            return FILE_BAD_BINARY_CIF;
+        }
+        for(size_t i = 0; i < *count; i++)
+        {
+            in[i] /= factor;
+        }
+    }
+    else if(equalsText(kind, kindLength, "IntervalQuantization"))
+    {
+        double minimum, maximum, steps;
+        if(findMsgNumber(step, "min", &minimum) != 0 || findMsgNumber(step, "max", &maximum) != 0 ||
+           findMsgNumber(step, "numSteps", &steps) != 0 || steps < 2)
+        {
+            return FILE_BAD_BINARY_CIF;
+        }
+        for(size_t i = 0; i < *count; i++)
+        {
+            in[i] = minimum + (maximum - minimum) / (steps - 1) * in[i];
+        }
+    }
+    else if(equalsText(kind, kindLength, "Delta"))
+    {
+        double origin;
+        if(findMsgNumber(step, "origin", &origin) != 0)
+        {
+            return FILE_BAD_BINARY_CIF;
+        }
+        for(size_t i = 0; i < *count; i++)
+        {
+            origin += in[i];
+            in[i] = origin;
+        }
+    }
+    else if(equalsText(kind, kindLength, "RunLength"))
+    {
+        size_t total = 0, filled = 0;
+        double *out;
+        if(*count % 2 != 0)
+        {
+            return FILE_BAD_BINARY_CIF;
+        }
+        for(size_t i = 1; i < *count; i += 2)
+        {
+            if(!(in[i] >= 0 && in[i] <= INT_MAX) || (total += (size_t)in[i]) > INT_MAX)
+            {
+                return FILE_BAD_BINARY_CIF;
+            }
+        }
+        out = malloc((total > 0 ? total : 1) * sizeof(double));
+        if(out == NULL)
+        {
+            return FILE_NO_MEMORY;
+        }
+        for(size_t i = 0; i < *count; i += 2)
+        {
+            for(size_t k = 0; k < (size_t)in[i + 1]; k++)
+            {
+                out[filled++] = in[i];
+            }
+        }
+        free(in);
+        *values = out;
+        *count = total;
+    }
+    else if(equalsText(kind, kindLength, "IntegerPacking"))
+    {
+        double byteCount, isUnsigned, upper, lower;
+        size_t filled = 0;
+        if(findMsgNumber(step, "byteCount", &byteCount) != 0 || findMsgNumber(step, "isUnsigned", &isUnsigned) != 0 ||
+           (byteCount != 1 && byteCount != 2))
+        {
+            return FILE_BAD_BINARY_CIF;
+        }
+        //a value past the limits of the packed type is written as a sum of limits and a rest
+        upper = isUnsigned ? (byteCount == 1 ? UINT8_MAX : UINT16_MAX) : (byteCount == 1 ? INT8_MAX : INT16_MAX);
+        lower = isUnsigned ? -1 : -upper - 1;
+        for(size_t i = 0; i < *count; i++)
+        {
+            double value = 0;
+            while(i + 1 < *count && (in[i] == upper || in[i] == lower))
+            {
+                value += in[i++];
+            }
+            in[filled++] = value + in[i];
+        }
+        *count = filled;
+    }
+    else
+    {
+        return FILE_BAD_BINARY_CIF;
+    }
+    return FILE_OK;
+}
+
+/**
+ * Gets a column.
+ * Responsible for freeing its decoded values.
+ * @param column
+ */
+void freeCifColumn(CifColumn *column)
+{
+    free(column->values);
+    free(column->offsets);
+    free(column->mask);
+    memset(column, 0, sizeof(*column));
+}
+
+/**
+ * Gets a decoded string column, a row and the text to fill.
+ * Responsible for finding the string of the row.
+ * @param column
+ * @param row
+ * @param text NULL when the column is missing, masked or isn't a string column
+ * @param length
+ * @return 1 if the row has a string, 0 otherwise
+ */
+int cifColumnString(const CifColumn *column, int row, const char **text, int *length)
+{
+    double index;
+
+    *text = NULL;
+    *length = 0;
+    if(column->values == NULL || column->offsets == NULL || (column->mask != NULL && column->mask[row] != 0))
+    {
+        return 0;
+    }
+    index = column->values[row];
+    if(!(index >= 0 && index + 1 < column->offsetCount)) //NAN is no index either
+    {
+        return 0;
+    }
+    *text = column->text + (size_t)column->offsets[(int)index];
+    *length = (int)(column->offsets[(int)index + 1] - column->offsets[(int)index]);
+    return 1;
+}
+
+/**
+ * Gets a decoded column, a row and the integer to fill.
+ * Responsible for reading the integer of the row from a numeric or a string column.
+ * @param column
+ * @param row
+ * @param value
+ * @return 1 if the row has an integer, 0 otherwise
+ */
+int cifColumnInteger(const CifColumn *column, int row, int *value)
+{
+    const char *text;
+    int length;
+
+    if(column->offsets != NULL)
+    {
+        return cifColumnString(column, row, &text, &length) && parseCifInteger(text, length, value) == 0;
+    }
+    if(column->values == NULL || (column->mask != NULL && column->mask[row] != 0) ||
+       !(column->values[row] >= INT_MIN && column->values[row] <= INT_MAX))
+    {
+        return 0;
+    }
+    *value = (int)column->values[row];
+    return 1;
+}
+
+/**
+ * Gets a reader and the length and the number to fill.
+ * Responsible for reading the header of the next MessagePack value, the reader
+ * is left on the bytes of a string or an extension and on the first item of
+ * an array or a map. A length is checked against the bytes left.
+ * @param reader
+ * @param length the bytes of a string or an extension, the items of an array or the pairs of a map
+ * @param number the value of a number or a boolean
+ * @return the kind of the value
+ */
+MsgKind readMsgHeader(MsgReader *reader, uint64_t *length, double *number)
+{
+    size_t left = reader->size - reader->position;
+    const uint8_t *bytes = reader->data + reader->position;
+    MsgKind kind;
+    int fieldBytes;
+    uint64_t field;
+
+    *length = 0;
+    *number = 0;
+    if(left == 0)
+    {
+        return MSG_INVALID;
+    }
+    reader->position++;
+    left--;
+    if(bytes[0] <= 0x7f || bytes[0] >= 0xe0) //the positive and the negative fixint
+    {
+        *number = bytes[0] <= 0x7f ? bytes[0] : (int8_t)bytes[0];
+        return MSG_NUMBER;
+    }
+    if(bytes[0] <= 0xbf) //fixmap, fixarray and fixstr
+    {
+        kind = bytes[0] <= 0x8f ? MSG_MAP : bytes[0] <= 0x9f ? MSG_ARRAY : MSG_STRING;
+        *length = bytes[0] & (kind == MSG_STRING ? 0x1f : 0x0f);
+        return *length <= left ? kind : MSG_INVALID;
+    }
+    switch(bytes[0])
+    {
+        case 0xc0:
+            return MSG_NIL;
+        case 0xc2:
+        case 0xc3:
+            *number = bytes[0] == 0xc3;
+            return MSG_BOOLEAN;
+        case 0xc4: //bin 8, 16 and 32
+        case 0xc5:
+        case 0xc6:
+            kind = MSG_STRING;
+            fieldBytes = 1 << (bytes[0] - 0xc4);
+            break;
+        case 0xc7: //ext 8, 16 and 32
+        case 0xc8:
+        case 0xc9:
+            kind = MSG_EXTENSION;
+            fieldBytes = 1 << (bytes[0] - 0xc7);
+            break;
+        case 0xca: //float 32 and 64
+        case 0xcb:
+            kind = MSG_NUMBER;
+            fieldBytes = bytes[0] == 0xca ? 4 : 8;
+            break;
+        case 0xcc: //uint 8 to 64 and int 8 to 64
+        case 0xcd:
+        case 0xce:
+        case 0xcf:
+        case 0xd0:
+        case 0xd1:
+        case 0xd2:
+        case 0xd3:
+            kind = MSG_NUMBER;
+            fieldBytes = 1 << ((bytes[0] - 0xcc) % 4);
+            break;
+        case 0xd4: //fixext 1 to 16, the type and the data
+        case 0xd5:
+        case 0xd6:
+        case 0xd7:
+        case 0xd8:
+            *length = (1 << (bytes[0] - 0xd4)) + 1;
+            return *length <= left ? MSG_EXTENSION : MSG_INVALID;
+        case 0xd9: //str 8, 16 and 32
+        case 0xda:
+        case 0xdb:
+            kind = MSG_STRING;
+            fieldBytes = 1 << (bytes[0] - 0xd9);
+            break;
+        case 0xdc: //array 16 and 32, map 16 and 32
+        case 0xdd:
+        case 0xde:
+        case 0xdf:
+            kind = bytes[0] <= 0xdd ? MSG_ARRAY : MSG_MAP;
+            fieldBytes = bytes[0] == 0xdc || bytes[0] == 0xde ? 2 : 4;
+            break;
+        default:
+            return MSG_INVALID;
+    }
+    if(left < (size_t)fieldBytes)
+    {
+        return MSG_INVALID;
+    }
+    field = readBigEndian(bytes + 1, fieldBytes);
+    reader->position += fieldBytes;
+    left -= fieldBytes;
+    if(kind != MSG_NUMBER)
+    {
+        *length = field + (kind == MSG_EXTENSION); //the type of an extension is before its data
+        return *length <= left ? kind : MSG_INVALID; //every item of an array or a map takes a byte at least
+    }
+    if(bytes[0] == 0xca)
+    {
+        uint32_t word = (uint32_t)field;
+        float single;
+        memcpy(&single, &word, sizeof(single));
+        *number = single;
+    }
+    else if(bytes[0] == 0xcb)
+    {
+        memcpy(number, &field, sizeof(double));
+    }
+    else if(bytes[0] <= 0xcf)
+    {
+        *number = (double)field;
+    }
+    else
+    {
+        *number = fieldBytes == 1 ? (int8_t)field : fieldBytes == 2 ? (int16_t)field :
+                  fieldBytes == 4 ? (int32_t)field : (double)(int64_t)field;
+    }
+    return MSG_NUMBER;
+}
+
+/**
+ * Gets a reader.
+ * Responsible for moving it past the next value with everything it holds,
+ * the items still to skip are counted instead of recursing.
+ * @param reader
+ * @return 0 for success, -1 if the value is invalid or truncated
+ */
+int skipMsgValue(MsgReader *reader)
+{
+    uint64_t pending = 1, length;
+    double number;
+
+    while(pending > 0)
+    {
+        MsgKind kind = readMsgHeader(reader, &length, &number);
+        pending--;
+        if(kind == MSG_INVALID)
+        {
+            return -1;
+        }
+        if(kind == MSG_STRING || kind == MSG_EXTENSION)
+        {
+            reader->position += length;
+        }
+        else if(kind == MSG_ARRAY)
+        {
+            pending += length;
+        }
+        else if(kind == MSG_MAP)
+        {
+            pending += 2 * length;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Gets a reader on a map, a key and the reader to fill.
+ * Responsible for finding the value of the key, the map reader isn't moved.
+ * @param map
+ * @param key
+ * @param value left on the value
+ * @return 0 for success, -1 if the map hasn't the key or isn't a map
+ */
+int findMsgKey(MsgReader map, const char *key, MsgReader *value)
+{
+    uint64_t count;
+    double number;
+
+    if(readMsgHeader(&map, &count, &number) != MSG_MAP)
+    {
+        return -1;
+    }
+    for(uint64_t i = 0; i < count; i++)
+    {
+        MsgReader name = map;
+        const char *text;
+        size_t length;
+        int found = readMsgString(&name, &text, &length) == 0 && equalsText(text, length, key);
+
+        if(skipMsgValue(&map) != 0)
+        {
+            return -1;
+        }
+        if(found)
+        {
+            *value = map;
+            return 0;
+        }
+        if(skipMsgValue(&map) != 0)
+        {
+            return -1;
+        }
+    }
+    return -1;
+}
 
-//*******************************************************************************************
+/**
+ * Gets a reader on a map, a key and the number to fill.
+ * Responsible for reading the number of the key.
+ * @param map
+ * @param key
+ * @param number
+ * @return 0 for success, -1 if the map hasn't the key or it isn't a number
+ */
+int findMsgNumber(MsgReader map, const char *key, double *number)
+{
+    MsgReader value;
 
+    return findMsgKey(map, key, &value) == 0 ? readMsgNumber(&value, number) : -1;
+}
 
 /**
- * Gets relevant arguments for running the program.
- * Passing over the files calculates the relevant equations by calling to the relevant functions.
- * Return 0 if the program ran successfuly.
- * @param argc
- * @param argv
- * @return int 0 for success
+ * Gets a reader and the text to fill.
+ * Responsible for reading a string or a bin, the text isn't terminated.
+ * @param reader
+ * @param text
+ * @param length
+ * @return 0 for success, -1 if the value isn't a string
  */
-int main(int argc, char *argv[])
+int readMsgString(MsgReader *reader, const char **text, size_t *length)
 {
-    FILE *fp;
-    char fileLine[MAX_LINE] = {0};
-    float fileAtoms[MAX_ATOMS][COORDINATES] = {{0}};
-    int atomCounter;
-    float gravityCenter[3];
+    uint64_t size;
+    double number;
 
-    if(argc < MIN_ARGS) //checks if no arguments entered
+    if(readMsgHeader(reader, &size, &number) != MSG_STRING)
     {
-        printf("Usage: AnalyzeProtein <pdb1> <pdb2>");
-        return 1;
+        return -1;
+    }
+    *text = (const char *)reader->data + reader->position;
+    *length = size;
+    reader->position += size;
+    return 0;
+}
+
+/**
+ * Gets a reader and the number to fill.
+ * Responsible for reading a number, a boolean is 0 or 1.
+ * @param reader
+ * @param number
+ * @return 0 for success, -1 if the value isn't a number
+ */
+int readMsgNumber(MsgReader *reader, double *number)
+{
+    uint64_t length;
+    MsgKind kind = readMsgHeader(reader, &length, number);
+
+    return kind == MSG_NUMBER || kind == MSG_BOOLEAN ? 0 : -1;
+}
+
+/**
+ * Gets a text that isn't terminated with its length and a string.
+ * Return 1 if they are equal, 0 otherwise.
+ * @param text
+ * @param length
+ * @param expected
+ * @return the result
+ */
+int equalsText(const char *text, size_t length, const char *expected)
+{
+    return strlen(expected) == length && memcmp(text, expected, length) == 0;
+}
+
+/**
+ * Gets bytes and their number, up to 8.
+ * Return the big endian number they hold.
+ * @param bytes
+ * @param count
+ * @return the number
+ */
+uint64_t readBigEndian(const uint8_t *bytes, int count)
+{
+    uint64_t value = 0;
 
+    for(int k = 0; k < count; k++)
+    {
+        value = value << 8 | bytes[k];
     }
+    return value;
+}
+
+//*********************************** RMSD **************************************************
+/**
+ * Gets the stored atoms of a frame, its center of gravity and where the frame came from.
+ * Responsible for keeping a copy of the atoms centered on the center of gravity
+ * for the RMSD matrix, so the files don't have to be parsed again.
+ * Return 0 for success, -1 if there is no memory.
+ * @param atoms
+ * @param gravityCenter
+ * @param file
+ * @param frame
+ * @param model
+ * @return 0 for success
+ */
+int keepRmsdStructure(const AtomStore *atoms, const float gravityCenter[3], int file, int frame, int model)
+{
+    RmsdStructure structure;
+    void *coordinates;
+    int failed = 0;
 
-    for (int i = 1; i < argc; i++)
+    structure.atomCount = atoms->count;
+    structure.stride = (atoms->count + RMSD_LANES - 1) / RMSD_LANES * RMSD_LANES;
+    structure.squaredNorm = 0;
+    structure.file = file;
+    structure.frame = frame;
+    structure.model = model;
+    if(posix_memalign(&coordinates, STORE_ALIGNMENT, sizeof(float) * COORDINATES * structure.stride) != 0)
     {
-        atomCounter = 0;
-        fp = fopen(argv[i], "r");
-        if(fp == NULL) // if the file couldn't open
+        return -1;
+    }
+    structure.coordinates = coordinates;
+    for(int k = 0; k < COORDINATES; k++)
+    {
+        float *lane = structure.coordinates + (size_t)k * structure.stride;
+        for(int i = 0; i < atoms->count; i++)
         {
-            printf("Error opening file: %s", argv[i]);
-            return 1;
+            lane[i] = atoms->lane[k][i] - gravityCenter[k];
+            structure.squaredNorm += (double)lane[i] * lane[i];
+        }
+        for(int i = atoms->count; i < structure.stride; i++)
+        {
+            lane[i] = 0;
         }
+    }
 
-        while(fgets(fileLine, MAX_LINE, fp))
+    pthread_mutex_lock(&rmsdSet.lock);
+    if(rmsdSet.count == rmsdSet.capacity)
+    {
+        int capacity = rmsdSet.capacity == 0 ? STORE_INITIAL_CAPACITY : rmsdSet.capacity * 2;
+        RmsdStructure *structures = realloc(rmsdSet.structures, sizeof(RmsdStructure) * capacity);
+        if(structures == NULL)
+        {
+            failed = -1;
+        }
+        else
         {
+            rmsdSet.structures = structures;
+            rmsdSet.capacity = capacity;
+        }
+    }
+    if(!failed)
+    {
+        rmsdSet.structures[rmsdSet.count++] = structure;
+    }
+    pthread_mutex_unlock(&rmsdSet.lock);
+    if(failed)
+    {
+        free(structure.coordinates);
+    }
+    return failed;
+}
+
+/**
+ * Gets two kept structures.
+ * Responsible for ordering the structures by their file and then by their
+ * order within the file, the order of the results whatever the number of jobs.
+ * @param first
+ * @param second
+ * @return negative, 0 or positive as for qsort
+ */
+int compareRmsdStructures(const void *first, const void *second)
+{
+    const RmsdStructure *a = first, *b = second;
+
+    if(a->file != b->file)
+    {
+        return a->file < b->file ? -1 : 1;
+    }
+    return (a->frame > b->frame) - (a->frame < b->frame);
+}
 
-            if (startsWith(fileLine))
+/**
+ * Gets the paths of the files and the number of threads.
+ * Responsible for calculating the RMSD of every pair of the kept structures
+ * and writing them to the RMSD file, one CSV line per pair i < j in the order
+ * of the files and their models. The RMSD of two structures with different
+ * numbers of atoms is left empty.
+ * @param paths
+ * @param threads
+ * @return 0 for success, 1 if there is no memory for the matrix
+ */
+int writeRmsdMatrix(char *paths[], int threads)
+{
+    const RmsdStructure *structures;
+    float *matrix;
+    long pair = 0;
+
+    if(rmsdSet.count < 2)
+    {
+        return 0;
+    }
+    qsort(rmsdSet.structures, rmsdSet.count, sizeof(RmsdStructure), compareRmsdStructures);
+    matrix = calRmsdMatrix(&rmsdSet, threads);
+    if(matrix == NULL)
+    {
+        fprintf(stderr, "Error allocating the RMSD matrix of %d structures\n", rmsdSet.count); //the results are already on stdout
+        return 1;
+    }
+
+    structures = rmsdSet.structures;
+    for(int i = 0; i < rmsdSet.count; i++)
+    {
+        for(int j = i + 1; j < rmsdSet.count; j++, pair++)
+        {
+            const RmsdStructure *pairStructures[2] = {&structures[i], &structures[j]};
+            for(int k = 0; k < 2; k++)
             {
-                if(strlen(fileLine) > MIN_LINE_LEN)
+                if(k > 0)
                 {
-                    parseLine(fileLine, atomCounter, fileAtoms);
-                    atomCounter ++;
+                    fputc(',', rmsdFile);
+                }
+                printCsvString(rmsdFile, paths[pairStructures[k]->file]);
+                if(pairStructures[k]->model == NO_MODEL)
+                {
+                    fputc(',', rmsdFile);
                 }
                 else
                 {
-                    printf("ATOM line is too short %lu characters", strlen(fileLine));
-                    exit(EXIT_FAILURE);
+                    fprintf(rmsdFile, ",%d", pairStructures[k]->model);
                 }
-
             }
-
-        }
-        //checks if problem accoured while reading a line
-        if(feof(fp) == 0 || atomCounter == 0)
-        {
-            printf("Error - 0 atoms were found in the file %s", argv[i]);
-            return 1;
+            if(isnan(matrix[pair]))
+            {
+                fputs(",\n", rmsdFile);
+            }
+            else
+            {
+                fprintf(rmsdFile, ",%.3f\n", matrix[pair]);
+            }
         }
-
-        fclose(fp);
-
-        printf("PDB file %s, %d atoms were read\n", argv[i], atomCounter);
-        calCenterOfGravity(atomCounter, fileAtoms, gravityCenter);
-        calRotationRadious(atomCounter, fileAtoms, gravityCenter);
-        calMaxDistance(atomCounter, fileAtoms);
-
     }
-
+    free(matrix);
     return 0;
 }
 
-
 /**
- * Gets a string line and checks if the line starts with the substring "ATOM"
- * return 0 for true 1 otherwise
- * @param line
- * @return the result
+ * Gets the sorted structures and the number of threads.
+ * Responsible for splitting the pairs i < j to tiles that the threads take one
+ * by one, every pair is written to its own place so the threads share nothing else.
+ * Return the condensed upper triangle, the RMSD of i < j at
+ * i * count - i * (i + 1) / 2 + j - i - 1, NULL if there is no memory.
+ * @param set
+ * @param threads
+ * @return the RMSD of the pairs
  */
-int startsWith(char* line)
+float *calRmsdMatrix(const RmsdSet *set, int threads)
 {
-    return (strncmp(line, LINE_STARTER, LINE_STARTER_LEN) == 0);
+    RmsdTiles tiles;
+    pthread_t *handles = malloc(sizeof(pthread_t) * threads);
+    int started = 0;
+
+    tiles.set = set;
+    tiles.matrix = malloc(sizeof(float) * ((size_t)set->count * (set->count - 1) / 2));
+    tiles.blockCount = (set->count + RMSD_TILE - 1) / RMSD_TILE;
+    tiles.tileCount = (long)tiles.blockCount * (tiles.blockCount + 1) / 2;
+    tiles.nextTile = 0;
+    if(tiles.matrix == NULL || handles == NULL)
+    {
+        free(handles);
+        if(tiles.matrix != NULL)
+        {
+            rmsdWorker(&tiles);
+        }
+        return tiles.matrix;
+    }
 
+    //this thread is the first worker
+    while(started + 1 < threads && pthread_create(&handles[started + 1], NULL, rmsdWorker, &tiles) == 0)
+    {
+        started++;
+    }
+    rmsdWorker(&tiles);
+    for(int t = 1; t <= started; t++)
+    {
+        pthread_join(handles[t], NULL);
+    }
+    free(handles);
+    return tiles.matrix;
 }
 
 /**
- * Gets a string line, number of atoms, and a two dimensional array
- * Responsible for parsing the line, gets the relevant substrings
- * and enters them to the atoms array.
- * @param fileLine
- * @param atomCounter
- * @param fileAtoms
- * @return 0 for success
+ * Gets the tiles of the RMSD matrix.
+ * Responsible for taking tiles until there are none left and writing the RMSD
+ * of their pairs to the matrix.
+ * @param tilesPointer
+ * @return NULL
  */
-int parseLine(char *fileLine, int atomCounter, float fileAtoms[MAX_ATOMS][COORDINATES])
+void *rmsdWorker(void *tilesPointer)
 {
-    char cgString[COORDINATE_LEN + 1], radString[COORDINATE_LEN + 1], disString[COORDINATE_LEN + 1];
+    RmsdTiles *tiles = tilesPointer;
+    const RmsdStructure *structures = tiles->set->structures;
+    int count = tiles->set->count;
+    long tile;
 
+    while((tile = __atomic_fetch_add(&tiles->nextTile, 1, __ATOMIC_RELAXED)) < tiles->tileCount)
+    {
+        int rowBlock, columnBlock;
+        locateTile(tile, tiles->blockCount, &rowBlock, &columnBlock);
+        int rowEnd = (rowBlock + 1) * RMSD_TILE < count ? (rowBlock + 1) * RMSD_TILE : count;
+        int columnEnd = (columnBlock + 1) * RMSD_TILE < count ? (columnBlock + 1) * RMSD_TILE : count;
 
-    memcpy(cgString, fileLine + 30, COORDINATE_LEN);
-    cgString[COORDINATE_LEN] = END_OF_STRING;
+        for(int i = rowBlock * RMSD_TILE; i < rowEnd; i++)
+        {
+            long rowStart = (long)i * count - (long)i * (i + 1) / 2 - i - 1; //the pair (i, 0), before the row
+            int columnStart = columnBlock == rowBlock ? i + 1 : columnBlock * RMSD_TILE;
+            for(int j = columnStart; j < columnEnd; j++)
+            {
+                tiles->matrix[rowStart + j] = (float)calPairRmsd(&structures[i], &structures[j]);
+            }
+        }
+    }
+    return NULL;
+}
 
-    memcpy(radString, fileLine + 38, COORDINATE_LEN);
-    radString[COORDINATE_LEN] = END_OF_STRING;
+/**
+ * Gets two centered structures.
+ * Responsible for summing the nine inner products of their coordinates, the
+ * matrix whose rotation the superposition looks for, and solving it by QCP.
+ * The sums run in RMSD_LANES independent doubles over the padded lanes.
+ * Return the RMSD after the optimal superposition, NAN if the numbers of atoms differ.
+ * @param first
+ * @param second
+ * @return the RMSD
+ */
+double calPairRmsd(const RmsdStructure *first, const RmsdStructure *second)
+{
+    const float *x1 = first->coordinates, *y1 = x1 + first->stride, *z1 = y1 + first->stride;
+    const float *x2 = second->coordinates, *y2 = x2 + second->stride, *z2 = y2 + second->stride;
+    double sums[INNER_PRODUCTS][RMSD_LANES] = {{0}};
+    double products[INNER_PRODUCTS] = {0};
 
-    memcpy(disString, fileLine + 46, COORDINATE_LEN);
-    disString[COORDINATE_LEN] = END_OF_STRING;
+    if(first->atomCount != second->atomCount)
+    {
+        return NAN;
+    }
+    for(int i = 0; i < first->stride; i += RMSD_LANES)
+    {
+        for(int l = 0; l < RMSD_LANES; l++)
+        {
+            double ax = x1[i + l], ay = y1[i + l], az = z1[i + l];
+            double bx = x2[i + l], by = y2[i + l], bz = z2[i + l];
+            sums[0][l] += ax * bx;
+            sums[1][l] += ax * by;
+            sums[2][l] += ax * bz;
+            sums[3][l] += ay * bx;
+            sums[4][l] += ay * by;
+            sums[5][l] += ay * bz;
+            sums[6][l] += az * bx;
+            sums[7][l] += az * by;
+            sums[8][l] += az * bz;
+        }
+    }
+    for(int p = 0; p < INNER_PRODUCTS; p++)
+    {
+        for(int l = 0; l < RMSD_LANES; l++)
+        {
+            products[p] += sums[p][l];
+        }
+    }
+    return solveQcp(products, (first->squaredNorm + second->squaredNorm) / 2, first->atomCount);
+}
 
-    fileAtoms[atomCounter][0] = getFloat(cgString);
-    fileAtoms[atomCounter][1] = getFloat(radString);
-    fileAtoms[atomCounter][2] = getFloat(disString);
+/**
+ * Gets the inner products xx, xy, ... zz of two centered structures, half the
+ * sum of their squared norms and the number of atoms.
+ * Responsible for the quaternion characteristic polynomial (Theobald 2005, Liu et al. 2010):
+ * the largest eigenvalue of the 4 x 4 key matrix is found by Newton's method
+ * from the half sum of the norms, an upper bound of it, without forming the
+ * matrix or decomposing anything.
+ * Return the RMSD after the optimal rotation.
+ * @param products
+ * @param innerProduct
+ * @param atomCount
+ * @return the RMSD
+ */
+double solveQcp(const double products[INNER_PRODUCTS], double innerProduct, int atomCount)
+{
+    double sxx = products[0], sxy = products[1], sxz = products[2];
+    double syx = products[3], syy = products[4], syz = products[5];
+    double szx = products[6], szy = products[7], szz = products[8];
+    double sxx2 = sxx * sxx, syy2 = syy * syy, szz2 = szz * szz;
+    double sxy2 = sxy * sxy, syz2 = syz * syz, sxz2 = sxz * sxz;
+    double syx2 = syx * syx, szy2 = szy * szy, szx2 = szx * szx;
+    double syzSzyMinusSyySzz2 = 2 * (syz * szy - syy * szz);
+    double squares = syy2 + szz2 - sxx2 + syz2 + szy2;
+    double c2 = -2 * (sxx2 + syy2 + szz2 + sxy2 + syx2 + sxz2 + szx2 + syz2 + szy2);
+    double c1 = 8 * (sxx * syz * szy + syy * szx * sxz + szz * sxy * syx - sxx * syy * szz - syz * szx * sxy -
+                     szy * syx * sxz);
+    double sxzPlusSzx = sxz + szx, syzPlusSzy = syz + szy, sxyPlusSyx = sxy + syx;
+    double syzMinusSzy = syz - szy, sxzMinusSzx = sxz - szx, sxyMinusSyx = sxy - syx;
+    double sxxPlusSyy = sxx + syy, sxxMinusSyy = sxx - syy;
+    double crossSquares = sxy2 + sxz2 - syx2 - szx2;
+    double c0 = crossSquares * crossSquares +
+                (squares + syzSzyMinusSyySzz2) * (squares - syzSzyMinusSyySzz2) +
+                (-sxzPlusSzx * syzMinusSzy + sxyMinusSyx * (sxxMinusSyy - szz)) *
+                    (-sxzMinusSzx * syzPlusSzy + sxyMinusSyx * (sxxMinusSyy + szz)) +
+                (-sxzPlusSzx * syzPlusSzy - sxyPlusSyx * (sxxPlusSyy - szz)) *
+                    (-sxzMinusSzx * syzMinusSzy - sxyPlusSyx * (sxxPlusSyy + szz)) +
+                (sxyPlusSyx * syzPlusSzy + sxzPlusSzx * (sxxMinusSyy + szz)) *
+                    (-sxyMinusSyx * syzMinusSzy + sxzPlusSzx * (sxxPlusSyy + szz)) +
+                (sxyPlusSyx * syzMinusSzy + sxzMinusSzx * (sxxMinusSyy - szz)) *
+                    (-sxyMinusSyx * syzPlusSzy + sxzMinusSzx * (sxxPlusSyy - szz));
+    double eigenvalue = innerProduct;
 
+    for(int i = 0; i < RMSD_MAX_ITERATIONS; i++)
+    {
+        double previous = eigenvalue;
+        double squared = eigenvalue * eigenvalue;
+        double b = (squared + c2) * eigenvalue;
+        double a = b + c1;
+        double denominator = 2 * squared * eigenvalue + b + a;
+        if(denominator == 0)
+        {
+            break;
+        }
+        eigenvalue -= (a * eigenvalue + c0) / denominator;
+        if(fabs(eigenvalue - previous) < fabs(RMSD_PRECISION * eigenvalue))
+        {
+            break;
+        }
+    }
+    return sqrt(fabs(2 * (innerProduct - eigenvalue) / atomCount));
+}
 
-    return 0;
+/**
+ * Gets the kept structures.
+ * Responsible for releasing their coordinates and the set.
+ * @param set
+ */
+void freeRmsdSet(RmsdSet *set)
+{
+    for(int i = 0; i < set->count; i++)
+    {
+        free(set->structures[i].coordinates);
+    }
+    free(set->structures);
+    set->structures = NULL;
+    set->count = set->capacity = 0;
 }
 
+//*********************************** offload ***********************************************
+/**
+ * Gets the name of the device, "auto" offloads the frames of at least
+ * OFFLOAD_MIN_ATOMS atoms when there is a device and "gpu" offloads every frame.
+ * Responsible for setting the size of the frames whose pairwise distances
+ * run on the device, used by all the threads.
+ * @param name
+ * @return 0 for success, -1 if the device is unknown or there is none
+ */
+int selectDevice(const char *name)
+{
+    offloadMinAtoms = INT_MAX;
+    if(strcmp(name, DEVICE_CPU) == 0)
+    {
+        return 0;
+    }
+#ifdef HAVE_OFFLOAD
+    if(omp_get_num_devices() > 0)
+    {
+        if(strcmp(name, DEVICE_AUTO) == 0)
+        {
+            offloadMinAtoms = OFFLOAD_MIN_ATOMS;
+            return 0;
+        }
+        if(strcmp(name, DEVICE_GPU) == 0)
+        {
+            offloadMinAtoms = 0;
+            return 0;
+        }
+    }
+#endif
+    return strcmp(name, DEVICE_AUTO) == 0 ? 0 : -1;
+}
 
 /**
- * Gets a pointer to the input
- * Responsible for converting the input value to a float.
- * @param input
- * @return the result of the float.
+ * Gets the stored atoms of a frame, or NULL, and the options.
+ * Responsible for copying the lanes to the device once when the brute force
+ * Dmax or the contacts of the frame run there, the kernels find them present.
+ * Return 1 if the atoms were copied and have to be released.
+ * @param atoms
+ * @param options
+ * @return 1 if the atoms are on the device
  */
-float getFloat(char* input)
+int uploadAtoms(const AtomStore *atoms, const Options *options)
 {
-    char *end;
-    float result = 0;
-    errno = 0;
-    result = strtof(input, &end);
-    if(result == 0 && (errno != 0 || end == input))
+#ifdef HAVE_OFFLOAD
+    int pairwise = options->contactCutoff > 0 || (options->maxDistance && options->engine == DMAX_ENGINE_BRUTE_FORCE);
+    if(atoms != NULL && atoms->count >= offloadMinAtoms && pairwise)
     {
-        fprintf(stderr, "Error in coordinate conversion %s", input);
-        exit(EXIT_FAILURE);
+        const float *x = atoms->lane[0], *y = atoms->lane[1], *z = atoms->lane[2];
+        int count = atoms->count;
+#pragma omp target enter data map(to: x[0:count], y[0:count], z[0:count])
+        (void)x; //GCC doesn't count the map clauses of a standalone directive as uses
+        (void)y;
+        (void)z;
+        return 1;
     }
-    return result;
+#else
+    (void)atoms;
+    (void)options;
+#endif
+    return 0;
 }
 
+/**
+ * Gets the stored atoms of a frame and whether they were copied to the device.
+ * Responsible for releasing the copy on the device.
+ * @param atoms
+ * @param resident
+ */
+void releaseAtoms(const AtomStore *atoms, int resident)
+{
+#ifdef HAVE_OFFLOAD
+    if(resident)
+    {
+        const float *x = atoms->lane[0], *y = atoms->lane[1], *z = atoms->lane[2];
+        int count = atoms->count;
+#pragma omp target exit data map(release: x[0:count], y[0:count], z[0:count])
+        (void)x;
+        (void)y;
+        (void)z;
+    }
+#else
+    (void)atoms;
+    (void)resident;
+#endif
+}
 
+#ifdef HAVE_OFFLOAD
 /**
- * Gets the number of atoms, two dimensional atoms array ,empty array of gravity
- * center with 3 coordinates.
- * Responsible for calculation of the gravity center, and fills the results in
- * the initialize gravity center array.
- * @param atomCounter
- * @param fileAtoms
- * @param gravityCenter
+ * Gets the atoms store.
+ * Responsible for the max squared distance of all the pairs i < j on the device.
+ * Every team takes a block of OFFLOAD_TILE rows and passes over the blocks of
+ * columns from its own one, each block of columns is loaded once to the memory
+ * of the team (the shared memory of a GPU) and read by all its threads.
+ * Return the max squared distance.
+ * @param atoms
+ * @return the max squared distance
  */
-void calCenterOfGravity(int atomCounter, float fileAtoms[MAX_ATOMS][COORDINATES], float gravityCenter[3])
+float calMaxSquaredDistanceDevice(const AtomStore *atoms)
 {
-    float xCorSum, yCorSum, zCorSum;
-    xCorSum = yCorSum = zCorSum = 0.0;
-    for (int i = 0; i < atomCounter; i++)
+    const float *x = atoms->lane[0], *y = atoms->lane[1], *z = atoms->lane[2];
+    int count = atoms->count;
+    int blockCount = (count + OFFLOAD_TILE - 1) / OFFLOAD_TILE;
+    float maxDistance = 0;
+
+#pragma omp target teams distribute reduction(max: maxDistance) thread_limit(OFFLOAD_TILE) \
+    map(to: x[0:count], y[0:count], z[0:count])
+    for(int rowBlock = 0; rowBlock < blockCount; rowBlock++)
     {
-        xCorSum += fileAtoms[i][0];
-        yCorSum += fileAtoms[i][1];
-        zCorSum += fileAtoms[i][2];
+        float tileX[OFFLOAD_TILE], tileY[OFFLOAD_TILE], tileZ[OFFLOAD_TILE];
+        int rowStart = rowBlock * OFFLOAD_TILE;
+        int rowEnd = rowStart + OFFLOAD_TILE < count ? rowStart + OFFLOAD_TILE : count;
+        float teamDistance = 0;
 
+#pragma omp parallel reduction(max: teamDistance)
+        {
+            int thread = omp_get_thread_num(), threadCount = omp_get_num_threads();
+            for(int columnBlock = rowBlock; columnBlock < blockCount; columnBlock++)
+            {
+                int columnStart = columnBlock * OFFLOAD_TILE;
+                int columnEnd = columnStart + OFFLOAD_TILE < count ? columnStart + OFFLOAD_TILE : count;
+#pragma omp barrier
+                for(int j = columnStart + thread; j < columnEnd; j += threadCount)
+                {
+                    tileX[j - columnStart] = x[j];
+                    tileY[j - columnStart] = y[j];
+                    tileZ[j - columnStart] = z[j];
+                }
+#pragma omp barrier
+                for(int i = rowStart + thread; i < rowEnd; i += threadCount)
+                {
+                    float px = x[i], py = y[i], pz = z[i];
+                    int first = columnBlock == rowBlock ? i + 1 : columnStart;
+                    for(int j = first; j < columnEnd; j++)
+                    {
+                        float dx = px - tileX[j - columnStart], dy = py - tileY[j - columnStart];
+                        float dz = pz - tileZ[j - columnStart];
+                        float squaredDistance = dx * dx + dy * dy + dz * dz;
+                        teamDistance = squaredDistance > teamDistance ? squaredDistance : teamDistance;
+                    }
+                }
+            }
+        }
+        maxDistance = teamDistance > maxDistance ? teamDistance : maxDistance;
     }
-    printf("Cg = %.3f %.3f %.3f\n", (xCorSum / atomCounter), (yCorSum / atomCounter), (zCorSum / atomCounter));
-    gravityCenter[0] = (xCorSum / atomCounter);
-    gravityCenter[1] = (yCorSum / atomCounter);
-    gravityCenter[2] = (zCorSum / atomCounter);
-
+    return maxDistance;
 }
 
-
 /**
- * Gets 6 coordinates.
- * Responsible for calculation of the distance between them.
- * Return float distance result.
- * @param xCor1
- * @param yCor1
- * @param zCor1
- * @param xCor2
- * @param yCor2
- * @param zCor2
- * @return result
+ * Gets the atoms of a frame, the cell grid built of them by the CPU, a cutoff
+ * and the neighbors to fill, or NULL.
+ * Responsible for counting the pairs of atoms within the cutoff on the device:
+ * every atom is a thread that looks at the 27 cells around its own one and
+ * counts all its neighbors, so no two threads write the same count and every
+ * pair is counted twice. Only the order and the cells of the grid are copied,
+ * the coordinates are the lanes of the frame already on the device.
+ * @param atoms
+ * @param grid
+ * @param cutoff
+ * @param neighborCounts zeroed, one per atom
+ * @return the number of pairs
  */
-float calDistance(float xCor1, float yCor1, float zCor1, float xCor2, float yCor2, float zCor2)
+long long calContactsDevice(const AtomStore *atoms, const CellGrid *grid, float cutoff, int *neighborCounts)
 {
-    return ((xCor1-xCor2)*(xCor1-xCor2) + ((yCor1-yCor2) * (yCor1-yCor2))
-                  + ((zCor1-zCor2) * (zCor1-zCor2)));
+    const float *x = atoms->lane[0], *y = atoms->lane[1], *z = atoms->lane[2];
+    const int *order = grid->order, *cellOf = grid->cellOf, *cellStart = grid->cellStart;
+    int count = atoms->count, cellCount = grid->cellCount;
+    int countsLength = neighborCounts != NULL ? count : 0;
+    int dimensionX = grid->dimension[0], dimensionY = grid->dimension[1], dimensionZ = grid->dimension[2];
+    float squaredCutoff = cutoff * cutoff;
+    long long contacts = 0;
+
+#pragma omp target teams distribute parallel for reduction(+: contacts) \
+    map(to: x[0:count], y[0:count], z[0:count], order[0:count], cellOf[0:count], cellStart[0:cellCount + 1]) \
+    map(from: neighborCounts[0:countsLength])
+    for(int k = 0; k < count; k++)
+    {
+        int atom = order[k], cell = cellOf[atom];
+        int cx = cell % dimensionX, cy = cell / dimensionX % dimensionY, cz = cell / dimensionX / dimensionY;
+        int low = cx > 0 ? cx - 1 : 0, high = cx + 1 < dimensionX ? cx + 1 : dimensionX - 1;
+        int neighbors = 0;
+        for(int nz = cz - 1; nz <= cz + 1; nz++)
+        {
+            for(int ny = cy - 1; ny <= cy + 1; ny++)
+            {
+                //the cells of a row are contiguous and so are their atoms
+                int rowCell = dimensionX * (ny + dimensionY * nz);
+                if(nz < 0 || nz >= dimensionZ || ny < 0 || ny >= dimensionY)
+                {
+                    continue;
+                }
+                for(int m = cellStart[rowCell + low]; m < cellStart[rowCell + high + 1]; m++)
+                {
+                    int other = order[m];
+                    float dx = x[atom] - x[other], dy = y[atom] - y[other], dz = z[atom] - z[other];
+                    neighbors += m != k && dx * dx + dy * dy + dz * dz <= squaredCutoff;
+                }
+            }
+        }
+        contacts += neighbors;
+        if(countsLength > 0)
+        {
+            neighborCounts[atom] = neighbors;
+        }
+    }
+    return contacts / 2;
 }
+#endif
 
+//*********************************** cross check *******************************************
 /**
- * Gets number of atoms, two dimensional atoms array, an array
- * represents the gravity center.
- * Responsible for calculation of the distance og each atom in the array
- * comparing to the gravity center coordinadtes.
- * Prints the rotation radious that was found by formula.
- * @param atomCounter
- * @param fileAtoms
- * @param gravityCenter
+ * Gets the stored atoms of a frame, its moments, its results, the options,
+ * the workspace and the name of the failed check to fill.
+ * Responsible for calculating the frame again by every engine and kernel and
+ * comparing them to the references: the pairwise sums in double for Cg and Rg,
+ * the scalar brute force for Dmax and the pairs of atoms one by one for the
+ * contacts. The references are O(n^2), the check is meant for validation runs.
+ * The two-pass Cg and Rg are checked only with the two-pass option, the one
+ * that uses them. Cg, Rg and Dmax agree within CROSS_CHECK_TOLERANCE plus the
+ * rounding of the float sums, n FLT_EPSILON of the largest coordinate, or of
+ * a float distance, the contacts exactly.
+ * @param atoms
+ * @param moments
+ * @param frame
+ * @param options
+ * @param workspace
+ * @param failed
+ * @return FILE_OK if all agree, FILE_CROSS_CHECK_FAILED with the check that didn't
  */
-void calRotationRadious(int atomCounter, float fileAtoms[MAX_ATOMS][COORDINATES], float gravityCenter[3])
+FileStatus crossCheckFrame(const AtomStore *atoms, const Moments *moments, const FrameResult *frame,
+                           const Options *options, Workspace *workspace, char failed[COORDINATE_LEN + 1])
 {
-    float rotationSum = 0.0;
-    float xCor1 = gravityCenter[0];
-    float yCor1 = gravityCenter[1];
-    float zCor1 = gravityCenter[2];
-    float tempdis;
+    RowMaxKernel rowMax[KERNEL_SETS];
+    RotationSumKernel rotationSum[KERNEL_SETS];
+    int kernelCount = listKernels(rowMax, rotationSum);
+    float center[COORDINATES], kernelCenter[COORDINATES], radius, maxDistance, largest = 0;
+    double distanceSlack, sumSlack;
+    const char *check = NULL;
+
+    for(int k = 0; k < COORDINATES; k++)
+    {
+        for(int i = 0; i < atoms->count; i++)
+        {
+            largest = fmaxf(largest, fabsf(atoms->lane[k][i]));
+        }
+    }
+    distanceSlack = COORDINATES * FLT_EPSILON * (double)largest; //a float distance, rounded on every coordinate
+    sumSlack = atoms->count * FLT_EPSILON * (double)largest; //a float sum of n terms
+
+    //Cg and Rg, the frame and the moments are weighted with the masses
+    calPairwiseMoments(atoms, center, &radius);
+    if(options->twoPass)
+    {
+        calCenterOfGravity(atoms, kernelCenter);
+    }
+    for(int k = 0; k < COORDINATES && check == NULL; k++)
+    {
+        if((options->twoPass && !agrees(kernelCenter[k], center[k], sumSlack)) ||
+           (!options->mass && (!agrees(moments->mean[k], center[k], distanceSlack) ||
+                               !agrees(frame->gravityCenter[k], center[k], sumSlack))))
+        {
+            check = "Cg";
+        }
+    }
+    if(check == NULL && !options->mass &&
+       (!agrees(momentsRotationRadius(moments), radius, distanceSlack) ||
+        !agrees(frame->rotationRadius, radius, sumSlack)))
+    {
+        check = "Rg";
+    }
+    for(int s = 0; s < kernelCount && check == NULL && options->twoPass; s++)
+    {
+        float sum = rotationSum[s](atoms->lane[0], atoms->lane[1], atoms->lane[2], atoms->count,
+                                   center[0], center[1], center[2]);
+        check = agrees(sqrt(sum / atoms->count), radius, sumSlack) ? NULL : "Rg";
+    }
 
-    for(int i = 0; i < atomCounter ; i++)
+    //Dmax, every exact engine and kernel against the scalar rows
+    maxDistance = sqrtf(calMaxSquaredDistanceRows(atoms, rowMaxScalar));
+    for(int s = 1; s < kernelCount && check == NULL; s++)
+    {
+        check = agrees(sqrtf(calMaxSquaredDistanceRows(atoms, rowMax[s])), maxDistance, distanceSlack) ? NULL : "Dmax";
+    }
+    if(check == NULL &&
+       (!agrees(sqrtf(calFarthestPairTiled(atoms, options->threads).squaredDistance), maxDistance, distanceSlack) ||
+        !agrees(sqrtf(calMaxSquaredDistanceHull(atoms, options->threads, workspace)), maxDistance, distanceSlack) ||
+        !agrees(sqrtf(calMaxSquaredDistancePruned(atoms, options->threads, workspace)), maxDistance, distanceSlack)))
+    {
+        check = "Dmax";
+    }
+#ifdef HAVE_OFFLOAD
+    if(check == NULL && offloadMinAtoms != INT_MAX &&
+       !agrees(sqrtf(calMaxSquaredDistanceDevice(atoms)), maxDistance, distanceSlack))
+    {
+        check = "Dmax";
+    }
+#endif
+    if(check == NULL && frame->hasMaxDistance)
     {
-        tempdis = calDistance(xCor1, yCor1, zCor1, fileAtoms[i][0], fileAtoms[i][1], fileAtoms[i][2]);
-        rotationSum += tempdis;
+        if(!agrees(frame->maxDistance, maxDistance, distanceSlack) &&
+           !(frame->approximate && frame->maxDistance <= maxDistance && maxDistance <= frame->maxDistanceBound))
+        {
+            check = "Dmax";
+        }
+    }
 
+    if(check == NULL && frame->contactCutoff > 0 &&
+       countContactsBruteForce(atoms, frame->contactCutoff) != frame->contacts)
+    {
+        check = "contacts";
+    }
+    if(check != NULL)
+    {
+        strcpy(failed, check);
+        return FILE_CROSS_CHECK_FAILED;
     }
-    rotationSum = sqrt(rotationSum / atomCounter);
-    printf("Rg = %.3f\n", rotationSum);
+    return FILE_OK;
+}
 
+/**
+ * Gets a value, its reference and the rounding error allowed to the value.
+ * Return 1 if they are within CROSS_CHECK_TOLERANCE of the reference, or of 1
+ * for a smaller one, plus the slack, so the float engines of large coordinates
+ * agree with the double references.
+ * @param value
+ * @param reference
+ * @param slack
+ * @return 1 if they agree
+ */
+int agrees(double value, double reference, double slack)
+{
+    return fabs(value - reference) <= CROSS_CHECK_TOLERANCE * fmax(1, fabs(reference)) + slack;
 }
 
 /**
- *  Gets number of atoms, two dimensional atoms array.
- * Responsible for calculation of the max distance between two atoms
- * by 3 coordinates.
- * Prints the max distance.
- * @param atomCounter
- * @param fileAtoms
+ * Gets the atoms store and a cutoff.
+ * Responsible for counting the pairs of atoms within the cutoff one pair at a time.
+ * Return the number of pairs.
+ * @param atoms
+ * @param cutoff
+ * @return the number of pairs
  */
-void calMaxDistance(int atomCounter, float fileAtoms[MAX_ATOMS][COORDINATES])
+long long countContactsBruteForce(const AtomStore *atoms, float cutoff)
 {
-    float maxDistance = 0.0;
-    float xCor1, yCor1, zCor1;
-    float tempDistance;
+    const float *x = atoms->lane[0], *y = atoms->lane[1], *z = atoms->lane[2];
+    float squaredCutoff = cutoff * cutoff;
+    long long contacts = 0;
 
-    //Passing all over the atoms in the array
-    for(int i = 0; i < atomCounter -1; i++)
+    for(int i = 0; i < atoms->count; i++)
     {
-        xCor1 = fileAtoms[i][0];
-        yCor1 = fileAtoms[i][1];
-        zCor1 = fileAtoms[i][2];
-        for(int j = 1; j < atomCounter; j++)
+        for(int j = i + 1; j < atoms->count; j++)
         {
-            tempDistance = sqrt(calDistance(xCor1, yCor1, zCor1, fileAtoms[j][0], fileAtoms[j][1], fileAtoms[j][2]));
-            if(maxDistance < tempDistance)
-            {//checks if the distance is bigger
-                maxDistance = tempDistance;
-            }
+            float dx = x[i] - x[j], dy = y[i] - y[j], dz = z[i] - z[j];
+            contacts += dx * dx + dy * dy + dz * dz <= squaredCutoff;
         }
-
     }
-    printf("Dmax = %.3f\n", maxDistance);
+    return contacts;
 }
-
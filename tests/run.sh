@@ -0,0 +1,125 @@
+#!/bin/sh
+# Golden output tests of AnalyzeProtein.
+# Runs the files of tests/data with every combination of the Dmax engine, the
+# SIMD kernels, the threads (-t), the parallel files (-j) and the parser, in
+# every output format, and diffs the output against tests/expected. The exact
+# engines share the golden files, the approximate one prints its bound too.
+# The engines are also checked against each other with --cross-check.
+#
+# Usage: tests/run.sh [BINARY] [--update]
+#   BINARY    the AnalyzeProtein to test, built from AnalyzeProtein.c if missing
+#   --update  writes the golden files from the scalar hull engine instead
+
+tests=$(cd "$(dirname "$0")" && pwd)
+root=$(dirname "$tests")
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+binary=
+update=0
+for argument in "$@"
+do
+    case $argument in
+        --update) update=1 ;;
+        *) binary=$argument ;;
+    esac
+done
+if [ -z "$binary" ]
+then
+    binary=$work/AnalyzeProtein
+    ${CC:-cc} -std=c99 -O2 -pthread "$root/AnalyzeProtein.c" -o "$binary" -lm || exit 1
+fi
+case $binary in
+    /*) ;;
+    *) binary=$(pwd)/$binary ;;
+esac
+
+inputs="small.pdb models.pdb models.cif far.pdb cluster.pdb"
+options="--contacts 4 --shape"
+formats="text csv json"
+cd "$tests/data" || exit 1
+
+if [ $update -eq 1 ]
+then
+    for format in $formats
+    do
+        "$binary" $options --format $format $inputs > "$tests/expected/exact.$format"
+        "$binary" $options --dmax approx --format $format $inputs > "$tests/expected/approx.$format"
+    done
+    echo "Updated the golden files in $tests/expected"
+    exit 0
+fi
+
+runs=0
+failures=0
+
+# Gets the golden file and the options of a run, diffs its output and counts it
+check()
+{
+    expected=$1
+    shift
+    runs=$((runs + 1))
+    "$binary" $options "$@" $inputs > "$work/output" 2>&1
+    if ! diff -u "$tests/expected/$expected" "$work/output" > "$work/diff"
+    then
+        failures=$((failures + 1))
+        echo "FAILED: $* (expected $expected)"
+        head -n 20 "$work/diff"
+    fi
+}
+
+for simd in scalar auto avx2 avx512 neon
+do
+    if ! "$binary" --simd $simd small.pdb > /dev/null 2>&1
+    then
+        echo "Skipping --simd $simd, not supported here"
+        continue
+    fi
+    for engine in hull brute pruned approx
+    do
+        golden=exact
+        if [ $engine = approx ]
+        then
+            golden=approx
+        fi
+        for threads in 1 4
+        do
+            for jobs in 1 3
+            do
+                for parser in fixed strtof
+                do
+                    for format in $formats
+                    do
+                        check $golden.$format --simd $simd --dmax $engine -t $threads -j $jobs --parser $parser \
+                              --format $format
+                    done
+                done
+            done
+        done
+    done
+    check exact.text --simd $simd --cross-check
+    check approx.text --simd $simd --dmax approx --cross-check
+    runs=$((runs + 1))
+    if "$binary" --simd $simd --two-pass --cross-check $inputs 2>&1 | grep "Error" > "$work/errors"
+    then
+        failures=$((failures + 1))
+        echo "FAILED: --simd $simd --two-pass --cross-check"
+        cat "$work/errors"
+    fi
+done
+
+# the approximate engine at the default tolerance must drop atoms and bound the Dmax, not run the hull
+runs=$((runs + 1))
+"$binary" --dmax approx $inputs > "$work/approx" 2>&1
+"$binary" --dmax hull $inputs > "$work/hull" 2>&1
+"$binary" --dmax approx --bench 20000 | grep -o '"dmax": [0-9.]*' >> "$work/approx"
+"$binary" --dmax hull --bench 20000 | grep -o '"dmax": [0-9.]*' >> "$work/hull"
+if ! grep -q "approximate, at most" "$work/approx" || grep -q "approximate" "$work/hull" ||
+   [ "$(tail -n 1 "$work/approx")" = "$(tail -n 1 "$work/hull")" ]
+then
+    failures=$((failures + 1))
+    echo "FAILED: --dmax approx gives the exact Dmax of --dmax hull"
+fi
+
+echo "$((runs - failures)) of $runs runs match"
+[ $failures -eq 0 ]